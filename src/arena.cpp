@@ -0,0 +1,110 @@
+#include "arena.h"
+
+#include <cJSON.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT 8
+
+bool oai_arena_init(oai_arena_t *arena, oai_mem_region_t region, size_t size,
+                    const char *owner) {
+  memset(arena, 0, sizeof(*arena));
+  arena->base = (uint8_t *)oai_mem_alloc(region, size, owner);
+  if (arena->base == NULL) {
+    return false;
+  }
+  arena->size = size;
+  return true;
+}
+
+void *oai_arena_alloc(oai_arena_t *arena, size_t size) {
+  size_t offset = (arena->used + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+  if (arena->base == NULL || offset + size > arena->size) {
+    return NULL;
+  }
+  arena->used = offset + size;
+  if (arena->used > arena->high_water) {
+    arena->high_water = arena->used;
+  }
+  return arena->base + offset;
+}
+
+void oai_arena_reset(oai_arena_t *arena) { arena->used = 0; }
+
+bool oai_arena_contains(const oai_arena_t *arena, const void *ptr) {
+  const uint8_t *p = (const uint8_t *)ptr;
+  return arena->base != NULL && p >= arena->base &&
+         p < arena->base + arena->size;
+}
+
+static oai_arena_t json_scratch;
+static thread_local bool json_scratch_active = false;
+
+static void *json_scratch_malloc(size_t size) {
+  if (json_scratch_active) {
+    void *ptr = oai_arena_alloc(&json_scratch, size);
+    if (ptr != NULL) {
+      return ptr;
+    }
+  }
+  return malloc(size);
+}
+
+static void json_scratch_free(void *ptr) {
+  if (!oai_arena_contains(&json_scratch, ptr)) {
+    free(ptr);
+  }
+}
+
+void oai_json_scratch_init(size_t size) {
+  if (!oai_arena_init(&json_scratch, OAI_MEM_PSRAM, size, "json_scratch")) {
+    return;
+  }
+  cJSON_Hooks hooks = {json_scratch_malloc, json_scratch_free};
+  cJSON_InitHooks(&hooks);
+}
+
+// Only one thread may hold the scratch arena at a time; message parsing all
+// happens on the network task.
+void oai_json_scratch_begin(void) {
+  oai_arena_reset(&json_scratch);
+  json_scratch_active = true;
+}
+
+void oai_json_scratch_end(void) {
+  json_scratch_active = false;
+  oai_arena_reset(&json_scratch);
+}
+
+#ifdef LINUX_BUILD
+#include <atomic>
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+}
+
+static std::atomic<uint32_t> alloc_count{0};
+
+uint32_t oai_alloc_count(void) {
+  return alloc_count.load(std::memory_order_relaxed);
+}
+
+// Counting wrappers around the glibc allocator. They take precedence over the
+// libc symbols at link time, so every allocation in the process is seen.
+extern "C" void *malloc(size_t size) {
+  alloc_count.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+  alloc_count.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+  alloc_count.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+#endif
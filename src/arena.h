@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem_policy.h"
+
+// Bump allocator over a single region allocation. Objects are never freed
+// individually; the whole arena is reset at once when its owner (a session,
+// a parsed message) goes away, so steady-state work never touches the heap.
+typedef struct {
+  uint8_t *base;
+  size_t size;
+  size_t used;
+  size_t high_water;
+} oai_arena_t;
+
+bool oai_arena_init(oai_arena_t *arena, oai_mem_region_t region, size_t size,
+                    const char *owner);
+// Returns NULL when the arena is exhausted.
+void *oai_arena_alloc(oai_arena_t *arena, size_t size);
+void oai_arena_reset(oai_arena_t *arena);
+bool oai_arena_contains(const oai_arena_t *arena, const void *ptr);
+
+// Installs cJSON hooks that serve allocations from a scratch arena while
+// oai_json_scratch_begin() is active on the calling thread. Other threads and
+// oversize trees fall back to the heap.
+void oai_json_scratch_init(size_t size);
+void oai_json_scratch_begin(void);
+void oai_json_scratch_end(void);
+
+#ifdef LINUX_BUILD
+// Number of malloc/calloc/realloc calls made by the process so far.
+uint32_t oai_alloc_count(void);
+#endif
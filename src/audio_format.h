@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "board.h"
+
+// Compile-time description of one PCM stream. Every size used by the I2S
+// driver and Opus is derived here so sample, frame and byte counts can not be
+// mixed up at the call sites.
+template <uint32_t Rate, uint32_t Channels, uint32_t FrameMs>
+struct AudioFormat {
+  static_assert(Rate == 8000 || Rate == 12000 || Rate == 16000 ||
+                    Rate == 24000 || Rate == 48000,
+                "Opus supports 8, 12, 16, 24 and 48 kHz");
+  static_assert(Channels == 1 || Channels == 2, "mono or stereo only");
+  static_assert(FrameMs == 10 || FrameMs == 20 || FrameMs == 40 ||
+                    FrameMs == 60,
+                "Opus frames are 10, 20, 40 or 60 ms");
+
+  static constexpr uint32_t kSampleRate = Rate;
+  static constexpr uint32_t kChannels = Channels;
+  static constexpr uint32_t kFrameMs = FrameMs;
+  static constexpr uint32_t kFrameUs = FrameMs * 1000;
+
+  // Samples per channel in one frame; this is Opus' frame_size and the I2S
+  // driver's dma_buf_len.
+  static constexpr uint32_t kFrameSamples = Rate * FrameMs / 1000;
+  // Interleaved samples in one frame.
+  static constexpr uint32_t kSamples = kFrameSamples * Channels;
+  static constexpr size_t kBytes = kSamples * sizeof(int16_t);
+
+  static constexpr uint32_t kDmaBufferLength = kFrameSamples;
+
+  // libopus' recommended ceiling: 1275 bytes per 20 ms frame plus framing.
+  static constexpr size_t kMaxPacketBytes =
+      FrameMs <= 20 ? 1276 : 1275 * (FrameMs / 20) + 7;
+
+  // The sender picks the duration of the packets it sends, up to the 120 ms
+  // Opus allows, so decoder output is sized for that rather than kFrameMs.
+  static constexpr uint32_t kMaxDecodeSamples = Rate * 120 / 1000;
+  static constexpr size_t kMaxDecodeBytes =
+      kMaxDecodeSamples * Channels * sizeof(int16_t);
+
+  // Capture counts one lost frame per DMA overflow, so one i2s_read() of
+  // kBytes must drain exactly one DMA buffer.
+  static_assert(kBytes == kDmaBufferLength * Channels * sizeof(int16_t),
+                "an I2S read must be one DMA buffer");
+  static_assert(kBytes <= 4092, "I2S DMA buffers hold at most 4092 bytes");
+  static_assert(kDmaBufferLength <= 1024,
+                "I2S DMA buffers hold at most 1024 frames");
+  // The pacer and the playout queue keep packet lengths in 16 bits.
+  static_assert(kMaxPacketBytes <= UINT16_MAX,
+                "packet length must fit the queue slots");
+};
+
+// Length of the frames the device encodes and sends.
+#ifndef OAI_AUDIO_FRAME_MS
+#define OAI_AUDIO_FRAME_MS 20
+#endif
+
+// Packet duration the Realtime API sends, which sets the playout period and
+// the I2S write size. Longer packets still decode (kMaxDecodeSamples).
+#define OAI_AUDIO_DOWNLINK_FRAME_MS 20
+
+using MicFormat = AudioFormat<Board::kAudio.mic_sample_rate,
+                              Board::kAudio.mic_channels, OAI_AUDIO_FRAME_MS>;
+using SpkFormat =
+    AudioFormat<Board::kAudio.spk_sample_rate, Board::kAudio.spk_channels,
+                OAI_AUDIO_DOWNLINK_FRAME_MS>;
@@ -0,0 +1,389 @@
+#include "bench.h"
+
+#include <cJSON.h>
+#include <esp_log.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "arena.h"
+#include "audio_format.h"
+#include "crypto_bench.h"
+#include "dc_stream.h"
+#include "dns_cache.h"
+#include "dsp.h"
+#include "governor.h"
+#include "history.h"
+#include "kws.h"
+#include "main.h"
+#include "metrics.h"
+#include "preroll.h"
+#include "send_queue.h"
+
+#define BENCH_TAG "bench"
+
+#define BENCH_DEFAULT_DIR "bench"
+#define BENCH_DEFAULT_BASELINE BENCH_DEFAULT_DIR "/baseline.json"
+#define BENCH_DEFAULT_TOLERANCE_PERCENT 15
+// Iterations per batch are doubled until a batch takes this long, then the
+// median of BENCH_BATCHES batches is reported.
+#define BENCH_MIN_BATCH_NS (20 * 1000 * 1000)
+#define BENCH_BATCHES 7
+#define BENCH_MAX_ITERATIONS (1u << 24)
+#define BENCH_JSON_SCRATCH_SIZE (32 * 1024)
+// Typical size of an SDP answer body read
+#define BENCH_HTTP_CHUNK 512
+
+/**********************
+ * Inputs
+ **********************/
+static int16_t speech[MicFormat::kSamples];
+static int16_t work[MicFormat::kSamples];
+static uint8_t packet[MicFormat::kMaxPacketBytes];
+static int packet_size = 0;
+static uint32_t default_stages = 0;
+
+static const char transcript_delta_event[] =
+    "{\"type\":\"response.audio_transcript.delta\",\"event_id\":"
+    "\"event_BQ9a7l2eaO1aWYUuyzA4x\",\"response_id\":"
+    "\"resp_BQ9a6GfIMbEoY8JG7PFtl\",\"item_id\":\"item_BQ9a6yEvQFrXm3nKJhxu2\","
+    "\"output_index\":0,\"content_index\":0,\"delta\":\" weather today\"}";
+
+static const char response_done_event[] =
+    "{\"type\":\"response.done\",\"event_id\":\"event_BQ9aBKs1QyVbU3aFlXsMd\","
+    "\"response\":{\"object\":\"realtime.response\",\"id\":"
+    "\"resp_BQ9a6GfIMbEoY8JG7PFtl\",\"status\":\"completed\","
+    "\"status_details\":null,\"output\":[{\"id\":\"item_BQ9a6yEvQFrXm3nKJhxu2\","
+    "\"object\":\"realtime.item\",\"type\":\"message\",\"status\":"
+    "\"completed\",\"role\":\"assistant\",\"content\":[{\"type\":\"audio\","
+    "\"transcript\":\"It is sunny with a high of twenty one degrees and a "
+    "light breeze from the west, so a jacket should be enough this "
+    "evening.\"}]}],\"conversation_id\":\"conv_BQ9a4hS1mJ5Kp9W2bVxRn\","
+    "\"modalities\":[\"text\",\"audio\"],\"voice\":\"alloy\","
+    "\"output_audio_format\":\"pcm16\",\"temperature\":0.8,"
+    "\"max_output_tokens\":\"inf\",\"usage\":{\"total_tokens\":412,"
+    "\"input_tokens\":287,\"output_tokens\":125,\"input_token_details\":{"
+    "\"text_tokens\":153,\"audio_tokens\":134,\"cached_tokens\":0,"
+    "\"cached_tokens_details\":{\"text_tokens\":0,\"audio_tokens\":0}},"
+    "\"output_token_details\":{\"text_tokens\":29,\"audio_tokens\":96}},"
+    "\"metadata\":null}}";
+
+// An SDP answer of the usual size, read in BENCH_HTTP_CHUNK pieces
+static const char sdp_line[] =
+    "a=candidate:1 1 UDP 2122317823 10.0.0.2 9 typ host\r\n";
+static char sdp_answer[MAX_HTTP_OUTPUT_BUFFER];
+static char answer_buffer[MAX_HTTP_OUTPUT_BUFFER + 1];
+static char send_queue_message[300];
+
+static int bench_send(const char *data, size_t len) { return (int)len; }
+
+static void setup_inputs(void) {
+  uint32_t seed = 1;
+  for (size_t i = 0; i < MicFormat::kSamples; i++) {
+    float t = (float)i / MicFormat::kSampleRate;
+    seed = seed * 1664525u + 1013904223u;
+    float noise = (float)(int32_t)(seed >> 16 & 0x7fff) / 32768.0f - 0.5f;
+    speech[i] = (int16_t)(6000.0f * sinf(2.0f * (float)M_PI * 140.0f * t) +
+                          3000.0f * sinf(2.0f * (float)M_PI * 700.0f * t) +
+                          600.0f * noise);
+  }
+
+  oai_init_audio_encoder();
+  default_stages = oai_dsp_get_stages();
+  const uint8_t *encoded;
+  uint32_t level;
+  memcpy(work, speech, sizeof(work));
+  packet_size = oai_encode_audio(work, &encoded, &level);
+  if (packet_size > 0) {
+    memcpy(packet, encoded, packet_size);
+  }
+
+  oai_json_scratch_init(BENCH_JSON_SCRATCH_SIZE);
+  oai_preroll_init();
+  oai_send_queue_init(bench_send);
+
+  for (size_t i = 0; i < sizeof(sdp_answer) - 1; i++) {
+    sdp_answer[i] = sdp_line[i % (sizeof(sdp_line) - 1)];
+  }
+  memset(send_queue_message, 'x', sizeof(send_queue_message));
+}
+
+/**********************
+ * Cases
+ **********************/
+static void bench_opus_encode(void) {
+  const uint8_t *encoded;
+  uint32_t level;
+  memcpy(work, speech, sizeof(work));
+  oai_encode_audio(work, &encoded, &level);
+}
+
+static void bench_opus_decode(void) { oai_audio_decode(packet, packet_size); }
+
+static void bench_dsp_chain(void) {
+  memcpy(work, speech, sizeof(work));
+  oai_dsp_process(work, MicFormat::kSamples);
+}
+
+static void parse_event(const char *event) {
+  oai_json_scratch_begin();
+  cJSON *root = cJSON_Parse(event);
+  cJSON *type = cJSON_GetObjectItem(root, "type");
+  if (!cJSON_IsString(type)) {
+    ESP_LOGE(BENCH_TAG, "benchmark event did not parse");
+  }
+  cJSON_Delete(root);
+  oai_json_scratch_end();
+}
+
+static void bench_json_delta(void) { parse_event(transcript_delta_event); }
+
+static void bench_json_response_done(void) {
+  parse_event(response_done_event);
+}
+
+static void bench_http_accumulate(void) {
+  int used = 0;
+  for (size_t offset = 0; offset < sizeof(sdp_answer) - 1;
+       offset += BENCH_HTTP_CHUNK) {
+    int len = std::min((int)(sizeof(sdp_answer) - 1 - offset),
+                       BENCH_HTTP_CHUNK);
+    used = oai_http_accumulate(answer_buffer, used, sdp_answer + offset, len);
+  }
+}
+
+static void bench_preroll_ring(void) {
+  static uint8_t out[MicFormat::kMaxPacketBytes];
+  oai_preroll_push(packet, packet_size, 1000);
+  oai_preroll_pop(out, sizeof(out));
+}
+
+static void bench_send_queue(void) {
+  static int64_t now_us = 0;
+  // A second per flush refills the budget, so the message always goes out.
+  now_us += 1000 * 1000;
+  oai_send_queue_push(OAI_SEND_NORMAL, send_queue_message,
+                      sizeof(send_queue_message), NULL);
+  oai_send_queue_flush(now_us);
+}
+
+typedef struct {
+  const char *name;
+  void (*run)(void);
+  uint32_t dsp_stages;  // Stages on while it runs
+} bench_case_t;
+
+// Opus is measured without the DSP chain, which has its own entry.
+static const bench_case_t cases[] = {
+    {"opus_encode", bench_opus_encode, 0},
+    {"opus_decode", bench_opus_decode, 0},
+    {"dsp_chain", bench_dsp_chain, OAI_DSP_ALL_STAGES},
+    {"json_transcript_delta", bench_json_delta, 0},
+    {"json_response_done", bench_json_response_done, 0},
+    {"http_accumulate_answer", bench_http_accumulate, 0},
+    {"preroll_push_pop", bench_preroll_ring, 0},
+    {"send_queue_push_flush", bench_send_queue, 0},
+};
+
+/**********************
+ * Measurement
+ **********************/
+static int64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t time_batch(const bench_case_t *c, uint32_t iterations) {
+  int64_t start = now_ns();
+  for (uint32_t i = 0; i < iterations; i++) {
+    c->run();
+  }
+  return now_ns() - start;
+}
+
+// Median nanoseconds per call; iterations is set to the batch size used.
+static double measure(const bench_case_t *c, uint32_t *iterations) {
+  oai_dsp_set_stages(c->dsp_stages);
+  uint32_t n = 1;
+  while (time_batch(c, n) < BENCH_MIN_BATCH_NS && n < BENCH_MAX_ITERATIONS) {
+    n *= 2;
+  }
+  double per_op[BENCH_BATCHES];
+  for (int i = 0; i < BENCH_BATCHES; i++) {
+    per_op[i] = (double)time_batch(c, n) / n;
+  }
+  std::sort(per_op, per_op + BENCH_BATCHES);
+  oai_dsp_set_stages(default_stages);
+  *iterations = n;
+  return per_op[BENCH_BATCHES / 2];
+}
+
+/**********************
+ * Baseline
+ **********************/
+static cJSON *read_json(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *text = (char *)malloc(size + 1);
+  cJSON *json = NULL;
+  if (text != NULL && fread(text, 1, size, file) == (size_t)size) {
+    text[size] = '\0';
+    json = cJSON_Parse(text);
+  }
+  free(text);
+  fclose(file);
+  return json;
+}
+
+static bool write_json(const char *path, const cJSON *json) {
+  char *text = cJSON_Print(json);
+  FILE *file = path != NULL ? fopen(path, "wb") : stdout;
+  bool ok = text != NULL && file != NULL;
+  if (ok) {
+    fprintf(file, "%s\n", text);
+  }
+  if (file != NULL && file != stdout) {
+    fclose(file);
+  }
+  cJSON_free(text);
+  return ok;
+}
+
+// Returns the number of results that regressed or have nothing to compare
+// with.
+static int compare(const cJSON *results, const cJSON *baseline,
+                   int tolerance_percent) {
+  int failures = 0;
+  const cJSON *base = cJSON_GetObjectItem(baseline, "benchmarks");
+  const cJSON *result;
+  cJSON_ArrayForEach(result, results) {
+    double now = cJSON_GetNumberValue(cJSON_GetObjectItem(result, "ns_per_op"));
+    const cJSON *entry = cJSON_GetObjectItem(base, result->string);
+    double then = cJSON_GetNumberValue(cJSON_GetObjectItem(entry, "ns_per_op"));
+    if (entry == NULL || isnan(then) || then <= 0) {
+      ESP_LOGE(BENCH_TAG, "%-24s %12.0f ns  NO BASELINE", result->string, now);
+      failures++;
+      continue;
+    }
+    double change = (now / then - 1.0) * 100.0;
+    bool regressed = change > tolerance_percent;
+    failures += regressed;
+    ESP_LOGI(BENCH_TAG, "%-24s %12.0f ns  baseline %12.0f ns  %+6.1f%%%s",
+             result->string, now, then, change,
+             regressed ? "  REGRESSION" : "");
+  }
+  return failures;
+}
+
+static int run_micro(void) {
+  setup_inputs();
+  if (packet_size <= 0) {
+    ESP_LOGE(BENCH_TAG, "Opus encoder unavailable");
+    return 1;
+  }
+
+  cJSON *root = cJSON_CreateObject();
+  cJSON *results = cJSON_AddObjectToObject(root, "benchmarks");
+  for (const auto &c : cases) {
+    uint32_t iterations;
+    double ns = measure(&c, &iterations);
+    cJSON *entry = cJSON_AddObjectToObject(results, c.name);
+    cJSON_AddNumberToObject(entry, "ns_per_op", round(ns));
+    cJSON_AddNumberToObject(entry, "iterations", iterations);
+  }
+
+  const char *baseline_path = getenv("OAI_BENCH_BASELINE");
+  bool baseline_given = baseline_path != NULL;
+  if (!baseline_given) {
+    baseline_path = BENCH_DEFAULT_BASELINE;
+  }
+  const char *update = getenv("OAI_BENCH_UPDATE");
+  if (update != NULL && strcmp(update, "1") == 0) {
+    if (!baseline_given) {
+      mkdir(BENCH_DEFAULT_DIR, 0755);
+    }
+    bool ok = write_json(baseline_path, root);
+    ESP_LOGI(BENCH_TAG, "%s %s", ok ? "Wrote" : "Could not write",
+             baseline_path);
+    cJSON_Delete(root);
+    return ok ? 0 : 1;
+  }
+
+  int status = write_json(getenv("OAI_BENCH_OUT"), root) ? 0 : 1;
+  // Until a baseline is recorded on the reference machine the results are
+  // only reported. Once there is one, or one is named, a result with nothing
+  // to compare against fails, so the gate can not pass by default.
+  cJSON *baseline = read_json(baseline_path);
+  if (baseline == NULL && !baseline_given) {
+    ESP_LOGW(BENCH_TAG,
+             "No baseline at %s, results are not gated; record one on the "
+             "reference machine with OAI_BENCH_UPDATE=1",
+             baseline_path);
+  } else if (baseline == NULL) {
+    ESP_LOGE(BENCH_TAG, "Can not read baseline %s", baseline_path);
+    status = 1;
+  } else {
+    const char *tolerance = getenv("OAI_BENCH_TOLERANCE");
+    int failures = compare(results, baseline,
+                           tolerance != NULL ? atoi(tolerance)
+                                             : BENCH_DEFAULT_TOLERANCE_PERCENT);
+    if (failures > 0) {
+      ESP_LOGE(BENCH_TAG,
+               "%d benchmark(s) regressed or missing from %s; record new "
+               "ones with OAI_BENCH_UPDATE=1",
+               failures, baseline_path);
+      status = 1;
+    }
+    cJSON_Delete(baseline);
+  }
+  cJSON_Delete(root);
+  return status;
+}
+
+int oai_bench_main(const char *name) {
+  if (strcmp(name, "crypto") == 0) {
+    return oai_crypto_bench_run() ? 0 : 1;
+  }
+  if (strcmp(name, "kws") == 0) {
+    const char *data = getenv("OAI_KWS_DATA");
+    return oai_kws_bench(data != NULL ? data : ".") ? 0 : 1;
+  }
+  if (strcmp(name, "governor") == 0) {
+    return oai_governor_bench() ? 0 : 1;
+  }
+  if (strcmp(name, "datachannel") == 0) {
+    return oai_dc_stream_selftest() ? 0 : 1;
+  }
+  if (strcmp(name, "metrics") == 0) {
+    return oai_metrics_selftest() ? 0 : 1;
+  }
+  if (strcmp(name, "sendqueue") == 0) {
+    return oai_send_queue_selftest() ? 0 : 1;
+  }
+  if (strcmp(name, "history") == 0) {
+    return oai_history_bench() ? 0 : 1;
+  }
+  if (strcmp(name, "dns") == 0) {
+    const char *host = getenv("OAI_DNS_HOST");
+    return oai_dns_cache_bench(host != NULL ? host : "api.openai.com") ? 0 : 1;
+  }
+  if (strcmp(name, "micro") == 0) {
+    return run_micro();
+  }
+  ESP_LOGE(BENCH_TAG,
+           "Unknown benchmark %s (crypto, kws, governor, datachannel, "
+           "metrics, sendqueue, history, dns, micro)",
+           name);
+  return 1;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+// Benchmarks for the Linux build, picked with OAI_BENCH:
+//
+//   crypto       SRTP and DTLS handshake cost (crypto_bench.h)
+//   kws          wake word accuracy on OAI_KWS_DATA/{positive,negative}
+//   governor     CPU governor against synthetic load (governor.h)
+//   datachannel  event reassembly from fragmented payloads (dc_stream.h)
+//   metrics      registry updates, histogram buckets and snapshots (metrics.h)
+//   sendqueue    priority, coalescing, eviction and rate limit against a
+//                saturated peer (send_queue.h)
+//   history      history log writes through the emulated flash (history.h)
+//   dns          time a TCP connect saves with the address cache
+//                (dns_cache.h), needs network access; OAI_DNS_HOST
+//                overrides api.openai.com
+//   micro        microbenchmarks of the hot paths, checked against a baseline
+//
+// micro times Opus encode and decode at the device's settings, the capture
+// DSP chain, cJSON parsing of Realtime API events through the scratch arena,
+// the SDP answer accumulator and the pre-roll and send queue rings. Each
+// result is the median of several batches, in nanoseconds per operation,
+// written as JSON to OAI_BENCH_OUT (stdout by default):
+//
+//   {"benchmarks": {"opus_encode": {"ns_per_op": 251000, "iterations": 80},
+//                   ...}}
+//
+// The results are then checked against OAI_BENCH_BASELINE (default
+// bench/baseline.json, same format). Anything slower than its baseline by
+// more than OAI_BENCH_TOLERANCE percent (default 15) is a regression and
+// fails the run, as does a result the baseline has no entry for, or a named
+// baseline that can not be read. OAI_BENCH_UPDATE=1 writes the results to
+// the baseline instead; record it on the reference machine and commit it
+// with the change that moved the numbers. No baseline is recorded yet, so
+// until one is committed the default run only reports.
+//
+// crypto fails if an SRTP round trip or a DTLS handshake fails, kws without
+// a model or clips, or below KWS_BENCH_MIN_DETECTED_PERCENT detection or
+// above KWS_BENCH_MAX_FALSE_PER_HOUR false alarms (kws.cpp).
+
+// Runs the benchmark named by OAI_BENCH after main() has set up peer, the
+// SRTP backend and the audio decoder. Returns the process exit status.
+int oai_bench_main(const char *name);
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+// Hardware profiles. Everything that differs between boards lives in one
+// constexpr struct per board, picked by CONFIG_OAI_BOARD_* (see
+// Kconfig.projbuild), so a variant is a menuconfig choice rather than a
+// source edit. Pins are plain GPIO numbers and -1 means not connected, which
+// keeps this header usable from the Linux build.
+
+// One panel init command. Layout matches the vendor init tables the
+// esp_lcd panel drivers accept through vendor_config.
+struct LcdInitCmd {
+  int cmd;
+  const void *data;
+  size_t data_bytes;
+  unsigned int delay_ms;
+};
+
+struct DisplayProfile {
+  const char *name;
+  uint16_t width;
+  uint16_t height;
+  int16_t offset_x;
+  int16_t offset_y;
+  bool mirror_x;
+  bool mirror_y;
+  bool swap_xy;
+  bool invert_color;
+  bool bgr_order;
+
+  int spi_host;  // spi_host_device_t
+  uint8_t spi_mode;
+  uint32_t pclk_hz;
+  uint8_t trans_queue_depth;
+  int mosi_pin;
+  int clk_pin;
+  int dc_pin;
+  int cs_pin;
+  int rst_pin;
+  int backlight_pin;
+
+  // Height of each of the two LVGL draw buffers
+  uint16_t draw_buffer_lines;
+
+  // Extra init sequence sent after reset, or nullptr for the driver default
+  const LcdInitCmd *init_cmds;
+  size_t init_cmds_size;
+};
+
+struct AudioProfile {
+  int mclk_pin;
+  int spk_bclk_pin;
+  int spk_lrclk_pin;
+  int spk_data_pin;
+  int mic_bclk_pin;
+  int mic_lrclk_pin;
+  int mic_data_pin;
+
+  uint32_t spk_sample_rate;
+  uint32_t spk_channels;
+  uint32_t mic_sample_rate;
+  uint32_t mic_channels;
+  int dma_buf_count;
+};
+
+// Freenove ESP32-S3 Media Kit. Both panel variants share the audio codec
+// wiring and the display SPI pins.
+namespace freenove {
+
+inline constexpr AudioProfile kAudio = {
+    .mclk_pin = -1,
+    .spk_bclk_pin = 42,
+    .spk_lrclk_pin = 41,
+    .spk_data_pin = 1,
+    .mic_bclk_pin = 3,
+    .mic_lrclk_pin = 14,
+    .mic_data_pin = 46,
+    .spk_sample_rate = 8000,
+    .spk_channels = 2,
+    .mic_sample_rate = 16000,
+    .mic_channels = 1,
+    .dma_buf_count = 8,
+};
+
+// ST7796 sequence for the 3.5" panel
+inline constexpr uint8_t kSt7796SleepOut[] = {0x00};
+inline constexpr uint8_t kSt7796PixelFormat[] = {0x05};
+inline constexpr uint8_t kSt7796CommandSet1[] = {0xC3};
+inline constexpr uint8_t kSt7796CommandSet2[] = {0x96};
+inline constexpr uint8_t kSt7796Inversion[] = {0x01};
+inline constexpr uint8_t kSt7796EntryMode[] = {0xC6};
+inline constexpr uint8_t kSt7796Power1[] = {0x80, 0x45};
+inline constexpr uint8_t kSt7796Power2[] = {0x13};
+inline constexpr uint8_t kSt7796Power3[] = {0xA7};
+inline constexpr uint8_t kSt7796Vcom[] = {0x0A};
+inline constexpr uint8_t kSt7796OutputAdjust[] = {0x40, 0x8A, 0x00, 0x00,
+                                                  0x29, 0x19, 0xA5, 0x33};
+inline constexpr uint8_t kSt7796GammaPos[] = {0xD0, 0x08, 0x0F, 0x06, 0x06,
+                                              0x33, 0x30, 0x33, 0x47, 0x17,
+                                              0x13, 0x13, 0x2B, 0x31};
+inline constexpr uint8_t kSt7796GammaNeg[] = {0xD0, 0x0A, 0x11, 0x0B, 0x09,
+                                              0x07, 0x2F, 0x33, 0x47, 0x38,
+                                              0x15, 0x16, 0x2C, 0x32};
+inline constexpr uint8_t kSt7796CommandSet3[] = {0x3C};
+inline constexpr uint8_t kSt7796CommandSet4[] = {0x69};
+inline constexpr uint8_t kSt7796NoArgs[] = {0x00};
+
+inline constexpr LcdInitCmd kSt7796InitCmds[] = {
+    {0x11, kSt7796SleepOut, 0, 120},
+    {0x3A, kSt7796PixelFormat, 1, 0},
+    {0xF0, kSt7796CommandSet1, 1, 0},
+    {0xF0, kSt7796CommandSet2, 1, 0},
+    {0xB4, kSt7796Inversion, 1, 0},
+    {0xB7, kSt7796EntryMode, 1, 0},
+    {0xC0, kSt7796Power1, 2, 0},
+    {0xC1, kSt7796Power2, 1, 0},
+    {0xC2, kSt7796Power3, 1, 0},
+    {0xC5, kSt7796Vcom, 1, 0},
+    {0xE8, kSt7796OutputAdjust, 8, 0},
+    {0xE0, kSt7796GammaPos, 14, 0},
+    {0xE1, kSt7796GammaNeg, 14, 0},
+    {0xF0, kSt7796CommandSet3, 1, 0},
+    {0xF0, kSt7796CommandSet4, 1, 120},
+    {0x21, kSt7796NoArgs, 0, 0},
+    {0x29, kSt7796NoArgs, 0, 0},
+};
+
+}  // namespace freenove
+
+struct FreenoveMediaKit114 {
+  static constexpr DisplayProfile kDisplay = {
+      .name = "Freenove 1.14 inch",
+      .width = 240,
+      .height = 135,
+      .offset_x = 40,
+      .offset_y = 53,
+      .mirror_x = true,
+      .mirror_y = false,
+      .swap_xy = true,
+      .invert_color = true,
+      .bgr_order = false,
+      .spi_host = 2,  // SPI3_HOST
+      .spi_mode = 3,
+      .pclk_hz = 80 * 1000 * 1000,
+      .trans_queue_depth = 10,
+      .mosi_pin = 21,
+      .clk_pin = 47,
+      .dc_pin = 45,
+      .cs_pin = -1,
+      .rst_pin = 20,
+      .backlight_pin = 2,
+      .draw_buffer_lines = 34,
+      .init_cmds = nullptr,
+      .init_cmds_size = 0,
+  };
+  static constexpr AudioProfile kAudio = freenove::kAudio;
+};
+
+struct FreenoveMediaKit35 {
+  static constexpr DisplayProfile kDisplay = {
+      .name = "Freenove 3.5 inch",
+      .width = 480,
+      .height = 320,
+      .offset_x = 0,
+      .offset_y = 0,
+      .mirror_x = false,
+      .mirror_y = false,
+      .swap_xy = true,
+      .invert_color = true,
+      .bgr_order = false,
+      .spi_host = 2,  // SPI3_HOST
+      .spi_mode = 0,
+      .pclk_hz = 80 * 1000 * 1000,
+      .trans_queue_depth = 10,
+      .mosi_pin = 21,
+      .clk_pin = 47,
+      .dc_pin = 45,
+      .cs_pin = -1,
+      .rst_pin = 20,
+      .backlight_pin = 2,
+      .draw_buffer_lines = 20,
+      .init_cmds = freenove::kSt7796InitCmds,
+      .init_cmds_size = sizeof(freenove::kSt7796InitCmds) /
+                        sizeof(freenove::kSt7796InitCmds[0]),
+  };
+  static constexpr AudioProfile kAudio = freenove::kAudio;
+};
+
+#if defined(CONFIG_OAI_BOARD_FREENOVE_3_5_INCH)
+using Board = FreenoveMediaKit35;
+#else
+using Board = FreenoveMediaKit114;
+#endif
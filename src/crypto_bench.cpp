@@ -0,0 +1,464 @@
+#include "crypto_bench.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/ecp.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/pk.h>
+#include <mbedtls/rsa.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/timing.h>
+#include <mbedtls/x509_crt.h>
+#include <string.h>
+
+#if defined(MBEDTLS_PSA_CRYPTO_C)
+#include <psa/crypto.h>
+#endif
+
+#include "mem_policy.h"
+#include "srtp.h"
+#include "srtp_cipher.h"
+
+#define CRYPTO_BENCH_TAG "crypto_bench"
+#define RTP_HEADER_SIZE 12
+
+// Packets are protected in place in one batch and then unprotected, so each
+// direction is timed over the same memory.
+#define SRTP_BENCH_BATCH 64
+#define SRTP_BENCH_ROUNDS 4
+#define SRTP_BENCH_MAX_PAYLOAD 1200
+#define SRTP_BENCH_SLOT_SIZE \
+  (RTP_HEADER_SIZE + SRTP_BENCH_MAX_PAYLOAD + SRTP_MAX_TRAILER_LEN)
+
+#define DTLS_BENCH_MTU 1200
+#define DTLS_BENCH_QUEUE_SLOTS 16
+#define DTLS_BENCH_MAX_STEPS 256
+#define DTLS_BENCH_RUNS 3
+#define DTLS_BENCH_CERT_SIZE 2048
+
+// Set by any measurement that could not be made
+static bool bench_failed = false;
+
+/**********************
+ * SRTP
+ **********************/
+typedef struct {
+  const char *name;
+  void (*set_policy)(srtp_crypto_policy_t *policy);
+} srtp_profile_t;
+
+// libsrtp only defines the GCM helpers when it was built with a GCM backend,
+// so spell the policy out and let srtp_create() report whether it exists.
+static void set_aes_gcm_128_16_auth(srtp_crypto_policy_t *policy) {
+  policy->cipher_type = SRTP_AES_GCM_128;
+  policy->cipher_key_len = SRTP_AES_GCM_128_KEY_LEN_WSALT;
+  policy->auth_type = SRTP_NULL_AUTH;
+  policy->auth_key_len = 0;
+  policy->auth_tag_len = 16;
+  policy->sec_serv = sec_serv_conf_and_auth;
+}
+
+static const srtp_profile_t srtp_profiles[] = {
+    {"aes_cm_128_hmac_sha1_80",
+     srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80},
+    {"aes_cm_128_hmac_sha1_32",
+     srtp_crypto_policy_set_aes_cm_128_hmac_sha1_32},
+    {"aes_gcm_128_16_auth", set_aes_gcm_128_16_auth},
+    {"null_cipher_hmac_sha1_80",
+     srtp_crypto_policy_set_null_cipher_hmac_sha1_80},
+};
+
+// 40 to 640 bytes covers 10 to 60 ms Opus frames; 1200 is a full MTU.
+static const int srtp_payload_sizes[] = {40, 80, 160, 320, 640, 1200};
+
+static bool srtp_session(srtp_t *session, const srtp_profile_t *profile,
+                         uint8_t *key, ssrc_type_t direction) {
+  srtp_policy_t policy;
+  memset(&policy, 0, sizeof(policy));
+  profile->set_policy(&policy.rtp);
+  profile->set_policy(&policy.rtcp);
+  policy.ssrc.type = direction;
+  policy.key = key;
+  policy.window_size = 128;
+  return srtp_create(session, &policy) == srtp_err_status_ok;
+}
+
+static void bench_srtp_profile(const srtp_profile_t *profile, uint8_t *slots) {
+  // Long enough for any profile's key and salt.
+  uint8_t key[SRTP_MAX_KEY_LEN];
+  for (size_t i = 0; i < sizeof(key); i++) {
+    key[i] = (uint8_t)(i * 13 + 5);
+  }
+
+  for (size_t s = 0; s < sizeof(srtp_payload_sizes) / sizeof(int); s++) {
+    int payload = srtp_payload_sizes[s];
+    srtp_t sender = NULL;
+    srtp_t receiver = NULL;
+    if (!srtp_session(&sender, profile, key, ssrc_any_outbound) ||
+        !srtp_session(&receiver, profile, key, ssrc_any_inbound)) {
+      ESP_LOGI(CRYPTO_BENCH_TAG, "srtp %-26s unavailable in this build",
+               profile->name);
+      if (sender != NULL) {
+        srtp_dealloc(sender);
+      }
+      return;
+    }
+
+    int64_t protect_us = 0;
+    int64_t unprotect_us = 0;
+    bool ok = true;
+    uint16_t seq = 0;
+    for (int round = 0; round < SRTP_BENCH_ROUNDS && ok; round++) {
+      for (int i = 0; i < SRTP_BENCH_BATCH; i++, seq++) {
+        uint8_t *packet = slots + i * SRTP_BENCH_SLOT_SIZE;
+        memset(packet, 0, RTP_HEADER_SIZE);
+        packet[0] = 0x80;
+        packet[1] = 111;
+        packet[2] = (uint8_t)(seq >> 8);
+        packet[3] = (uint8_t)seq;
+        packet[11] = 1;  // SSRC
+        memset(packet + RTP_HEADER_SIZE, seq, payload);
+      }
+
+      int lens[SRTP_BENCH_BATCH];
+      int64_t start = esp_timer_get_time();
+      for (int i = 0; i < SRTP_BENCH_BATCH && ok; i++) {
+        lens[i] = RTP_HEADER_SIZE + payload;
+        ok = srtp_protect(sender, slots + i * SRTP_BENCH_SLOT_SIZE,
+                          &lens[i]) == srtp_err_status_ok;
+      }
+      protect_us += esp_timer_get_time() - start;
+
+      start = esp_timer_get_time();
+      for (int i = 0; i < SRTP_BENCH_BATCH && ok; i++) {
+        ok = srtp_unprotect(receiver, slots + i * SRTP_BENCH_SLOT_SIZE,
+                            &lens[i]) == srtp_err_status_ok &&
+             lens[i] == RTP_HEADER_SIZE + payload;
+      }
+      unprotect_us += esp_timer_get_time() - start;
+    }
+    srtp_dealloc(sender);
+    srtp_dealloc(receiver);
+
+    if (!ok) {
+      ESP_LOGE(CRYPTO_BENCH_TAG, "srtp %-26s %4d B round trip failed",
+               profile->name, payload);
+      bench_failed = true;
+      continue;
+    }
+    const int packets = SRTP_BENCH_BATCH * SRTP_BENCH_ROUNDS;
+    ESP_LOGI(CRYPTO_BENCH_TAG,
+             "srtp %-26s %4d B  protect %6lld ns  unprotect %6lld ns",
+             profile->name, payload, (long long)(protect_us * 1000 / packets),
+             (long long)(unprotect_us * 1000 / packets));
+  }
+}
+
+static void bench_srtp(void) {
+  uint8_t *slots = (uint8_t *)oai_mem_alloc(
+      OAI_MEM_PSRAM, SRTP_BENCH_BATCH * SRTP_BENCH_SLOT_SIZE, "crypto bench");
+  if (slots == NULL) {
+    bench_failed = true;
+    return;
+  }
+  ESP_LOGI(CRYPTO_BENCH_TAG, "srtp AES_CM_128 backend: %s",
+           oai_srtp_cipher_backend());
+  for (size_t p = 0; p < sizeof(srtp_profiles) / sizeof(srtp_profile_t); p++) {
+    bench_srtp_profile(&srtp_profiles[p], slots);
+  }
+  oai_mem_free(slots);
+}
+
+/**********************
+ * DTLS
+ **********************/
+#if defined(MBEDTLS_SSL_DTLS_SRTP)
+typedef struct {
+  uint8_t data[DTLS_BENCH_QUEUE_SLOTS][DTLS_BENCH_MTU];
+  size_t len[DTLS_BENCH_QUEUE_SLOTS];
+  int head;
+  int count;
+} datagram_queue_t;
+
+typedef struct {
+  mbedtls_ssl_context ssl;
+  mbedtls_ssl_config conf;
+  mbedtls_x509_crt cert;
+  mbedtls_pk_context key;
+  mbedtls_timing_delay_context timer;
+  datagram_queue_t *inbox;
+  datagram_queue_t *outbox;  // The other endpoint's inbox
+} dtls_endpoint_t;
+
+typedef struct {
+  const char *name;
+  mbedtls_pk_type_t key_type;
+  int ciphersuites[2];
+} dtls_profile_t;
+
+typedef struct {
+  const char *name;
+  mbedtls_ssl_srtp_profile profiles[2];
+} dtls_srtp_profile_t;
+
+static const dtls_profile_t dtls_profiles[] = {
+    {"ecdsa_p256", MBEDTLS_PK_ECKEY,
+     {MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256, 0}},
+    {"rsa_2048", MBEDTLS_PK_RSA,
+     {MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256, 0}},
+};
+
+static const dtls_srtp_profile_t dtls_srtp_profiles[] = {
+    {"sha1_80",
+     {MBEDTLS_TLS_SRTP_AES128_CM_HMAC_SHA1_80, MBEDTLS_TLS_SRTP_UNSET}},
+    {"sha1_32",
+     {MBEDTLS_TLS_SRTP_AES128_CM_HMAC_SHA1_32, MBEDTLS_TLS_SRTP_UNSET}},
+};
+
+static mbedtls_entropy_context entropy;
+static mbedtls_ctr_drbg_context drbg;
+
+static int queue_send(void *ctx, const unsigned char *buf, size_t len) {
+  datagram_queue_t *queue = ((dtls_endpoint_t *)ctx)->outbox;
+  if (len > DTLS_BENCH_MTU) {
+    return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+  }
+  if (queue->count == DTLS_BENCH_QUEUE_SLOTS) {
+    return MBEDTLS_ERR_SSL_WANT_WRITE;
+  }
+  int slot = (queue->head + queue->count) % DTLS_BENCH_QUEUE_SLOTS;
+  memcpy(queue->data[slot], buf, len);
+  queue->len[slot] = len;
+  queue->count++;
+  return (int)len;
+}
+
+static int queue_recv(void *ctx, unsigned char *buf, size_t len) {
+  datagram_queue_t *queue = ((dtls_endpoint_t *)ctx)->inbox;
+  if (queue->count == 0) {
+    return MBEDTLS_ERR_SSL_WANT_READ;
+  }
+  // Like a UDP socket, a short read truncates the datagram.
+  size_t n = queue->len[queue->head] < len ? queue->len[queue->head] : len;
+  memcpy(buf, queue->data[queue->head], n);
+  queue->head = (queue->head + 1) % DTLS_BENCH_QUEUE_SLOTS;
+  queue->count--;
+  return (int)n;
+}
+
+static bool make_identity(dtls_endpoint_t *ep, mbedtls_pk_type_t type) {
+  static uint8_t der[DTLS_BENCH_CERT_SIZE];
+  int ret = mbedtls_pk_setup(&ep->key, mbedtls_pk_info_from_type(type));
+  if (ret == 0 && type == MBEDTLS_PK_RSA) {
+    ret = mbedtls_rsa_gen_key(mbedtls_pk_rsa(ep->key), mbedtls_ctr_drbg_random,
+                              &drbg, 2048, 65537);
+  } else if (ret == 0) {
+    ret = mbedtls_ecp_gen_key(MBEDTLS_ECP_DP_SECP256R1, mbedtls_pk_ec(ep->key),
+                              mbedtls_ctr_drbg_random, &drbg);
+  }
+  if (ret != 0) {
+    return false;
+  }
+
+  // Self-signed, like the certificate libpeer presents to the browser.
+  mbedtls_x509write_cert crt;
+  mbedtls_mpi serial;
+  mbedtls_x509write_crt_init(&crt);
+  mbedtls_mpi_init(&serial);
+  mbedtls_mpi_lset(&serial, 1);
+  mbedtls_x509write_crt_set_version(&crt, MBEDTLS_X509_CRT_VERSION_3);
+  mbedtls_x509write_crt_set_md_alg(&crt, MBEDTLS_MD_SHA256);
+  mbedtls_x509write_crt_set_subject_key(&crt, &ep->key);
+  mbedtls_x509write_crt_set_issuer_key(&crt, &ep->key);
+  mbedtls_x509write_crt_set_subject_name(&crt, "CN=oai_bench");
+  mbedtls_x509write_crt_set_issuer_name(&crt, "CN=oai_bench");
+  mbedtls_x509write_crt_set_serial(&crt, &serial);
+  mbedtls_x509write_crt_set_validity(&crt, "20240101000000", "20340101000000");
+  ret = mbedtls_x509write_crt_der(&crt, der, sizeof(der),
+                                  mbedtls_ctr_drbg_random, &drbg);
+  mbedtls_x509write_crt_free(&crt);
+  mbedtls_mpi_free(&serial);
+  if (ret <= 0) {
+    return false;
+  }
+  // The DER is written at the end of the buffer.
+  return mbedtls_x509_crt_parse_der(&ep->cert, der + sizeof(der) - ret, ret) ==
+         0;
+}
+
+static bool setup_endpoint(dtls_endpoint_t *ep, int endpoint,
+                           const dtls_profile_t *profile,
+                           const dtls_srtp_profile_t *srtp) {
+  mbedtls_ssl_init(&ep->ssl);
+  mbedtls_ssl_config_init(&ep->conf);
+  if (mbedtls_ssl_config_defaults(&ep->conf, endpoint,
+                                  MBEDTLS_SSL_TRANSPORT_DATAGRAM,
+                                  MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+    return false;
+  }
+  // WebRTC checks the peer against the SDP fingerprint, not a CA.
+  mbedtls_ssl_conf_authmode(&ep->conf, MBEDTLS_SSL_VERIFY_NONE);
+  mbedtls_ssl_conf_rng(&ep->conf, mbedtls_ctr_drbg_random, &drbg);
+  mbedtls_ssl_conf_ciphersuites(&ep->conf, profile->ciphersuites);
+  mbedtls_ssl_conf_dtls_srtp_protection_profiles(&ep->conf, srtp->profiles);
+  if (endpoint == MBEDTLS_SSL_IS_SERVER) {
+    // Over ICE the peer's address is already verified.
+    mbedtls_ssl_conf_dtls_cookies(&ep->conf, NULL, NULL, NULL);
+  }
+  if (mbedtls_ssl_conf_own_cert(&ep->conf, &ep->cert, &ep->key) != 0 ||
+      mbedtls_ssl_setup(&ep->ssl, &ep->conf) != 0) {
+    return false;
+  }
+  mbedtls_ssl_set_mtu(&ep->ssl, DTLS_BENCH_MTU);
+  mbedtls_ssl_set_bio(&ep->ssl, ep, queue_send, queue_recv, NULL);
+  mbedtls_ssl_set_timer_cb(&ep->ssl, &ep->timer, mbedtls_timing_set_delay,
+                           mbedtls_timing_get_delay);
+  return true;
+}
+
+static void teardown_endpoint(dtls_endpoint_t *ep) {
+  mbedtls_ssl_free(&ep->ssl);
+  mbedtls_ssl_config_free(&ep->conf);
+}
+
+static bool in_progress(int ret) {
+  return ret == MBEDTLS_ERR_SSL_WANT_READ ||
+         ret == MBEDTLS_ERR_SSL_WANT_WRITE || ret == MBEDTLS_ERR_SSL_TIMEOUT;
+}
+
+// Returns the handshake time in microseconds, or -1 on failure.
+static int64_t run_handshake(dtls_endpoint_t *client, dtls_endpoint_t *server,
+                             const dtls_srtp_profile_t *srtp) {
+  client->inbox->head = client->inbox->count = 0;
+  server->inbox->head = server->inbox->count = 0;
+
+  int client_ret = -1;
+  int server_ret = -1;
+  int64_t start = esp_timer_get_time();
+  for (int step = 0;
+       step < DTLS_BENCH_MAX_STEPS && (client_ret != 0 || server_ret != 0);
+       step++) {
+    if (client_ret != 0) {
+      client_ret = mbedtls_ssl_handshake(&client->ssl);
+    }
+    if (server_ret != 0) {
+      server_ret = mbedtls_ssl_handshake(&server->ssl);
+    }
+    if ((client_ret != 0 && !in_progress(client_ret)) ||
+        (server_ret != 0 && !in_progress(server_ret))) {
+      ESP_LOGE(CRYPTO_BENCH_TAG, "Handshake failed: client -0x%04x server -0x%04x",
+               -client_ret, -server_ret);
+      return -1;
+    }
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+  if (client_ret != 0 || server_ret != 0) {
+    ESP_LOGE(CRYPTO_BENCH_TAG, "Handshake did not finish in %d steps",
+             DTLS_BENCH_MAX_STEPS);
+    return -1;
+  }
+
+  mbedtls_dtls_srtp_info negotiated;
+  mbedtls_ssl_get_dtls_srtp_negotiation_result(&client->ssl, &negotiated);
+  if (negotiated.MBEDTLS_PRIVATE(chosen_dtls_srtp_profile) != srtp->profiles[0]) {
+    ESP_LOGE(CRYPTO_BENCH_TAG, "use_srtp negotiated the wrong profile");
+    return -1;
+  }
+  return elapsed;
+}
+
+static void bench_dtls_profile(const dtls_profile_t *profile,
+                               datagram_queue_t *queues) {
+  dtls_endpoint_t client = {};
+  dtls_endpoint_t server = {};
+  client.inbox = server.outbox = &queues[0];
+  server.inbox = client.outbox = &queues[1];
+  mbedtls_x509_crt_init(&client.cert);
+  mbedtls_x509_crt_init(&server.cert);
+  mbedtls_pk_init(&client.key);
+  mbedtls_pk_init(&server.key);
+
+  int64_t keygen_start = esp_timer_get_time();
+  if (!make_identity(&client, profile->key_type) ||
+      !make_identity(&server, profile->key_type)) {
+    ESP_LOGE(CRYPTO_BENCH_TAG, "dtls %s: certificate generation failed",
+             profile->name);
+    bench_failed = true;
+  } else {
+    ESP_LOGI(CRYPTO_BENCH_TAG, "dtls %s: two identities in %lld ms",
+             profile->name,
+             (long long)((esp_timer_get_time() - keygen_start) / 1000));
+    for (size_t s = 0;
+         s < sizeof(dtls_srtp_profiles) / sizeof(dtls_srtp_profile_t); s++) {
+      const dtls_srtp_profile_t *srtp = &dtls_srtp_profiles[s];
+      int64_t total_us = 0;
+      int runs = 0;
+      for (; runs < DTLS_BENCH_RUNS; runs++) {
+        bool ok = setup_endpoint(&client, MBEDTLS_SSL_IS_CLIENT, profile,
+                                 srtp) &&
+                  setup_endpoint(&server, MBEDTLS_SSL_IS_SERVER, profile, srtp);
+        int64_t us = ok ? run_handshake(&client, &server, srtp) : -1;
+        teardown_endpoint(&client);
+        teardown_endpoint(&server);
+        if (us < 0) {
+          bench_failed = true;
+          break;
+        }
+        total_us += us;
+      }
+      if (runs == DTLS_BENCH_RUNS) {
+        ESP_LOGI(CRYPTO_BENCH_TAG, "dtls %-10s %-7s handshake %6lld ms",
+                 profile->name, srtp->name,
+                 (long long)(total_us / runs / 1000));
+      }
+    }
+  }
+
+  mbedtls_x509_crt_free(&client.cert);
+  mbedtls_x509_crt_free(&server.cert);
+  mbedtls_pk_free(&client.key);
+  mbedtls_pk_free(&server.key);
+}
+
+static void bench_dtls(void) {
+#if defined(MBEDTLS_PSA_CRYPTO_C)
+  psa_crypto_init();
+#endif
+  datagram_queue_t *queues = (datagram_queue_t *)oai_mem_alloc(
+      OAI_MEM_PSRAM, 2 * sizeof(datagram_queue_t), "crypto bench");
+  if (queues == NULL) {
+    bench_failed = true;
+    return;
+  }
+  mbedtls_entropy_init(&entropy);
+  mbedtls_ctr_drbg_init(&drbg);
+  if (mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy,
+                            (const unsigned char *)CRYPTO_BENCH_TAG,
+                            strlen(CRYPTO_BENCH_TAG)) == 0) {
+    for (size_t p = 0; p < sizeof(dtls_profiles) / sizeof(dtls_profile_t);
+         p++) {
+      bench_dtls_profile(&dtls_profiles[p], queues);
+    }
+  } else {
+    ESP_LOGE(CRYPTO_BENCH_TAG, "dtls: random generator seeding failed");
+    bench_failed = true;
+  }
+  mbedtls_ctr_drbg_free(&drbg);
+  mbedtls_entropy_free(&entropy);
+  oai_mem_free(queues);
+}
+#else
+static void bench_dtls(void) {
+  ESP_LOGW(CRYPTO_BENCH_TAG, "dtls skipped, mbedTLS built without DTLS-SRTP");
+}
+#endif
+
+bool oai_crypto_bench_run(void) {
+  ESP_LOGI(CRYPTO_BENCH_TAG, "Starting");
+  bench_failed = false;
+  bench_srtp();
+  bench_dtls();
+  ESP_LOGI(CRYPTO_BENCH_TAG, "%s", bench_failed ? "FAIL" : "Done");
+  return !bench_failed;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+// Measures the per-packet cost of SRTP and the DTLS handshake on this build.
+//
+// SRTP: protect and unprotect time per packet for each profile at voice and
+// video-sized payloads, through whichever AES_CM_128 backend
+// oai_srtp_cipher_select() registered.
+//
+// DTLS: wall time for a full DTLS 1.2 handshake with use_srtp between two
+// in-process mbedTLS endpoints, per certificate type and SRTP profile. Both
+// sides run on this CPU, so the figure is an upper bound on the device's
+// share of a real handshake. Key generation is not included.
+//
+// Results are logged. Runs at boot with CONFIG_OAI_CRYPTO_BENCH, or on Linux
+// with OAI_BENCH=crypto, after peer_init(). Returns false if any round trip
+// or handshake failed; a profile the build lacks is skipped, not failed.
+bool oai_crypto_bench_run(void);
@@ -0,0 +1,274 @@
+#include "dc_stream.h"
+
+#include <esp_log.h>
+#include <string.h>
+
+#include "mem_policy.h"
+#include "metrics.h"
+#include "sdkconfig.h"
+
+#ifdef LINUX_BUILD
+#include <stdio.h>
+#include <stdlib.h>
+#endif
+
+#define DC_STREAM_TAG "dc_stream"
+
+static oai_dc_event_fn event_handler = NULL;
+static char *assembly = NULL;
+static size_t assembly_size = 0;
+static size_t assembled = 0;  // Bytes of the split event gathered so far
+static size_t event_bytes = 0;  // Including any dropped for being oversize
+static size_t high_water = 0;
+
+// JSON framing state of the event in flight
+static bool in_event = false;
+static bool in_string = false;
+static bool escaped = false;
+static uint32_t depth = 0;
+
+void oai_dc_stream_init(oai_dc_event_fn on_event) {
+  event_handler = on_event;
+  if (assembly == NULL && CONFIG_OAI_DC_RX_KB > 0) {
+    assembly_size = (size_t)CONFIG_OAI_DC_RX_KB * 1024;
+    assembly = (char *)oai_mem_alloc(OAI_MEM_PSRAM, assembly_size + 1,
+                                     "dc_stream");
+    if (assembly == NULL) {
+      assembly_size = 0;
+    }
+  }
+  oai_dc_stream_reset();
+}
+
+void oai_dc_stream_reset(void) {
+  in_event = false;
+  in_string = false;
+  escaped = false;
+  depth = 0;
+  assembled = 0;
+  event_bytes = 0;
+}
+
+static void deliver(const char *text, size_t len) {
+  oai_metrics_histogram_observe(OAI_HISTOGRAM_DATACHANNEL_RX_BYTES,
+                                (uint32_t)len);
+  if (event_handler != NULL) {
+    event_handler(text, len);
+  }
+}
+
+// Advances *pos past the end of the current event and returns true, or to
+// len and returns false if the event goes on in the next payload.
+static bool scan(const char *data, size_t len, size_t *pos) {
+  for (; *pos < len; (*pos)++) {
+    char c = data[*pos];
+    if (in_string) {
+      if (escaped) {
+        escaped = false;
+      } else if (c == '\\') {
+        escaped = true;
+      } else if (c == '"') {
+        in_string = false;
+      }
+    } else if (c == '"') {
+      in_string = true;
+    } else if (c == '{' || c == '[') {
+      depth++;
+    } else if ((c == '}' || c == ']') && --depth == 0) {
+      (*pos)++;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void gather(const char *data, size_t len) {
+  if (event_bytes + len <= assembly_size) {
+    memcpy(assembly + assembled, data, len);
+    assembled += len;
+    if (assembled > high_water) {
+      high_water = assembled;
+      oai_metrics_gauge_set(OAI_GAUGE_DC_RX_HIGH_WATER, (int32_t)high_water);
+    }
+  }
+  event_bytes += len;
+}
+
+void oai_dc_stream_rx(const char *data, size_t len) {
+  size_t pos = 0;
+  while (pos < len) {
+    if (!in_event) {
+      while (pos < len && (data[pos] == ' ' || data[pos] == '\t' ||
+                           data[pos] == '\r' || data[pos] == '\n')) {
+        pos++;
+      }
+      if (pos == len) {
+        return;
+      }
+      if (data[pos] != '{' && data[pos] != '[') {
+        deliver(data + pos, len - pos);
+        return;
+      }
+      in_event = true;
+    }
+
+    size_t start = pos;
+    bool complete = scan(data, len, &pos);
+    if (complete && event_bytes == 0) {
+      deliver(data + start, pos - start);
+    } else {
+      gather(data + start, pos - start);
+      if (complete && event_bytes > assembled) {
+        ESP_LOGW(DC_STREAM_TAG, "Dropped a %u byte event, buffer is %u",
+                 (unsigned)event_bytes, (unsigned)assembly_size);
+        oai_metrics_counter_add(OAI_COUNTER_DATACHANNEL_RX_OVERSIZE, 1);
+      } else if (complete) {
+        assembly[assembled] = '\0';
+        deliver(assembly, assembled);
+      }
+    }
+    if (complete) {
+      oai_dc_stream_reset();
+    }
+  }
+}
+
+#ifdef LINUX_BUILD
+/**********************
+ * Stand-in peer
+ **********************/
+#define SELFTEST_EVENTS 64
+
+static char *expected[SELFTEST_EVENTS];
+static size_t expected_len[SELFTEST_EVENTS];
+static bool expected_fits[SELFTEST_EVENTS];
+static size_t next_expected = 0;
+static bool expect_all = false;  // Whole events are delivered at any size
+static bool selftest_ok = true;
+
+static void skip_oversize(void) {
+  while (!expect_all && next_expected < SELFTEST_EVENTS &&
+         !expected_fits[next_expected]) {
+    next_expected++;
+  }
+}
+
+static void selftest_on_event(const char *text, size_t len) {
+  skip_oversize();
+  if (next_expected == SELFTEST_EVENTS || len != expected_len[next_expected] ||
+      memcmp(text, expected[next_expected], len) != 0) {
+    ESP_LOGE(DC_STREAM_TAG, "Event %u came out wrong (%u bytes)",
+             (unsigned)next_expected, (unsigned)len);
+    selftest_ok = false;
+  }
+  next_expected++;
+}
+
+static uint32_t selftest_random(void) {
+  static uint32_t seed = 12345;
+  seed = seed * 1664525u + 1013904223u;
+  return seed >> 8;
+}
+
+// An event of about size bytes whose strings hold the characters that could
+// confuse the framing.
+static size_t selftest_event(char *out, size_t size, unsigned index) {
+  int len = snprintf(out, size,
+                     "{\"type\":\"response.text.delta\",\"n\":%u,\"nested\":"
+                     "{\"list\":[1,[2,3],{\"a\":\"}]\"}]},\"delta\":\"",
+                     index);
+  const char pattern[] = "quote \\\" brace } bracket ] backslash \\\\ ";
+  while ((size_t)len + sizeof(pattern) + 3 < size) {
+    memcpy(out + len, pattern, sizeof(pattern) - 1);
+    len += sizeof(pattern) - 1;
+  }
+  len += snprintf(out + len, size - len, "\"}");
+  return (size_t)len;
+}
+
+bool oai_dc_stream_selftest(void) {
+  oai_dc_stream_init(selftest_on_event);
+  if (assembly_size == 0) {
+    ESP_LOGE(DC_STREAM_TAG, "CONFIG_OAI_DC_RX_KB is 0");
+    return false;
+  }
+
+  // Mostly small events, some several MTUs long, one that only just fits
+  // and two that do not.
+  size_t total = 0;
+  for (unsigned i = 0; i < SELFTEST_EVENTS; i++) {
+    size_t size = 200 + selftest_random() % 400;
+    if (i % 8 == 3) {
+      size = 4000 + selftest_random() % 12000;
+    } else if (i == 20) {
+      size = assembly_size;
+    } else if (i == 40 || i == 41) {
+      size = assembly_size + 1 + selftest_random() % 4096;
+    }
+    expected[i] = (char *)malloc(size + 1);
+    expected_len[i] = selftest_event(expected[i], size + 1, i);
+    expected_fits[i] = expected_len[i] <= assembly_size;
+    total += expected_len[i];
+  }
+
+  // First whole events, two to a payload now and then, then the same events
+  // as one stream cut at random points, down to single bytes. Only split
+  // events are limited by the buffer, so the oversize pair is dropped in the
+  // second pass alone.
+  uint32_t dropped_before =
+      oai_metrics_counter_get(OAI_COUNTER_DATACHANNEL_RX_OVERSIZE);
+  for (int pass = 0; pass < 2 && selftest_ok; pass++) {
+    next_expected = 0;
+    expect_all = pass == 0;
+    char *stream = (char *)malloc(total);
+    size_t stream_len = 0;
+    for (unsigned i = 0; i < SELFTEST_EVENTS; i++) {
+      if (pass == 0 && i % 5 != 4) {
+        oai_dc_stream_rx(expected[i], expected_len[i]);
+        continue;
+      }
+      memcpy(stream + stream_len, expected[i], expected_len[i]);
+      stream_len += expected_len[i];
+      if (pass == 0) {
+        // Packed with the next event
+        memcpy(stream + stream_len, expected[i + 1], expected_len[i + 1]);
+        stream_len += expected_len[i + 1];
+        oai_dc_stream_rx(stream, stream_len);
+        stream_len = 0;
+        i++;
+      }
+    }
+    for (size_t pos = 0; pos < stream_len;) {
+      size_t fragment = selftest_random() % 4 == 0 ? 1 + selftest_random() % 8
+                                                   : 1 + selftest_random() % 1400;
+      fragment = fragment < stream_len - pos ? fragment : stream_len - pos;
+      oai_dc_stream_rx(stream + pos, fragment);
+      pos += fragment;
+    }
+    free(stream);
+    skip_oversize();
+    if (next_expected != SELFTEST_EVENTS) {
+      ESP_LOGE(DC_STREAM_TAG, "Pass %d: %u of %u events delivered", pass,
+               (unsigned)next_expected, SELFTEST_EVENTS);
+      selftest_ok = false;
+    }
+  }
+  uint32_t dropped =
+      oai_metrics_counter_get(OAI_COUNTER_DATACHANNEL_RX_OVERSIZE) -
+      dropped_before;
+  if (dropped != 2) {
+    ESP_LOGE(DC_STREAM_TAG, "%u oversize events dropped, expected 2",
+             (unsigned)dropped);
+    selftest_ok = false;
+  }
+
+  for (unsigned i = 0; i < SELFTEST_EVENTS; i++) {
+    free(expected[i]);
+  }
+  ESP_LOGI(DC_STREAM_TAG, "%s: %u events, %u bytes, buffer high water %u of %u",
+           selftest_ok ? "PASS" : "FAIL", SELFTEST_EVENTS, (unsigned)total,
+           (unsigned)high_water, (unsigned)assembly_size);
+  oai_dc_stream_init(NULL);
+  return selftest_ok;
+}
+#endif
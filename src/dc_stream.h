@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Inbound data channel events, reassembled as a stream. Every payload from
+// the data channel callback is scanned as it arrives for the end of the JSON
+// value it belongs to, so an event may come whole, split over any number of
+// callbacks, or packed with the next one. An event that arrives whole, the
+// usual case, is handed over in place without a copy. Only a split event is
+// gathered, in a PSRAM buffer of CONFIG_OAI_DC_RX_KB; there is one data
+// channel and at most one event in flight on it, so that is all the
+// reassembly state there is, and libpeer no longer needs a buffer the size
+// of the largest event. Events larger than the buffer are dropped and
+// counted in datachannel_rx_oversize; the datachannel_rx_bytes histogram and
+// the dc_rx_high_water gauge show what the buffer actually needs.
+//
+// Payloads that do not start a JSON object or array are passed on as they
+// are. Only the network task feeds the stream, so nothing is locked.
+
+// Receives one complete event, len bytes that are not necessarily NUL
+// terminated and only valid for the duration of the call.
+typedef void (*oai_dc_event_fn)(const char *text, size_t len);
+
+void oai_dc_stream_init(oai_dc_event_fn on_event);
+
+// Feeds one payload as received.
+void oai_dc_stream_rx(const char *data, size_t len);
+
+// Drops a partly received event, e.g. when the connection is replaced.
+void oai_dc_stream_reset(void);
+
+#ifdef LINUX_BUILD
+// Stand-in for the remote peer: sends small, packed, large and oversize
+// events through the stream in random fragment sizes and checks that every
+// event that fits comes out intact and in order. Returns false on the first
+// mismatch.
+bool oai_dc_stream_selftest(void);
+#endif
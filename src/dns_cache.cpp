@@ -0,0 +1,436 @@
+#include "dns_cache.h"
+
+#include <arpa/inet.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <mutex>
+
+#include "metrics.h"
+
+#ifndef LINUX_BUILD
+#include <esp_random.h>
+
+#include "lwip/dns.h"
+#else
+#include <netdb.h>
+#include <stdlib.h>
+#endif
+
+#define DNS_CACHE_TAG "dns_cache"
+#define DNS_PORT 53
+#define DNS_PACKET_SIZE 512
+// A query unanswered for this long is sent again, until DNS_GIVE_UP_US.
+#define DNS_RETRY_US (1000 * 1000)
+#define DNS_GIVE_UP_US (5 * 1000 * 1000)
+// Refreshed this long before it expires, so the cached answer never lapses
+// while the device is connected. Short TTLs are refreshed at half their
+// lifetime but no more often than DNS_MIN_REFRESH_US; the answer still
+// expires when its TTL says.
+#define DNS_REFRESH_AHEAD_US (30 * 1000 * 1000LL)
+#define DNS_MIN_REFRESH_US (10 * 1000 * 1000LL)
+// After DNS_GIVE_UP_US without an answer, the poll waits this long to retry.
+#define DNS_BACKOFF_US (60 * 1000 * 1000LL)
+#define DNS_MAX_TTL_S (24 * 60 * 60)
+
+typedef struct {
+  char host[OAI_DNS_HOST_SIZE];
+  uint32_t addr;  // Network byte order, 0 if unknown
+  uint32_t ttl_s;
+} dns_entry_t;
+
+static std::mutex cache_mutex;
+static dns_entry_t entry;
+static int64_t resolved_us = 0;  // When the answer arrived
+static int64_t expires_us = 0;   // resolved_us plus the TTL
+static int64_t refresh_us = 0;  // When the poll sends the next query
+static int dns_socket = -1;
+static uint16_t query_id = 0;
+static int64_t query_sent_us = 0;  // 0 when no query is in flight
+static int64_t query_started_us = 0;
+
+/**********************
+ * Wire format
+ **********************/
+static size_t dns_build_query(const char *host, uint16_t id, uint8_t *out) {
+  uint8_t header[12] = {(uint8_t)(id >> 8), (uint8_t)id, 0x01, 0x00, 0, 1};
+  memcpy(out, header, sizeof(header));
+  size_t pos = sizeof(header);
+  while (*host != '\0') {
+    const char *dot = strchr(host, '.');
+    size_t label = dot != NULL ? (size_t)(dot - host) : strlen(host);
+    if (label == 0 || label > 63 || pos + label + 6 > DNS_PACKET_SIZE) {
+      return 0;
+    }
+    out[pos++] = (uint8_t)label;
+    memcpy(out + pos, host, label);
+    pos += label;
+    host += label + (dot != NULL ? 1 : 0);
+  }
+  out[pos++] = 0;
+  const uint8_t question[4] = {0, 1, 0, 1};  // A, IN
+  memcpy(out + pos, question, sizeof(question));
+  return pos + sizeof(question);
+}
+
+// Moves pos past a possibly compressed name.
+static bool dns_skip_name(const uint8_t *packet, size_t len, size_t *pos) {
+  while (*pos < len) {
+    uint8_t label = packet[*pos];
+    if ((label & 0xC0) == 0xC0) {
+      *pos += 2;
+      return *pos <= len;
+    }
+    *pos += 1 + label;
+    if (label == 0) {
+      return *pos <= len;
+    }
+  }
+  return false;
+}
+
+// The first A record and the lowest TTL along the answer, CNAMEs included.
+static bool dns_parse_answer(const uint8_t *packet, size_t len, uint16_t id,
+                             uint32_t *addr, uint32_t *ttl_s) {
+  if (len < 12 || ((packet[0] << 8) | packet[1]) != id ||
+      (packet[2] & 0x80) == 0 || (packet[3] & 0x0F) != 0) {
+    return false;
+  }
+  uint16_t questions = (packet[4] << 8) | packet[5];
+  uint16_t answers = (packet[6] << 8) | packet[7];
+  size_t pos = 12;
+  for (uint16_t i = 0; i < questions; i++) {
+    if (!dns_skip_name(packet, len, &pos) || pos + 4 > len) {
+      return false;
+    }
+    pos += 4;
+  }
+  bool found = false;
+  uint32_t lowest = UINT32_MAX;
+  for (uint16_t i = 0; i < answers; i++) {
+    if (!dns_skip_name(packet, len, &pos) || pos + 10 > len) {
+      return false;
+    }
+    const uint8_t *rr = packet + pos;
+    uint16_t type = (rr[0] << 8) | rr[1];
+    uint32_t ttl = ((uint32_t)rr[4] << 24) | (rr[5] << 16) | (rr[6] << 8) |
+                   rr[7];
+    uint16_t rdlength = (rr[8] << 8) | rr[9];
+    pos += 10;
+    if (pos + rdlength > len) {
+      return false;
+    }
+    if (type == 1 && rdlength == 4 && !found) {
+      memcpy(addr, packet + pos, 4);
+      found = true;
+    }
+    if (type == 1 || type == 5) {
+      lowest = ttl < lowest ? ttl : lowest;
+    }
+    pos += rdlength;
+  }
+  if (!found) {
+    return false;
+  }
+  *ttl_s = lowest > DNS_MAX_TTL_S ? DNS_MAX_TTL_S : lowest;
+  return true;
+}
+
+/**********************
+ * Socket
+ **********************/
+static bool dns_server(struct sockaddr_in *server) {
+  memset(server, 0, sizeof(*server));
+  server->sin_family = AF_INET;
+  server->sin_port = htons(DNS_PORT);
+#ifndef LINUX_BUILD
+  const ip_addr_t *dns = dns_getserver(0);
+  if (dns == NULL || !IP_IS_V4(dns) || ip_addr_isany(dns)) {
+    return false;
+  }
+  server->sin_addr.s_addr = ip_2_ip4(dns)->addr;
+  return true;
+#else
+  FILE *file = fopen("/etc/resolv.conf", "r");
+  if (file == NULL) {
+    return false;
+  }
+  char line[128];
+  char addr[OAI_DNS_ADDR_SIZE];
+  bool found = false;
+  while (!found && fgets(line, sizeof(line), file) != NULL) {
+    found = sscanf(line, "nameserver %15s", addr) == 1 &&
+            inet_pton(AF_INET, addr, &server->sin_addr) == 1;
+  }
+  fclose(file);
+  return found;
+#endif
+}
+
+static uint16_t dns_random_id(void) {
+#ifndef LINUX_BUILD
+  return (uint16_t)esp_random();
+#else
+  return (uint16_t)rand();
+#endif
+}
+
+// Called with cache_mutex held.
+static void dns_send_query(int64_t now_us) {
+  struct sockaddr_in server;
+  if (!dns_server(&server)) {
+    return;
+  }
+  if (dns_socket < 0) {
+    dns_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (dns_socket < 0) {
+      ESP_LOGE(DNS_CACHE_TAG, "Can not open a socket");
+      return;
+    }
+    fcntl(dns_socket, F_SETFL, fcntl(dns_socket, F_GETFL, 0) | O_NONBLOCK);
+  }
+  uint8_t query[DNS_PACKET_SIZE];
+  if (query_sent_us == 0) {
+    query_id = dns_random_id();
+    query_started_us = now_us;
+  }
+  size_t len = dns_build_query(entry.host, query_id, query);
+  if (len > 0 && sendto(dns_socket, query, len, 0, (struct sockaddr *)&server,
+                        sizeof(server)) == (ssize_t)len) {
+    query_sent_us = now_us;
+  }
+}
+
+// Whether the cached address is still within its TTL. Called with
+// cache_mutex held.
+static bool dns_fresh(int64_t now_us) {
+  return entry.addr != 0 && now_us <= expires_us;
+}
+
+// Reads whatever answers arrived. Called with cache_mutex held.
+static void dns_receive(int64_t now_us) {
+  if (dns_socket < 0 || query_sent_us == 0) {
+    return;
+  }
+  uint8_t packet[DNS_PACKET_SIZE];
+  ssize_t len;
+  while ((len = recv(dns_socket, packet, sizeof(packet), 0)) > 0) {
+    uint32_t addr;
+    uint32_t ttl_s;
+    if (!dns_parse_answer(packet, len, query_id, &addr, &ttl_s)) {
+      continue;
+    }
+    entry.addr = addr;
+    entry.ttl_s = ttl_s;
+    resolved_us = now_us;
+    int64_t ttl_us = ttl_s * 1000000LL;
+    int64_t refresh_in = ttl_us - DNS_REFRESH_AHEAD_US;
+    refresh_in = refresh_in > ttl_us / 2 ? refresh_in : ttl_us / 2;
+    refresh_in = refresh_in > DNS_MIN_REFRESH_US ? refresh_in
+                                                 : DNS_MIN_REFRESH_US;
+    expires_us = now_us + ttl_us;
+    refresh_us = now_us + refresh_in;
+    query_sent_us = 0;
+    char text[OAI_DNS_ADDR_SIZE];
+    inet_ntop(AF_INET, &addr, text, sizeof(text));
+    ESP_LOGI(DNS_CACHE_TAG, "%s is %s for %lu s, resolved in %lld ms",
+             entry.host, text, (unsigned long)ttl_s,
+             (long long)((now_us - query_started_us) / 1000));
+    return;
+  }
+}
+
+/**********************
+ * API
+ **********************/
+void oai_dns_cache_prefetch(const char *host) {
+  if (strlen(host) >= sizeof(entry.host)) {
+    return;
+  }
+  int64_t now = esp_timer_get_time();
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  if (strcmp(entry.host, host) != 0) {
+    memset(&entry, 0, sizeof(entry));
+    strcpy(entry.host, host);
+    resolved_us = 0;
+    expires_us = 0;
+    refresh_us = 0;
+    query_sent_us = 0;
+  }
+  if (dns_fresh(now) || query_sent_us != 0) {
+    return;
+  }
+  dns_send_query(now);
+}
+
+void oai_dns_cache_poll(int64_t now_us) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  if (entry.host[0] == '\0') {
+    return;
+  }
+  dns_receive(now_us);
+  if (query_sent_us != 0 && now_us - query_started_us > DNS_GIVE_UP_US) {
+    ESP_LOGW(DNS_CACHE_TAG, "No answer for %s", entry.host);
+    query_sent_us = 0;
+    refresh_us = now_us + DNS_BACKOFF_US;
+  } else if (query_sent_us != 0 ? now_us - query_sent_us > DNS_RETRY_US
+                                : refresh_us != 0 && now_us >= refresh_us) {
+    dns_send_query(now_us);
+  }
+}
+
+bool oai_dns_cache_lookup(const char *host, char addr[OAI_DNS_ADDR_SIZE],
+                          uint32_t timeout_ms) {
+  int64_t start = esp_timer_get_time();
+  int64_t deadline = start + timeout_ms * 1000LL;
+  std::unique_lock<std::mutex> lock(cache_mutex);
+  if (strcmp(entry.host, host) != 0) {
+    return false;
+  }
+  // An expired address is not used; the lookup waits for the query in flight
+  // to refresh it. An answer that arrives during the wait is used even with a
+  // TTL of 0, since this lookup is what it was asked for.
+  bool waited = false;
+  int64_t now = start;
+  dns_receive(now);
+  if (!dns_fresh(now) && query_sent_us == 0) {
+    dns_send_query(now);
+  }
+  while (!dns_fresh(now) && resolved_us < start && now < deadline) {
+    if (query_sent_us != 0 && now - query_sent_us > DNS_RETRY_US) {
+      dns_send_query(now);
+    }
+    if (query_sent_us == 0) {
+      break;
+    }
+    int64_t wait =
+        deadline - now < DNS_RETRY_US ? deadline - now : DNS_RETRY_US;
+    struct timeval tv = {(time_t)(wait / 1000000),
+                         (suseconds_t)(wait % 1000000)};
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(dns_socket, &readable);
+    // Answers are only read by the network task; prefetch may send meanwhile.
+    lock.unlock();
+    select(dns_socket + 1, &readable, NULL, NULL, &tv);
+    lock.lock();
+    waited = true;
+    now = esp_timer_get_time();
+    dns_receive(now);
+  }
+
+  bool found = entry.addr != 0 && (dns_fresh(now) || resolved_us >= start);
+  if (found) {
+    inet_ntop(AF_INET, &entry.addr, addr, OAI_DNS_ADDR_SIZE);
+  }
+  oai_metrics_counter_add(waited || !found ? OAI_COUNTER_DNS_CACHE_MISSES
+                                          : OAI_COUNTER_DNS_CACHE_HITS,
+                          1);
+  oai_metrics_histogram_observe(OAI_HISTOGRAM_DNS_LOOKUP_US,
+                                (uint32_t)(esp_timer_get_time() - start));
+  return found;
+}
+
+void oai_dns_cache_invalidate(const char *host) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  if (strcmp(entry.host, host) == 0 && entry.addr != 0) {
+    entry.addr = 0;
+    expires_us = 0;
+    refresh_us = 0;
+  }
+}
+
+#ifdef LINUX_BUILD
+#define BENCH_ROUNDS 10
+#define BENCH_PORT 443
+#define BENCH_WAIT_US (2 * 1000 * 1000)
+
+// Opens and closes a TCP connection to addr, as oai_http_post() would before
+// the TLS handshake.
+static bool bench_connect(uint32_t addr) {
+  struct sockaddr_in server;
+  memset(&server, 0, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_port = htons(BENCH_PORT);
+  server.sin_addr.s_addr = addr;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = connect(fd, (struct sockaddr *)&server, sizeof(server)) == 0;
+  close(fd);
+  return ok;
+}
+
+// Resolves host through the system resolver and connects, the path
+// oai_http_request() takes without the cache. Returns the time taken, or -1.
+static int64_t bench_uncached(const char *host) {
+  int64_t start = esp_timer_get_time();
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *result = NULL;
+  if (getaddrinfo(host, NULL, &hints, &result) != 0 || result == NULL) {
+    return -1;
+  }
+  uint32_t addr = ((struct sockaddr_in *)result->ai_addr)->sin_addr.s_addr;
+  freeaddrinfo(result);
+  return bench_connect(addr) ? esp_timer_get_time() - start : -1;
+}
+
+// Prefetches host and polls until the answer is in, as the network loop does
+// while ICE gathers, then times the lookup and the connect. Returns -1 on
+// failure.
+static int64_t bench_cached(const char *host) {
+  oai_dns_cache_invalidate(host);
+  oai_dns_cache_prefetch(host);
+  char addr[OAI_DNS_ADDR_SIZE];
+  int64_t give_up = esp_timer_get_time() + BENCH_WAIT_US;
+  while (esp_timer_get_time() < give_up) {
+    oai_dns_cache_poll(esp_timer_get_time());
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (entry.addr != 0) {
+      break;
+    }
+    usleep(1000);
+  }
+  int64_t start = esp_timer_get_time();
+  uint32_t resolved;
+  if (!oai_dns_cache_lookup(host, addr, 0) ||
+      inet_pton(AF_INET, addr, &resolved) != 1 || !bench_connect(resolved)) {
+    return -1;
+  }
+  return esp_timer_get_time() - start;
+}
+
+bool oai_dns_cache_bench(const char *host) {
+  int64_t uncached_total = 0;
+  int64_t cached_total = 0;
+  for (int i = 0; i < BENCH_ROUNDS; i++) {
+    int64_t uncached = bench_uncached(host);
+    int64_t cached = bench_cached(host);
+    if (uncached < 0 || cached < 0) {
+      ESP_LOGE(DNS_CACHE_TAG, "Can not resolve and connect to %s:%d", host,
+               BENCH_PORT);
+      return false;
+    }
+    uncached_total += uncached;
+    cached_total += cached;
+  }
+  ESP_LOGI(DNS_CACHE_TAG,
+           "%s:%d: resolve and connect %lld us, cached connect %lld us, "
+           "%lld us saved per connect",
+           host, BENCH_PORT, (long long)(uncached_total / BENCH_ROUNDS),
+           (long long)(cached_total / BENCH_ROUNDS),
+           (long long)((uncached_total - cached_total) / BENCH_ROUNDS));
+  return true;
+}
+#endif
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Address cache for the Realtime API host, so connecting does not wait for
+// DNS. The query is sent as soon as the station has an address
+// (oai_dns_cache_prefetch() from on_got_ip) and the answer waits in the
+// socket until the offer is posted, by which time ICE gathering has long
+// hidden the round trip. Answers are kept for exactly the TTL the server
+// gave and refreshed from the network loop before they expire. An expired
+// address is never used: the lookup waits for the fresh answer instead, and
+// oai_http_request() resolves by name if none arrives in time or connecting
+// to the address fails. Nothing is persisted, since without a wall clock the
+// age of a stored answer can not be known after a reboot.
+//
+// dns_lookup_us is how long the connect path waited for an address and
+// signaling_us how long the whole offer took; dns_cache_hits and
+// dns_cache_misses count lookups answered without waiting or not.
+//
+// One host, IPv4 A records, the first DNS server of the station. On Linux the
+// server comes from /etc/resolv.conf.
+
+#define OAI_DNS_HOST_SIZE 64
+#define OAI_DNS_ADDR_SIZE 16
+
+// Sends a query for host unless a fresh answer is cached or one is already in
+// flight. Never blocks.
+void oai_dns_cache_prefetch(const char *host);
+
+// Collects answers and refreshes the entry before it expires. Call from the
+// network loop.
+void oai_dns_cache_poll(int64_t now_us);
+
+// Writes host's IPv4 address in dotted form to addr. Unless a fresh answer is
+// cached, waits up to timeout_ms for the query in flight. Returns false if no
+// answer within its TTL is there by then, in which case the caller resolves
+// by name.
+bool oai_dns_cache_lookup(const char *host, char addr[OAI_DNS_ADDR_SIZE],
+                          uint32_t timeout_ms);
+
+// Forgets host's address, e.g. after connecting to it failed.
+void oai_dns_cache_invalidate(const char *host);
+
+#ifdef LINUX_BUILD
+// Times a TCP connect to host:443 resolved through the system resolver
+// against one to the address the cache prefetched, and logs the time the
+// cache saves per connect. Needs network access. Returns false if host does
+// not resolve or connect.
+bool oai_dns_cache_bench(const char *host);
+#endif
@@ -0,0 +1,434 @@
+#include "dsp.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <atomic>
+
+#ifndef LINUX_BUILD
+#include <esp_cpu.h>
+#else
+#include <time.h>
+#endif
+
+#ifndef OAI_DSP_DEFAULT_STAGES
+#define OAI_DSP_DEFAULT_STAGES OAI_DSP_ALL_STAGES
+#endif
+
+// DC blocker pole, 0.995 in Q15.
+#define DC_POLE_Q15 32604
+
+#define HIGH_PASS_CUTOFF_HZ 100.0f
+#define BIQUAD_SHIFT 14
+
+#define NS_FFT_SIZE 256
+#define NS_HOP (NS_FFT_SIZE / 2)
+#define NS_BINS (NS_FFT_SIZE / 2 + 1)
+#define NS_OVER_SUBTRACTION 3.0f
+#define NS_GAIN_FLOOR 0.1f  // -20 dB
+#define NS_NOISE_INIT_BLOCKS 16
+// Per-block growth of the noise floor, about 1 dB/s, so sustained speech is
+// not learned as noise while a louder environment is still picked up.
+#define NS_NOISE_RISE 1.002f
+
+#define AGC_TARGET_RMS 3277.0f  // -20 dBFS
+#define AGC_GATE_RMS 58.0f      // -55 dBFS, below this the gain is held
+#define AGC_MAX_GAIN 8.0f       // +18 dB
+#define AGC_MIN_GAIN 0.25f      // -12 dB
+#define AGC_ATTACK 0.5f
+#define AGC_RELEASE 0.03f
+// Gain only adapts on frames this far above the tracked background level,
+// so pauses are not pumped up to the speech target.
+#define AGC_SPEECH_RATIO 4.0f  // 12 dB
+#define AGC_FLOOR_RISE 1.01f
+
+static std::atomic<uint32_t> enabled_stages{OAI_DSP_DEFAULT_STAGES};
+static std::atomic<uint32_t> shed_stages{0};
+static uint32_t active_stages = 0;
+static uint32_t stage_ticks[OAI_DSP_STAGE_MAX];
+
+static inline uint32_t dsp_ticks(void) {
+#ifndef LINUX_BUILD
+  return esp_cpu_get_cycle_count();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+static inline int16_t saturate16(int32_t value) {
+  if (value > INT16_MAX) {
+    return INT16_MAX;
+  }
+  if (value < INT16_MIN) {
+    return INT16_MIN;
+  }
+  return (int16_t)value;
+}
+
+typedef struct {
+  float cos[OAI_DSP_FFT_MAX / 2];
+  float sin[OAI_DSP_FFT_MAX / 2];
+} fft_tables_t;
+
+static const fft_tables_t &fft_tables(void) {
+  static const fft_tables_t tables = [] {
+    fft_tables_t t;
+    for (int k = 0; k < OAI_DSP_FFT_MAX / 2; k++) {
+      t.cos[k] = cosf(2.0f * (float)M_PI * k / OAI_DSP_FFT_MAX);
+      t.sin[k] = sinf(2.0f * (float)M_PI * k / OAI_DSP_FFT_MAX);
+    }
+    return t;
+  }();
+  return tables;
+}
+
+void oai_dsp_fft(float *re, float *im, size_t n, bool inverse) {
+  const fft_tables_t &tables = fft_tables();
+
+  for (size_t i = 1, j = 0; i < n; i++) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      float t = re[i];
+      re[i] = re[j];
+      re[j] = t;
+      t = im[i];
+      im[i] = im[j];
+      im[j] = t;
+    }
+  }
+
+  for (size_t len = 2; len <= n; len <<= 1) {
+    size_t half = len >> 1;
+    size_t step = OAI_DSP_FFT_MAX / len;
+    for (size_t i = 0; i < n; i += len) {
+      for (size_t k = 0; k < half; k++) {
+        float wr = tables.cos[k * step];
+        float wi = inverse ? tables.sin[k * step] : -tables.sin[k * step];
+        size_t a = i + k;
+        size_t b = a + half;
+        float tr = re[b] * wr - im[b] * wi;
+        float ti = re[b] * wi + im[b] * wr;
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+      }
+    }
+  }
+}
+
+// DC blocker: y[n] = x[n] - x[n-1] + p * y[n-1]
+static struct {
+  int32_t x1;
+  int32_t y1;
+} dc;
+
+static void dc_block_reset(void) { memset(&dc, 0, sizeof(dc)); }
+
+static void dc_block_process(int16_t *pcm, size_t samples) {
+  int32_t x1 = dc.x1;
+  int32_t y1 = dc.y1;
+  for (size_t i = 0; i < samples; i++) {
+    int32_t x = pcm[i];
+    int32_t y = x - x1 + ((DC_POLE_Q15 * y1) >> 15);
+    x1 = x;
+    y1 = y;
+    pcm[i] = saturate16(y);
+  }
+  dc.x1 = x1;
+  dc.y1 = y1;
+}
+
+// Second order Butterworth high-pass, direct form I with Q14 coefficients.
+// The rounding error is fed back into the next sample; without it the
+// low-frequency poles amplify truncation noise into an audible floor.
+static struct {
+  int32_t b0, b1, b2, a1, a2;
+  int32_t x1, x2, y1, y2;
+  int32_t error;
+} biquad;
+
+static void high_pass_design(uint32_t sample_rate) {
+  float w0 = 2.0f * (float)M_PI * HIGH_PASS_CUTOFF_HZ / (float)sample_rate;
+  float cosw = cosf(w0);
+  float alpha = sinf(w0) / (2.0f * (float)M_SQRT1_2);
+  float a0 = 1.0f + alpha;
+  float scale = (float)(1 << BIQUAD_SHIFT) / a0;
+
+  biquad.b0 = (int32_t)lrintf((1.0f + cosw) / 2.0f * scale);
+  // Exactly -2 * b0 so the zeros sit on DC despite rounding.
+  biquad.b1 = -2 * biquad.b0;
+  biquad.b2 = biquad.b0;
+  biquad.a1 = (int32_t)lrintf(-2.0f * cosw * scale);
+  biquad.a2 = (int32_t)lrintf((1.0f - alpha) * scale);
+}
+
+static void high_pass_reset(void) {
+  biquad.x1 = biquad.x2 = biquad.y1 = biquad.y2 = 0;
+  biquad.error = 0;
+}
+
+static void high_pass_process(int16_t *pcm, size_t samples) {
+  int32_t x1 = biquad.x1, x2 = biquad.x2, y1 = biquad.y1, y2 = biquad.y2;
+  int32_t error = biquad.error;
+  for (size_t i = 0; i < samples; i++) {
+    int32_t x = pcm[i];
+    int64_t acc = (int64_t)biquad.b0 * x + (int64_t)biquad.b1 * x1 +
+                  (int64_t)biquad.b2 * x2 - (int64_t)biquad.a1 * y1 -
+                  (int64_t)biquad.a2 * y2 + error;
+    int32_t y = (int32_t)(acc >> BIQUAD_SHIFT);
+    error = (int32_t)(acc - ((int64_t)y << BIQUAD_SHIFT));
+    x2 = x1;
+    x1 = x;
+    y2 = y1;
+    y1 = y;
+    pcm[i] = saturate16(y);
+  }
+  biquad.x1 = x1;
+  biquad.x2 = x2;
+  biquad.y1 = y1;
+  biquad.y2 = y2;
+  biquad.error = error;
+}
+
+// Spectral noise suppression: 50% overlapped sqrt-Hann frames, a per-bin
+// noise floor that follows minima quickly and rises slowly, and a floored
+// Wiener gain. Adds NS_HOP samples of latency.
+static struct {
+  float window[NS_FFT_SIZE];
+  float analysis[NS_FFT_SIZE];
+  float overlap[NS_HOP];
+  float noise[NS_BINS];
+  float gain[NS_BINS];
+  float re[NS_FFT_SIZE];
+  float im[NS_FFT_SIZE];
+  int16_t hop_in[NS_HOP];
+  int16_t hop_out[NS_HOP];
+  size_t position;
+  uint32_t blocks;
+} ns;
+
+static void noise_suppress_reset(void) {
+  memset(ns.analysis, 0, sizeof(ns.analysis));
+  memset(ns.overlap, 0, sizeof(ns.overlap));
+  memset(ns.noise, 0, sizeof(ns.noise));
+  memset(ns.hop_in, 0, sizeof(ns.hop_in));
+  memset(ns.hop_out, 0, sizeof(ns.hop_out));
+  for (int k = 0; k < NS_BINS; k++) {
+    ns.gain[k] = 1.0f;
+  }
+  ns.position = 0;
+  ns.blocks = 0;
+}
+
+static void noise_suppress_init(void) {
+  for (int n = 0; n < NS_FFT_SIZE; n++) {
+    ns.window[n] =
+        sqrtf(0.5f * (1.0f - cosf(2.0f * (float)M_PI * n / NS_FFT_SIZE)));
+  }
+  noise_suppress_reset();
+}
+
+static void noise_suppress_block(void) {
+  memmove(ns.analysis, ns.analysis + NS_HOP, NS_HOP * sizeof(float));
+  for (int n = 0; n < NS_HOP; n++) {
+    ns.analysis[NS_HOP + n] = ns.hop_in[n] * (1.0f / 32768.0f);
+  }
+  for (int n = 0; n < NS_FFT_SIZE; n++) {
+    ns.re[n] = ns.analysis[n] * ns.window[n];
+    ns.im[n] = 0.0f;
+  }
+
+  oai_dsp_fft(ns.re, ns.im, NS_FFT_SIZE, false);
+
+  bool learning = ns.blocks < NS_NOISE_INIT_BLOCKS;
+  for (int k = 0; k < NS_BINS; k++) {
+    float power = ns.re[k] * ns.re[k] + ns.im[k] * ns.im[k];
+    if (learning) {
+      ns.noise[k] += power / NS_NOISE_INIT_BLOCKS;
+    } else if (power < ns.noise[k]) {
+      ns.noise[k] = 0.9f * ns.noise[k] + 0.1f * power;
+    } else {
+      ns.noise[k] *= NS_NOISE_RISE;
+    }
+
+    float gain = 1.0f;
+    if (!learning && power > 0.0f) {
+      float snr = power / (NS_OVER_SUBTRACTION * ns.noise[k] + 1e-12f) - 1.0f;
+      gain = snr > 0.0f ? snr / (snr + 1.0f) : 0.0f;
+      if (gain < NS_GAIN_FLOOR) {
+        gain = NS_GAIN_FLOOR;
+      }
+    }
+    ns.gain[k] = 0.5f * ns.gain[k] + 0.5f * gain;
+
+    ns.re[k] *= ns.gain[k];
+    ns.im[k] *= ns.gain[k];
+    if (k > 0 && k < NS_FFT_SIZE / 2) {
+      ns.re[NS_FFT_SIZE - k] = ns.re[k];
+      ns.im[NS_FFT_SIZE - k] = -ns.im[k];
+    }
+  }
+  ns.blocks++;
+
+  oai_dsp_fft(ns.re, ns.im, NS_FFT_SIZE, true);
+
+  const float scale = 32768.0f / NS_FFT_SIZE;
+  for (int n = 0; n < NS_HOP; n++) {
+    float y = ns.re[n] * ns.window[n] * scale + ns.overlap[n];
+    ns.hop_out[n] = saturate16((int32_t)lrintf(y));
+    ns.overlap[n] = ns.re[NS_HOP + n] * ns.window[NS_HOP + n] * scale;
+  }
+}
+
+static void noise_suppress_process(int16_t *pcm, size_t samples) {
+  for (size_t i = 0; i < samples; i++) {
+    int16_t out = ns.hop_out[ns.position];
+    ns.hop_in[ns.position] = pcm[i];
+    pcm[i] = out;
+    if (++ns.position == NS_HOP) {
+      noise_suppress_block();
+      ns.position = 0;
+    }
+  }
+}
+
+// Frame-rate AGC towards a fixed RMS target with fast attack and slow
+// release. The gain ramps across each frame to avoid zipper noise.
+static float agc_gain = 1.0f;
+static float agc_floor = AGC_TARGET_RMS;
+
+static void agc_reset(void) {
+  agc_gain = 1.0f;
+  agc_floor = AGC_TARGET_RMS;
+}
+
+static void agc_process(int16_t *pcm, size_t samples) {
+  if (samples == 0) {
+    return;
+  }
+  int64_t energy = 0;
+  for (size_t i = 0; i < samples; i++) {
+    energy += (int32_t)pcm[i] * pcm[i];
+  }
+  float rms = sqrtf((float)energy / (float)samples);
+
+  if (rms < agc_floor) {
+    agc_floor = 0.8f * agc_floor + 0.2f * rms;
+  } else {
+    agc_floor *= AGC_FLOOR_RISE;
+  }
+
+  float target = agc_gain;
+  if (rms > AGC_GATE_RMS && rms > AGC_SPEECH_RATIO * agc_floor) {
+    float desired = AGC_TARGET_RMS / rms;
+    if (desired > AGC_MAX_GAIN) {
+      desired = AGC_MAX_GAIN;
+    } else if (desired < AGC_MIN_GAIN) {
+      desired = AGC_MIN_GAIN;
+    }
+    float rate = desired < agc_gain ? AGC_ATTACK : AGC_RELEASE;
+    target = agc_gain + (desired - agc_gain) * rate;
+  }
+
+  int32_t gain_q12 = (int32_t)(agc_gain * 4096.0f);
+  int32_t target_q12 = (int32_t)(target * 4096.0f);
+  int32_t step_q12 = (target_q12 - gain_q12) / (int32_t)samples;
+  for (size_t i = 0; i < samples; i++) {
+    pcm[i] = saturate16((pcm[i] * gain_q12) >> 12);
+    gain_q12 += step_q12;
+  }
+  agc_gain = target;
+}
+
+typedef struct {
+  const char *name;
+  void (*process)(int16_t *pcm, size_t samples);
+  void (*reset)(void);
+} stage_desc_t;
+
+static const stage_desc_t stages[OAI_DSP_STAGE_MAX] = {
+    {"dc_block", dc_block_process, dc_block_reset},
+    {"high_pass", high_pass_process, high_pass_reset},
+    {"noise_suppress", noise_suppress_process, noise_suppress_reset},
+    {"agc", agc_process, agc_reset},
+};
+
+void oai_dsp_init(uint32_t sample_rate) {
+  fft_tables();
+  high_pass_design(sample_rate);
+  noise_suppress_init();
+  for (const auto &stage : stages) {
+    stage.reset();
+  }
+  active_stages = 0;
+}
+
+void oai_dsp_set_stages(uint32_t mask) {
+  enabled_stages.store(mask & OAI_DSP_ALL_STAGES, std::memory_order_relaxed);
+}
+
+uint32_t oai_dsp_get_stages(void) {
+  return enabled_stages.load(std::memory_order_relaxed);
+}
+
+void oai_dsp_set_shed(uint32_t mask) {
+  shed_stages.store(mask & OAI_DSP_ALL_STAGES, std::memory_order_relaxed);
+}
+
+const char *oai_dsp_stage_name(oai_dsp_stage_t stage) {
+  return stages[stage].name;
+}
+
+uint32_t oai_dsp_stage_ticks(oai_dsp_stage_t stage) {
+  return stage_ticks[stage];
+}
+
+void oai_dsp_process(int16_t *pcm, size_t samples) {
+  uint32_t mask = enabled_stages.load(std::memory_order_relaxed) &
+                  ~shed_stages.load(std::memory_order_relaxed);
+  for (int i = 0; i < OAI_DSP_STAGE_MAX; i++) {
+    uint32_t bit = OAI_DSP_STAGE_BIT(i);
+    if (!(mask & bit)) {
+      stage_ticks[i] = 0;
+      continue;
+    }
+    // A stage coming back on starts from clean state rather than whatever
+    // it held when it was switched off.
+    if (!(active_stages & bit)) {
+      stages[i].reset();
+    }
+    uint32_t start = dsp_ticks();
+    stages[i].process(pcm, samples);
+    stage_ticks[i] = dsp_ticks() - start;
+  }
+  active_stages = mask;
+}
+
+uint32_t oai_dsp_rms(const int16_t *pcm, size_t samples) {
+  if (samples == 0) {
+    return 0;
+  }
+  int64_t energy = 0;
+  for (size_t i = 0; i < samples; i++) {
+    energy += (int32_t)pcm[i] * pcm[i];
+  }
+  return (uint32_t)sqrtf((float)energy / (float)samples);
+}
+
+uint8_t oai_dsp_audio_level(uint32_t rms) {
+  if (rms == 0) {
+    return 127;
+  }
+  float dbov = 20.0f * log10f((float)rms / 32768.0f);
+  if (dbov >= 0.0f) {
+    return 0;
+  }
+  return dbov <= -127.0f ? 127 : (uint8_t)lroundf(-dbov);
+}
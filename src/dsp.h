@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Microphone front end, run in place on each captured frame before encoding.
+// Stages run in table order and can be switched on and off at any time.
+typedef enum {
+  OAI_DSP_DC_BLOCK = 0,
+  OAI_DSP_HIGH_PASS,
+  OAI_DSP_NOISE_SUPPRESS,
+  OAI_DSP_AGC,
+  OAI_DSP_STAGE_MAX,
+} oai_dsp_stage_t;
+
+#define OAI_DSP_STAGE_BIT(stage) (1u << (stage))
+#define OAI_DSP_ALL_STAGES ((1u << OAI_DSP_STAGE_MAX) - 1)
+
+void oai_dsp_init(uint32_t sample_rate);
+void oai_dsp_set_stages(uint32_t mask);
+uint32_t oai_dsp_get_stages(void);
+// Stages in mask are skipped whatever oai_dsp_set_stages() enabled; the CPU
+// governor (governor.h) sheds optional stages this way.
+void oai_dsp_set_shed(uint32_t mask);
+const char *oai_dsp_stage_name(oai_dsp_stage_t stage);
+
+// Processes one mono frame of 16-bit PCM in place.
+void oai_dsp_process(int16_t *pcm, size_t samples);
+
+// Root mean square of a block of 16-bit PCM, 0 - 32768.
+uint32_t oai_dsp_rms(const int16_t *pcm, size_t samples);
+
+// Level of an RMS value as in RFC 6464: -dBov, 0 (full scale) to 127.
+uint8_t oai_dsp_audio_level(uint32_t rms);
+
+// Time each stage spent on the last frame, in CPU cycles on the device and
+// nanoseconds on the Linux build.
+uint32_t oai_dsp_stage_ticks(oai_dsp_stage_t stage);
+
+// In-place complex radix-2 FFT, n a power of two up to OAI_DSP_FFT_MAX.
+// The inverse transform is unscaled.
+#define OAI_DSP_FFT_MAX 512
+void oai_dsp_fft(float *re, float *im, size_t n, bool inverse);
@@ -0,0 +1,225 @@
+#include "governor.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "audio_format.h"
+#include "dsp.h"
+#include "main.h"
+#include "metrics.h"
+#include "sdkconfig.h"
+
+#ifdef LINUX_BUILD
+#include <math.h>
+#endif
+
+#define GOVERNOR_TAG "governor"
+
+#define GOVERNOR_NOMINAL_LEVEL 3
+#define GOVERNOR_MAX_LEVEL \
+  (GOVERNOR_NOMINAL_LEVEL + CONFIG_OAI_GOVERNOR_MAX_COMPLEXITY)
+// Windows in a row with twice the minimum slack before stepping up. Stepping
+// down takes one, so a level that does not fit is left within two seconds
+// and one that does is only tried again after six.
+#define GOVERNOR_UP_WINDOWS 3
+// Index of the 99th percentile in a sorted window
+#define GOVERNOR_P99_INDEX (OAI_GOVERNOR_WINDOW_FRAMES / 100)
+
+static std::atomic<int> level{GOVERNOR_NOMINAL_LEVEL};
+static std::atomic<uint32_t> playout_us{0};
+
+// Capture task only
+static int64_t frame_start_us = 0;  // 0 while no frame is open
+static uint32_t frames_since_charge = 0;
+static int32_t window[OAI_GOVERNOR_WINDOW_FRAMES];
+static size_t window_frames = 0;
+static int good_windows = 0;
+
+static uint32_t shed_for_level(int at) {
+  uint32_t shed = 0;
+  if (at < GOVERNOR_NOMINAL_LEVEL) {
+    shed |= OAI_GOVERNOR_SHED_METRICS;
+  }
+  if (at < GOVERNOR_NOMINAL_LEVEL - 1) {
+    shed |= OAI_GOVERNOR_SHED_UI;
+  }
+  if (at < GOVERNOR_NOMINAL_LEVEL - 2) {
+    shed |= OAI_GOVERNOR_SHED_NOISE_SUPPRESS;
+  }
+  return shed;
+}
+
+static int complexity_for_level(int at) {
+  return at > GOVERNOR_NOMINAL_LEVEL ? at - GOVERNOR_NOMINAL_LEVEL : 0;
+}
+
+static void apply_level(int next) {
+  level.store(next, std::memory_order_relaxed);
+  oai_dsp_set_shed(shed_for_level(next) & OAI_GOVERNOR_SHED_NOISE_SUPPRESS
+                       ? OAI_DSP_STAGE_BIT(OAI_DSP_NOISE_SUPPRESS)
+                       : 0);
+  oai_audio_set_encoder_complexity(complexity_for_level(next));
+  oai_metrics_gauge_set(OAI_GAUGE_GOVERNOR_LEVEL, next);
+  oai_metrics_gauge_set(OAI_GAUGE_ENCODER_COMPLEXITY,
+                        complexity_for_level(next));
+}
+
+void oai_governor_init(void) {
+  frame_start_us = 0;
+  frames_since_charge = 0;
+  window_frames = 0;
+  good_windows = 0;
+  playout_us.store(0, std::memory_order_relaxed);
+  apply_level(GOVERNOR_NOMINAL_LEVEL);
+}
+
+static void step(int next, int32_t p99) {
+  ESP_LOGI(GOVERNOR_TAG, "p99 slack %ld us, level %d -> %d (complexity %d)",
+           (long)p99, level.load(std::memory_order_relaxed), next,
+           complexity_for_level(next));
+  oai_metrics_counter_add(OAI_COUNTER_GOVERNOR_STEPS, 1);
+  apply_level(next);
+}
+
+static void evaluate_window(void) {
+  std::nth_element(window, window + GOVERNOR_P99_INDEX,
+                   window + OAI_GOVERNOR_WINDOW_FRAMES);
+  int32_t p99 = window[GOVERNOR_P99_INDEX];
+  oai_metrics_gauge_set(OAI_GAUGE_AUDIO_SLACK_P99_US, p99);
+  if (CONFIG_OAI_GOVERNOR_MIN_SLACK_US == 0) {
+    return;
+  }
+
+  int current = level.load(std::memory_order_relaxed);
+  if (p99 < CONFIG_OAI_GOVERNOR_MIN_SLACK_US) {
+    good_windows = 0;
+    if (current > 0) {
+      step(current - 1, p99);
+    }
+  } else if (p99 >= 2 * CONFIG_OAI_GOVERNOR_MIN_SLACK_US) {
+    if (++good_windows >= GOVERNOR_UP_WINDOWS && current < GOVERNOR_MAX_LEVEL) {
+      good_windows = 0;
+      step(current + 1, p99);
+    }
+  } else {
+    good_windows = 0;
+  }
+}
+
+void oai_governor_frame_begin(int64_t now_us) {
+  frame_start_us = now_us;
+  frames_since_charge++;
+}
+
+void oai_governor_frame_end(int64_t now_us) {
+  if (frame_start_us == 0) {
+    return;
+  }
+  // Playout time piles up while frames are skipped; spread it back out.
+  uint32_t playout = playout_us.exchange(0, std::memory_order_relaxed) /
+                     frames_since_charge;
+  frames_since_charge = 0;
+  int64_t busy = now_us - frame_start_us + playout;
+  frame_start_us = 0;
+
+  window[window_frames++] =
+      (int32_t)(MicFormat::kFrameMs * 1000LL - busy);
+  if (window_frames == OAI_GOVERNOR_WINDOW_FRAMES) {
+    window_frames = 0;
+    evaluate_window();
+  }
+}
+
+void oai_governor_add_playout_us(uint32_t us) {
+  playout_us.fetch_add(us, std::memory_order_relaxed);
+}
+
+int oai_governor_level(void) {
+  return level.load(std::memory_order_relaxed);
+}
+
+bool oai_governor_shedding(oai_governor_shed_t work) {
+  return shed_for_level(level.load(std::memory_order_relaxed)) & work;
+}
+
+#ifdef LINUX_BUILD
+/**********************
+ * Synthetic load test
+ **********************/
+typedef struct {
+  const char *name;
+  uint32_t load_us;  // Busy loop added to every frame
+  uint32_t frames;
+} bench_phase_t;
+
+static void spin_us(uint32_t us) {
+  int64_t end = esp_timer_get_time() + us;
+  while (esp_timer_get_time() < end) {
+  }
+}
+
+// A pitched vowel-like tone with a slow envelope and some noise, so every
+// DSP stage and the encoder have real work to do.
+static void synth_frame(int16_t *pcm, uint32_t frame) {
+  static uint32_t seed = 1;
+  for (size_t i = 0; i < MicFormat::kSamples; i++) {
+    float t = (float)(frame * MicFormat::kSamples + i) / MicFormat::kSampleRate;
+    float envelope = 0.5f + 0.5f * sinf(2.0f * (float)M_PI * 2.0f * t);
+    float voice = sinf(2.0f * (float)M_PI * 140.0f * t) +
+                  0.5f * sinf(2.0f * (float)M_PI * 700.0f * t);
+    seed = seed * 1664525u + 1013904223u;
+    float noise = (float)(int32_t)(seed >> 16 & 0x7fff) / 32768.0f - 0.5f;
+    pcm[i] = (int16_t)(6000.0f * envelope * voice + 600.0f * noise);
+  }
+}
+
+bool oai_governor_bench(void) {
+  static_assert(MicFormat::kChannels == 1, "the DSP chain expects mono");
+  const bench_phase_t phases[] = {
+      {"idle", 0, 2000},
+      // Leaves half the minimum slack before the frame is even encoded
+      {"overload",
+       MicFormat::kFrameMs * 1000 - CONFIG_OAI_GOVERNOR_MIN_SLACK_US / 2,
+       1000},
+      {"light", 2000, 2000},
+  };
+  static int16_t pcm[MicFormat::kSamples];
+
+  oai_init_audio_encoder();
+  oai_governor_init();
+  int overload_min = GOVERNOR_MAX_LEVEL;
+  uint32_t frame = 0;
+  for (const auto &phase : phases) {
+    int start_level = oai_governor_level();
+    int min_level = start_level;
+    for (uint32_t i = 0; i < phase.frames; i++, frame++) {
+      synth_frame(pcm, frame);
+      oai_governor_frame_begin(esp_timer_get_time());
+      const uint8_t *packet;
+      uint32_t rms;
+      oai_encode_audio(pcm, &packet, &rms);
+      spin_us(phase.load_us);
+      oai_governor_frame_end(esp_timer_get_time());
+      min_level = std::min(min_level, oai_governor_level());
+    }
+    ESP_LOGI(GOVERNOR_TAG,
+             "%-8s load %5lu us: level %d -> %d (lowest %d), p99 slack %ld us",
+             phase.name, (unsigned long)phase.load_us, start_level,
+             oai_governor_level(), min_level,
+             (long)oai_metrics_gauge_get(OAI_GAUGE_AUDIO_SLACK_P99_US));
+    if (phase.load_us > MicFormat::kFrameMs * 1000 / 2) {
+      overload_min = min_level;
+    }
+  }
+
+  bool shed = overload_min < GOVERNOR_NOMINAL_LEVEL;
+  bool recovered = oai_governor_level() >= GOVERNOR_NOMINAL_LEVEL;
+  ESP_LOGI(GOVERNOR_TAG, "%s: %s under overload, %s afterwards",
+           shed && recovered ? "PASS" : "FAIL", shed ? "shed" : "did not shed",
+           recovered ? "recovered" : "did not recover");
+  return shed && recovered;
+}
+#endif
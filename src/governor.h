@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+
+// CPU budget governor for the audio core. Capture and playout share one core
+// and have one frame period between them, so each encoded frame is charged
+// the time the capture task spent on it plus the decode time playout used
+// over the same period; the rest is slack. Every OAI_GOVERNOR_WINDOW_FRAMES
+// the 99th percentile of that slack is checked against
+// CONFIG_OAI_GOVERNOR_MIN_SLACK_US. Below it the governor steps down a level
+// at once; with twice that for a few windows in a row it steps back up.
+//
+// Each level below the top sheds one more piece of optional work:
+//
+//   nominal + n  Opus complexity n, up to CONFIG_OAI_GOVERNOR_MAX_COMPLEXITY
+//   nominal      complexity 0, everything else on (the fixed default before)
+//   nominal - 1  metrics publishing paused
+//   nominal - 2  UI and HUD refresh slowed down
+//   nominal - 3  noise suppression off
+//
+// The level, the complexity in use and the last p99 slack are reported as
+// gauges, and every step counts in governor_steps.
+
+#define OAI_GOVERNOR_WINDOW_FRAMES 100
+
+typedef enum {
+  OAI_GOVERNOR_SHED_METRICS = 1 << 0,
+  OAI_GOVERNOR_SHED_UI = 1 << 1,
+  OAI_GOVERNOR_SHED_NOISE_SUPPRESS = 1 << 2,
+} oai_governor_shed_t;
+
+// Starts at the nominal level. Call from the task that owns the encoder,
+// after oai_init_audio_encoder().
+void oai_governor_init(void);
+
+// Brackets the capture task's work on one frame, from the microphone read
+// returning to the packet being sent. Only frames that get as far as the
+// encoder count; a frame without an end is ignored. The end also applies any
+// step, so it has to run on the encoder's task.
+void oai_governor_frame_begin(int64_t now_us);
+void oai_governor_frame_end(int64_t now_us);
+
+// Decode time spent by the playout task, charged to the next frame.
+void oai_governor_add_playout_us(uint32_t us);
+
+int oai_governor_level(void);
+// True while the current level sheds the given piece of work. Safe from any
+// task.
+bool oai_governor_shedding(oai_governor_shed_t work);
+
+#ifdef LINUX_BUILD
+// Encodes synthetic speech through the real DSP chain and encoder while a
+// busy loop adds idle, overloaded and then light CPU load, and logs every
+// step. Returns false if the governor did not shed under overload or did not
+// recover afterwards.
+bool oai_governor_bench(void);
+#endif
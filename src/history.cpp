@@ -0,0 +1,889 @@
+#include "history.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "kws.h"
+#include "mem_policy.h"
+#include "metrics.h"
+#include "sdkconfig.h"
+#include "tasks.h"
+
+#ifndef LINUX_BUILD
+#include <esp_partition.h>
+#else
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+#define HISTORY_TAG "history"
+#define HISTORY_PARTITION_SUBTYPE 0x41
+// Flash program granularity; no single write crosses a page, so none holds
+// the cache longer than one page program.
+#define HISTORY_PAGE_SIZE 256
+// Records moved from the buffer to flash in one go
+#define HISTORY_BATCH_SIZE 2048
+#define HISTORY_EVENT_SIZE 160
+#define HISTORY_HTTP_CHUNK_SIZE 1024
+
+/**********************
+ * Flash
+ **********************/
+static uint32_t sectors = 0;
+static uint32_t flash_op_max_us = 0;
+
+static void flash_op_done(int64_t start) {
+  uint32_t took = (uint32_t)(esp_timer_get_time() - start);
+  oai_metrics_histogram_observe(OAI_HISTOGRAM_HISTORY_FLASH_OP_US, took);
+  if (took > flash_op_max_us) {
+    flash_op_max_us = took;
+  }
+}
+
+#ifndef LINUX_BUILD
+static std::mutex flash_mutex;  // One flash operation at a time
+static const esp_partition_t *partition = NULL;
+
+static bool flash_open(void) {
+  partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA,
+      (esp_partition_subtype_t)HISTORY_PARTITION_SUBTYPE, "history");
+  if (partition == NULL) {
+    return false;
+  }
+  sectors = partition->size / OAI_HISTORY_SECTOR_SIZE;
+  return sectors >= 2;
+}
+
+static bool flash_read(size_t offset, void *out, size_t len) {
+  std::lock_guard<std::mutex> lock(flash_mutex);
+  return esp_partition_read(partition, offset, out, len) == ESP_OK;
+}
+
+static bool flash_erase_sector(uint32_t sector) {
+  std::lock_guard<std::mutex> lock(flash_mutex);
+  int64_t start = esp_timer_get_time();
+  esp_err_t err = esp_partition_erase_range(
+      partition, sector * OAI_HISTORY_SECTOR_SIZE, OAI_HISTORY_SECTOR_SIZE);
+  flash_op_done(start);
+  return err == ESP_OK;
+}
+
+static bool flash_program(size_t offset, const void *data, size_t len) {
+  std::lock_guard<std::mutex> lock(flash_mutex);
+  int64_t start = esp_timer_get_time();
+  esp_err_t err = esp_partition_write(partition, offset, data, len);
+  flash_op_done(start);
+  return err == ESP_OK;
+}
+#else
+// NOR flash as on the module: erase sets a sector to 0xFF, programming can
+// only clear bits, and both take the device's typical time, during which the
+// emulated cache is held.
+#define HISTORY_EMU_SECTORS 64
+#define HISTORY_EMU_ERASE_US 45000
+#define HISTORY_EMU_PAGE_PROGRAM_US 700
+
+// The cache, held by every flash operation and taken in turn, as on the
+// device, where a task waiting for the cache runs once the operation ends.
+typedef struct {
+  std::mutex mutex;
+  std::condition_variable turn;
+  uint32_t next;
+  uint32_t serving;
+
+  void lock() {
+    std::unique_lock<std::mutex> guard(mutex);
+    uint32_t ticket = next++;
+    turn.wait(guard, [&] { return serving == ticket; });
+  }
+  void unlock() {
+    std::lock_guard<std::mutex> guard(mutex);
+    serving++;
+    turn.notify_all();
+  }
+} emu_cache_t;
+
+static emu_cache_t emu_cache;
+static uint8_t *emu_flash = NULL;
+static FILE *emu_file = NULL;
+static uint32_t emu_violations = 0;
+
+static void emu_persist(size_t offset, size_t len) {
+  if (emu_file != NULL) {
+    fseek(emu_file, offset, SEEK_SET);
+    fwrite(emu_flash + offset, 1, len, emu_file);
+    fflush(emu_file);
+  }
+}
+
+static bool flash_emulate(const char *path) {
+  size_t size = (size_t)HISTORY_EMU_SECTORS * OAI_HISTORY_SECTOR_SIZE;
+  if (emu_flash == NULL) {
+    emu_flash = (uint8_t *)malloc(size);
+    if (emu_flash == NULL) {
+      return false;
+    }
+  }
+  memset(emu_flash, 0xFF, size);
+  if (path != NULL) {
+    emu_file = fopen(path, "r+b");
+    if (emu_file == NULL) {
+      emu_file = fopen(path, "w+b");
+    }
+    if (emu_file == NULL) {
+      ESP_LOGE(HISTORY_TAG, "Can not open %s", path);
+      return false;
+    }
+    if (fread(emu_flash, 1, size, emu_file) != size) {
+      memset(emu_flash, 0xFF, size);
+      emu_persist(0, size);
+    }
+  }
+  sectors = HISTORY_EMU_SECTORS;
+  return true;
+}
+
+static bool flash_open(void) {
+  const char *path = getenv("OAI_HISTORY_FILE");
+  return path != NULL && flash_emulate(path);
+}
+
+static bool flash_read(size_t offset, void *out, size_t len) {
+  std::lock_guard<emu_cache_t> lock(emu_cache);
+  memcpy(out, emu_flash + offset, len);
+  return true;
+}
+
+static bool flash_erase_sector(uint32_t sector) {
+  std::lock_guard<emu_cache_t> lock(emu_cache);
+  int64_t start = esp_timer_get_time();
+  size_t offset = (size_t)sector * OAI_HISTORY_SECTOR_SIZE;
+  memset(emu_flash + offset, 0xFF, OAI_HISTORY_SECTOR_SIZE);
+  usleep(HISTORY_EMU_ERASE_US);
+  emu_persist(offset, OAI_HISTORY_SECTOR_SIZE);
+  flash_op_done(start);
+  return true;
+}
+
+static bool flash_program(size_t offset, const void *data, size_t len) {
+  std::lock_guard<emu_cache_t> lock(emu_cache);
+  int64_t start = esp_timer_get_time();
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (size_t i = 0; i < len; i++) {
+    if ((bytes[i] & ~emu_flash[offset + i]) != 0) {
+      emu_violations++;
+    }
+    emu_flash[offset + i] &= bytes[i];
+  }
+  usleep(HISTORY_EMU_PAGE_PROGRAM_US);
+  emu_persist(offset, len);
+  flash_op_done(start);
+  return true;
+}
+#endif
+
+/**********************
+ * Log
+ **********************/
+typedef struct {
+  uint32_t head_sector;  // Sector records are appended to
+  size_t head_offset;    // Next byte in it, OAI_HISTORY_SECTOR_SIZE if full
+  uint32_t sequence;     // Of the head sector
+  uint32_t erased_ahead;  // Erased sectors following the head
+} history_log_t;
+
+// Only changed by the history task, once started.
+static history_log_t log_state;
+static std::atomic<uint32_t> read_head_sector{0};
+static uint8_t *batch = NULL;
+
+static uint32_t read_u32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool sector_header(uint32_t sector, uint32_t *sequence) {
+  uint8_t header[OAI_HISTORY_SECTOR_HEADER_SIZE];
+  if (!flash_read((size_t)sector * OAI_HISTORY_SECTOR_SIZE, header,
+                  sizeof(header)) ||
+      memcmp(header, OAI_HISTORY_MAGIC, 4) != 0) {
+    return false;
+  }
+  *sequence = read_u32(header + 4);
+  return true;
+}
+
+static bool sector_erased(uint32_t sector) {
+  uint8_t chunk[HISTORY_PAGE_SIZE];
+  for (size_t offset = 0; offset < OAI_HISTORY_SECTOR_SIZE;
+       offset += sizeof(chunk)) {
+    if (!flash_read((size_t)sector * OAI_HISTORY_SECTOR_SIZE + offset, chunk,
+                    sizeof(chunk))) {
+      return false;
+    }
+    for (size_t i = 0; i < sizeof(chunk); i++) {
+      if (chunk[i] != 0xFF) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Finds the newest sector, the end of its records and the erased sectors
+// after it.
+static void history_recover(history_log_t *log) {
+  bool found = false;
+  for (uint32_t sector = 0; sector < sectors; sector++) {
+    uint32_t sequence;
+    if (sector_header(sector, &sequence) &&
+        (!found || (int32_t)(sequence - log->sequence) > 0)) {
+      found = true;
+      log->head_sector = sector;
+      log->sequence = sequence;
+    }
+  }
+  if (!found) {
+    // Appending starts with sector 0.
+    log->head_sector = sectors - 1;
+    log->sequence = 0;
+    log->head_offset = OAI_HISTORY_SECTOR_SIZE;
+  } else {
+    // A torn record ends the sector; appending goes on in the next one.
+    size_t offset = OAI_HISTORY_SECTOR_HEADER_SIZE;
+    size_t base = (size_t)log->head_sector * OAI_HISTORY_SECTOR_SIZE;
+    uint8_t header[OAI_HISTORY_RECORD_HEADER_SIZE];
+    while (offset + sizeof(header) <= OAI_HISTORY_SECTOR_SIZE &&
+           flash_read(base + offset, header, sizeof(header)) &&
+           header[0] != 0xFF) {
+      size_t next = offset + sizeof(header) + (header[2] | (header[3] << 8));
+      if (next > OAI_HISTORY_SECTOR_SIZE) {
+        offset = OAI_HISTORY_SECTOR_SIZE;
+        break;
+      }
+      offset = next;
+    }
+    log->head_offset = offset;
+  }
+  log->erased_ahead = 0;
+  while (log->erased_ahead < (uint32_t)CONFIG_OAI_HISTORY_ERASE_AHEAD &&
+         log->erased_ahead < sectors - 1 &&
+         sector_erased((log->head_sector + 1 + log->erased_ahead) % sectors)) {
+    log->erased_ahead++;
+  }
+}
+
+// Erasing the sector after the erased ones drops the oldest records. Erases
+// until want sectors are erased ahead of the head.
+static bool history_erase_ahead(history_log_t *log, uint32_t want) {
+  while (log->erased_ahead < want && log->erased_ahead < sectors - 1) {
+    if (!flash_erase_sector((log->head_sector + 1 + log->erased_ahead) %
+                            sectors)) {
+      ESP_LOGE(HISTORY_TAG, "Sector erase failed");
+      return false;
+    }
+    oai_metrics_counter_add(OAI_COUNTER_HISTORY_ERASES, 1);
+    log->erased_ahead++;
+    oai_metrics_gauge_set(OAI_GAUGE_HISTORY_ERASED_AHEAD,
+                          (int32_t)log->erased_ahead);
+  }
+  return true;
+}
+
+static bool history_open_sector(history_log_t *log, bool may_erase) {
+  if (log->erased_ahead == 0 &&
+      (!may_erase ||
+       !history_erase_ahead(log, CONFIG_OAI_HISTORY_ERASE_AHEAD))) {
+    return false;
+  }
+  uint32_t sector = (log->head_sector + 1) % sectors;
+  uint32_t sequence = log->sequence + 1;
+  uint8_t header[OAI_HISTORY_SECTOR_HEADER_SIZE] = {
+      'O',
+      'A',
+      'I',
+      'H',
+      (uint8_t)sequence,
+      (uint8_t)(sequence >> 8),
+      (uint8_t)(sequence >> 16),
+      (uint8_t)(sequence >> 24),
+  };
+  if (!flash_program((size_t)sector * OAI_HISTORY_SECTOR_SIZE, header,
+                     sizeof(header))) {
+    return false;
+  }
+  log->head_sector = sector;
+  log->head_offset = sizeof(header);
+  log->sequence = sequence;
+  log->erased_ahead--;
+  read_head_sector.store(sector, std::memory_order_release);
+  oai_metrics_gauge_set(OAI_GAUGE_HISTORY_ERASED_AHEAD,
+                        (int32_t)log->erased_ahead);
+  return true;
+}
+
+/**********************
+ * Batch buffer
+ **********************/
+static std::mutex buffer_mutex;
+static std::condition_variable writer_wake;
+static std::condition_variable buffer_drained;
+static uint8_t *buffer = NULL;
+static size_t buffer_size = 0;
+static size_t buffer_head = 0;  // Next byte written
+static size_t buffer_tail = 0;  // First byte not yet in flash
+static size_t buffered = 0;
+static bool flush_requested = false;
+// Set by the first record dropped, cleared once the buffer has drained
+static bool dropping = false;
+static uint32_t dropped_before = 0;
+
+static void buffer_write(const void *src, size_t len) {
+  const uint8_t *p = (const uint8_t *)src;
+  size_t first =
+      buffer_size - buffer_head < len ? buffer_size - buffer_head : len;
+  memcpy(buffer + buffer_head, p, first);
+  memcpy(buffer, p + first, len - first);
+  buffer_head = (buffer_head + len) % buffer_size;
+  buffered += len;
+}
+
+static void buffer_peek(size_t pos, void *dst, size_t len) {
+  uint8_t *p = (uint8_t *)dst;
+  pos %= buffer_size;
+  size_t first = buffer_size - pos < len ? buffer_size - pos : len;
+  memcpy(p, buffer + pos, first);
+  memcpy(p + first, buffer, len - first);
+}
+
+// Moves whole records from the buffer to flash until it is empty or a new
+// sector is needed that may not be erased now.
+static void history_drain(history_log_t *log, bool may_erase) {
+  while (1) {
+    size_t len = 0;
+    {
+      std::lock_guard<std::mutex> lock(buffer_mutex);
+      size_t room = OAI_HISTORY_SECTOR_SIZE - log->head_offset;
+      room = room < HISTORY_BATCH_SIZE ? room : HISTORY_BATCH_SIZE;
+      while (len < buffered) {
+        uint8_t header[OAI_HISTORY_RECORD_HEADER_SIZE];
+        buffer_peek(buffer_tail + len, header, sizeof(header));
+        size_t record = sizeof(header) + (header[2] | (header[3] << 8));
+        if (len + record > room) {
+          break;
+        }
+        buffer_peek(buffer_tail + len, batch + len, record);
+        len += record;
+      }
+      if (buffered == 0) {
+        return;
+      }
+    }
+    if (len == 0) {
+      if (!history_open_sector(log, may_erase)) {
+        return;
+      }
+      continue;
+    }
+
+    size_t offset = (size_t)log->head_sector * OAI_HISTORY_SECTOR_SIZE +
+                    log->head_offset;
+    for (size_t done = 0; done < len;) {
+      size_t page_room = HISTORY_PAGE_SIZE - (offset + done) % HISTORY_PAGE_SIZE;
+      size_t chunk = len - done < page_room ? len - done : page_room;
+      if (!flash_program(offset + done, batch + done, chunk)) {
+        ESP_LOGE(HISTORY_TAG, "Write failed, closing the sector");
+        log->head_offset = OAI_HISTORY_SECTOR_SIZE;
+        return;
+      }
+      done += chunk;
+    }
+    log->head_offset += len;
+    oai_metrics_counter_add(OAI_COUNTER_HISTORY_BYTES, (uint32_t)len);
+
+    std::lock_guard<std::mutex> lock(buffer_mutex);
+    buffer_tail = (buffer_tail + len) % buffer_size;
+    buffered -= len;
+    if (buffered == 0) {
+      buffer_drained.notify_all();
+    }
+  }
+}
+
+static std::atomic<bool> peer_connected{false};
+#ifdef LINUX_BUILD
+static std::atomic<int> bench_streaming{-1};
+#endif
+
+// An erase stalls every task that needs the cache, so it waits until no
+// audio is streamed; the I2S DMA ring then covers the capture task.
+static bool history_erase_allowed(void) {
+#if !defined(LINUX_BUILD) && defined(CONFIG_SPI_FLASH_AUTO_SUSPEND)
+  return true;
+#else
+#ifdef LINUX_BUILD
+  int streaming = bench_streaming.load();
+  if (streaming >= 0) {
+    return streaming == 0;
+  }
+#endif
+  return !peer_connected.load() || !oai_kws_uplink_open();
+#endif
+}
+
+static void history_task(void *user_data) {
+  bool blocked = false;  // Records wait for an erased sector
+  while (1) {
+    bool flushing;
+    {
+      // While blocked a full page is no reason to wake.
+      std::unique_lock<std::mutex> lock(buffer_mutex);
+      writer_wake.wait_for(
+          lock, std::chrono::milliseconds(CONFIG_OAI_HISTORY_FLUSH_MS), [&] {
+            return flush_requested ||
+                   (!blocked && buffered >= HISTORY_PAGE_SIZE);
+          });
+      flushing = flush_requested;
+    }
+    bool may_erase = flushing || history_erase_allowed();
+    bool erased =
+        !may_erase ||
+        history_erase_ahead(&log_state, CONFIG_OAI_HISTORY_ERASE_AHEAD);
+    history_drain(&log_state, may_erase);
+
+    bool was_blocked = blocked;
+    bool resumed = false;
+    {
+      std::lock_guard<std::mutex> lock(buffer_mutex);
+      blocked = buffered > 0 && log_state.erased_ahead == 0;
+      if (dropping && buffered == 0) {
+        dropping = false;
+        resumed = true;
+      }
+    }
+    if (resumed) {
+      ESP_LOGI(HISTORY_TAG, "Buffer drained, %u records were dropped",
+               (unsigned)(oai_metrics_counter_get(OAI_COUNTER_HISTORY_DROPPED) -
+                          dropped_before));
+    }
+    if (blocked && !was_blocked) {
+      ESP_LOGW(HISTORY_TAG,
+               "No erased sector, holding records while audio streams");
+    }
+    if (!erased) {
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(CONFIG_OAI_HISTORY_FLUSH_MS));
+    } else if (flushing) {
+      // Not drained means the flash failed; the flush times out.
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+}
+
+/**********************
+ * API
+ **********************/
+// Takes over the log in the opened partition.
+static void history_start(void) {
+  batch = (uint8_t *)oai_mem_alloc(OAI_MEM_INTERNAL, HISTORY_BATCH_SIZE,
+                                   "history");
+  uint8_t *ring = (uint8_t *)oai_mem_alloc(
+      OAI_MEM_PSRAM, CONFIG_OAI_HISTORY_BUFFER_KB * 1024, "history");
+  if (batch == NULL || ring == NULL) {
+    return;
+  }
+  history_recover(&log_state);
+  read_head_sector.store(log_state.head_sector, std::memory_order_release);
+  oai_metrics_gauge_set(OAI_GAUGE_HISTORY_ERASED_AHEAD,
+                        (int32_t)log_state.erased_ahead);
+  ESP_LOGI(HISTORY_TAG, "%u sectors, appending at sector %u offset %u",
+           (unsigned)sectors, (unsigned)log_state.head_sector,
+           (unsigned)log_state.head_offset);
+
+  {
+    std::lock_guard<std::mutex> lock(buffer_mutex);
+    buffer_size = CONFIG_OAI_HISTORY_BUFFER_KB * 1024;
+    buffer = ring;
+  }
+#ifndef LINUX_BUILD
+  oai_task_start(OAI_TASK_HISTORY, history_task, NULL);
+#else
+  std::thread(history_task, nullptr).detach();
+#endif
+  oai_history_append(OAI_HISTORY_BOOT, "", 0);
+}
+
+void oai_history_init(void) {
+  if (CONFIG_OAI_HISTORY_BUFFER_KB == 0 || buffer != NULL) {
+    return;
+  }
+  if (!flash_open()) {
+    ESP_LOGW(HISTORY_TAG, "No history partition, history is off");
+    return;
+  }
+  history_start();
+}
+
+void oai_history_append(oai_history_kind_t kind, const char *text,
+                        size_t len) {
+  if (len > OAI_HISTORY_MAX_TEXT) {
+    len = OAI_HISTORY_MAX_TEXT;
+  }
+  uint32_t ms = (uint32_t)(esp_timer_get_time() / 1000);
+  uint8_t header[OAI_HISTORY_RECORD_HEADER_SIZE] = {
+      (uint8_t)kind,       0,
+      (uint8_t)len,        (uint8_t)(len >> 8),
+      (uint8_t)ms,         (uint8_t)(ms >> 8),
+      (uint8_t)(ms >> 16), (uint8_t)(ms >> 24),
+  };
+
+  bool wake;
+  bool stopped = false;
+  {
+    std::lock_guard<std::mutex> lock(buffer_mutex);
+    if (buffer == NULL) {
+      return;
+    }
+    if (buffered + sizeof(header) + len > buffer_size) {
+      if (!dropping) {
+        dropped_before = oai_metrics_counter_get(OAI_COUNTER_HISTORY_DROPPED);
+        dropping = true;
+        stopped = true;
+      }
+      oai_metrics_counter_add(OAI_COUNTER_HISTORY_DROPPED, 1);
+      wake = false;
+    } else {
+      buffer_write(header, sizeof(header));
+      buffer_write(text, len);
+      wake = buffered >= HISTORY_PAGE_SIZE;
+    }
+  }
+  if (stopped) {
+    ESP_LOGW(HISTORY_TAG, "Buffer full, dropping records until it drains");
+  }
+  if (wake) {
+    writer_wake.notify_one();
+  }
+}
+
+void oai_history_event(const char *format, ...) {
+  char text[HISTORY_EVENT_SIZE];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  if (len > 0) {
+    oai_history_append(OAI_HISTORY_EVENT, text,
+                       len < (int)sizeof(text) ? len : sizeof(text) - 1);
+  }
+}
+
+void oai_history_on_peer_connected(bool connected) {
+  peer_connected.store(connected);
+}
+
+bool oai_history_flush(uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(buffer_mutex);
+  if (buffer == NULL) {
+    return true;
+  }
+  flush_requested = true;
+  writer_wake.notify_one();
+  bool drained =
+      buffer_drained.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                              [] { return buffered == 0; });
+  flush_requested = false;
+  return drained;
+}
+
+size_t oai_history_read(size_t offset, uint8_t *out, size_t len) {
+  static uint32_t oldest = 0;
+  if (buffer == NULL) {
+    return 0;
+  }
+  if (offset == 0) {
+    oldest = (read_head_sector.load(std::memory_order_acquire) + 1) % sectors;
+  }
+  // The index-th written sector from the oldest
+  size_t index = offset / OAI_HISTORY_SECTOR_SIZE;
+  for (uint32_t i = 0; i < sectors; i++) {
+    uint32_t sector = (oldest + i) % sectors;
+    uint32_t sequence;
+    if (!sector_header(sector, &sequence)) {
+      continue;
+    }
+    if (index > 0) {
+      index--;
+      continue;
+    }
+    size_t within = offset % OAI_HISTORY_SECTOR_SIZE;
+    if (len > OAI_HISTORY_SECTOR_SIZE - within) {
+      len = OAI_HISTORY_SECTOR_SIZE - within;
+    }
+    return flash_read((size_t)sector * OAI_HISTORY_SECTOR_SIZE + within, out,
+                      len)
+               ? len
+               : 0;
+  }
+  return 0;
+}
+
+#ifndef LINUX_BUILD
+static esp_err_t history_get_handler(httpd_req_t *req) {
+  // httpd serves requests from a single task, so one buffer is enough.
+  static uint8_t chunk[HISTORY_HTTP_CHUNK_SIZE];
+  httpd_resp_set_type(req, "application/octet-stream");
+  httpd_resp_set_hdr(req, "Content-Disposition",
+                     "attachment; filename=\"history.oaih\"");
+
+  esp_err_t err = ESP_OK;
+  size_t offset = 0;
+  size_t len;
+  while (err == ESP_OK &&
+         (len = oai_history_read(offset, chunk, sizeof(chunk))) > 0) {
+    err = httpd_resp_send_chunk(req, (const char *)chunk, len);
+    offset += len;
+  }
+  if (err == ESP_OK) {
+    err = httpd_resp_send_chunk(req, NULL, 0);
+  }
+  return err;
+}
+
+static const httpd_uri_t history_uri = {
+    .uri = "/history",
+    .method = HTTP_GET,
+    .handler = history_get_handler,
+    .user_ctx = NULL,
+};
+
+void oai_history_register_http(httpd_handle_t server) {
+  if (server != NULL && buffer != NULL) {
+    httpd_register_uri_handler(server, &history_uri);
+  }
+}
+#else
+/**********************
+ * Bench
+ **********************/
+#define BENCH_STREAMING_MS 3000
+#define BENCH_STREAMING_INTERVAL_MS 50
+#define BENCH_QUIET_MS 2000
+#define BENCH_FRAME_US 20000
+
+typedef struct {
+  uint32_t appended;
+  uint32_t last_kept;  // Newest record not dropped
+  uint32_t max_append_us;
+} bench_producer_t;
+
+// What the network task would append: one numbered transcript per interval,
+// or back to back when interval_ms is 0.
+static void bench_produce(bench_producer_t *producer, uint32_t duration_ms,
+                          uint32_t interval_ms) {
+  char text[OAI_HISTORY_MAX_TEXT];
+  int64_t end = esp_timer_get_time() + (int64_t)duration_ms * 1000;
+  while (esp_timer_get_time() < end) {
+    uint32_t seq = producer->appended++;
+    int len = snprintf(text, sizeof(text), "%08u ", (unsigned)seq);
+    size_t size = 60 + (seq * 37) % 400;
+    while ((size_t)len < size) {
+      text[len] = 'a' + (seq + len) % 26;
+      len++;
+    }
+    uint32_t dropped = oai_metrics_counter_get(OAI_COUNTER_HISTORY_DROPPED);
+    int64_t start = esp_timer_get_time();
+    oai_history_append(OAI_HISTORY_ASSISTANT, text, size);
+    uint32_t took = (uint32_t)(esp_timer_get_time() - start);
+    if (oai_metrics_counter_get(OAI_COUNTER_HISTORY_DROPPED) == dropped) {
+      producer->last_kept = seq;
+    }
+    if (took > producer->max_append_us) {
+      producer->max_append_us = took;
+    }
+    usleep(interval_ms > 0 ? interval_ms * 1000 : 200);
+  }
+}
+
+// What the capture task goes through: it runs from flash once per frame, so
+// it waits for whichever flash operation holds the cache.
+static void bench_capture(const std::atomic<bool> *running,
+                          uint32_t *max_stall_us) {
+  while (running->load()) {
+    int64_t start = esp_timer_get_time();
+    { std::lock_guard<emu_cache_t> lock(emu_cache); }
+    uint32_t stall = (uint32_t)(esp_timer_get_time() - start);
+    if (stall > *max_stall_us) {
+      *max_stall_us = stall;
+    }
+    usleep(BENCH_FRAME_US);
+  }
+}
+
+// Runs the producer and the capture stand-in together; returns the longest
+// stall of the capture task.
+static uint32_t bench_run(bench_producer_t *producer, uint32_t duration_ms,
+                          uint32_t interval_ms) {
+  std::atomic<bool> running{true};
+  uint32_t max_stall_us = 0;
+  std::thread capture(bench_capture, &running, &max_stall_us);
+  std::thread network(bench_produce, producer, duration_ms, interval_ms);
+  network.join();
+  running.store(false);
+  capture.join();
+  return max_stall_us;
+}
+
+static bool bench_wait_erased(uint32_t timeout_ms) {
+  int64_t end = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+  while (esp_timer_get_time() < end) {
+    if (oai_metrics_gauge_get(OAI_GAUGE_HISTORY_ERASED_AHEAD) ==
+        CONFIG_OAI_HISTORY_ERASE_AHEAD) {
+      return true;
+    }
+    usleep(10 * 1000);
+  }
+  return false;
+}
+
+// Parses the log as served by oai_history_read() and checks that the
+// numbered records only ever go up, ending with last.
+static bool bench_verify(uint32_t last, uint32_t *records) {
+  static uint8_t sector[OAI_HISTORY_SECTOR_SIZE];
+  int64_t previous = -1;
+  *records = 0;
+  for (size_t offset = 0;; offset += OAI_HISTORY_SECTOR_SIZE) {
+    size_t got = 0;
+    size_t len;
+    while (got < sizeof(sector) &&
+           (len = oai_history_read(offset + got, sector + got,
+                                   sizeof(sector) - got)) > 0) {
+      got += len;
+    }
+    if (got == 0) {
+      break;
+    }
+    size_t pos = OAI_HISTORY_SECTOR_HEADER_SIZE;
+    while (pos + OAI_HISTORY_RECORD_HEADER_SIZE <= got && sector[pos] != 0xFF) {
+      size_t text_len = sector[pos + 2] | (sector[pos + 3] << 8);
+      const uint8_t *text = sector + pos + OAI_HISTORY_RECORD_HEADER_SIZE;
+      if (sector[pos] == OAI_HISTORY_ASSISTANT) {
+        int64_t seq = atol((const char *)text);
+        if (seq <= previous) {
+          ESP_LOGE(HISTORY_TAG, "Record %lld after %lld", (long long)seq,
+                   (long long)previous);
+          return false;
+        }
+        previous = seq;
+        (*records)++;
+      }
+      pos += OAI_HISTORY_RECORD_HEADER_SIZE + text_len;
+    }
+  }
+  if (previous != (int64_t)last) {
+    ESP_LOGE(HISTORY_TAG, "Last record is %lld, expected %u",
+             (long long)previous, (unsigned)last);
+    return false;
+  }
+  return true;
+}
+
+bool oai_history_bench(void) {
+  if (CONFIG_OAI_HISTORY_BUFFER_KB == 0) {
+    ESP_LOGE(HISTORY_TAG, "CONFIG_OAI_HISTORY_BUFFER_KB is 0");
+    return false;
+  }
+  // A blank emulated partition, as after flashing, before the peer is up
+  bench_streaming.store(0);
+  if (buffer != NULL || !flash_emulate(NULL)) {
+    return false;
+  }
+  history_start();
+  bool ok = bench_wait_erased(5000);
+
+  // A conversation: no erase may happen however long it lasts.
+  bench_streaming.store(1);
+  bench_producer_t producer = {};
+  uint32_t erases = oai_metrics_counter_get(OAI_COUNTER_HISTORY_ERASES);
+  uint32_t dropped = oai_metrics_counter_get(OAI_COUNTER_HISTORY_DROPPED);
+  uint32_t bytes = oai_metrics_counter_get(OAI_COUNTER_HISTORY_BYTES);
+  flash_op_max_us = 0;
+  uint32_t streaming_stall_us =
+      bench_run(&producer, BENCH_STREAMING_MS, BENCH_STREAMING_INTERVAL_MS);
+  uint32_t streaming_erases =
+      oai_metrics_counter_get(OAI_COUNTER_HISTORY_ERASES) - erases;
+  ESP_LOGI(HISTORY_TAG,
+           "streaming: %u records, %u bytes to flash, %u dropped, %u erases, "
+           "longest flash op %u us, capture task stall %u us",
+           (unsigned)producer.appended,
+           (unsigned)(oai_metrics_counter_get(OAI_COUNTER_HISTORY_BYTES) -
+                      bytes),
+           (unsigned)(oai_metrics_counter_get(OAI_COUNTER_HISTORY_DROPPED) -
+                      dropped),
+           (unsigned)streaming_erases, (unsigned)flash_op_max_us,
+           (unsigned)streaming_stall_us);
+  // Page programs are all the capture task may wait for while streaming.
+  ok = ok && streaming_erases == 0 &&
+       streaming_stall_us < HISTORY_EMU_ERASE_US;
+
+  // Flat out with the uplink closed, wrapping the log: erases bound the
+  // throughput, and each one stalls the capture task for its full length.
+  bench_streaming.store(0);
+  erases = oai_metrics_counter_get(OAI_COUNTER_HISTORY_ERASES);
+  dropped = oai_metrics_counter_get(OAI_COUNTER_HISTORY_DROPPED);
+  bytes = oai_metrics_counter_get(OAI_COUNTER_HISTORY_BYTES);
+  flash_op_max_us = 0;
+  uint32_t max_append_us = producer.max_append_us;
+  producer.max_append_us = 0;
+  int64_t start = esp_timer_get_time();
+  uint32_t quiet_stall_us = bench_run(&producer, BENCH_QUIET_MS, 0);
+  ok = oai_history_flush(10 * 1000) && ok;
+  int64_t elapsed = esp_timer_get_time() - start;
+  uint32_t written =
+      oai_metrics_counter_get(OAI_COUNTER_HISTORY_BYTES) - bytes;
+  ESP_LOGI(HISTORY_TAG,
+           "uplink closed: %u bytes to flash in %lld ms (%u KB/s), "
+           "%u dropped, %u erases, audio task stall per erase %u us",
+           (unsigned)written, (long long)(elapsed / 1000),
+           (unsigned)(written * 1000 / 1024 / (elapsed / 1000)),
+           (unsigned)(oai_metrics_counter_get(OAI_COUNTER_HISTORY_DROPPED) -
+                      dropped),
+           (unsigned)(oai_metrics_counter_get(OAI_COUNTER_HISTORY_ERASES) -
+                      erases),
+           (unsigned)quiet_stall_us);
+  if (producer.max_append_us > max_append_us) {
+    max_append_us = producer.max_append_us;
+  }
+
+  // The log as a reboot finds it
+  history_log_t recovered = {};
+  history_recover(&recovered);
+  uint32_t records = 0;
+  bool verified = bench_verify(producer.last_kept, &records);
+  bool found = recovered.head_sector == log_state.head_sector &&
+               recovered.head_offset == log_state.head_offset &&
+               recovered.sequence == log_state.sequence;
+  if (!found) {
+    ESP_LOGE(HISTORY_TAG, "Recovered sector %u offset %u, log is at %u %u",
+             (unsigned)recovered.head_sector, (unsigned)recovered.head_offset,
+             (unsigned)log_state.head_sector, (unsigned)log_state.head_offset);
+  }
+  ok = ok && verified && found && emu_violations == 0 &&
+       max_append_us < 1000;
+  ESP_LOGI(HISTORY_TAG,
+           "%s: %u records read back, %u NOR violations, longest append %u us",
+           ok ? "PASS" : "FAIL", (unsigned)records, (unsigned)emu_violations,
+           (unsigned)max_append_us);
+  bench_streaming.store(-1);
+  return ok;
+}
+#endif
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef LINUX_BUILD
+#include "esp_http_server.h"
+#endif
+
+// Conversation and diagnostic history in the "history" flash partition, kept
+// across reboots for support. Transcripts and notable events are appended
+// with a short memcpy into a PSRAM batch buffer of CONFIG_OAI_HISTORY_BUFFER_KB
+// and the history task, the lowest priority task on core 0, programs them to
+// flash one page at a time. Appends never wait on flash, but every flash
+// operation turns the cache off and holds the other core, stalling the
+// capture and network tasks whatever their priority: a page program for
+// under a millisecond, a sector erase for tens to hundreds.
+//
+// The partition is a circular log of 4 KB sectors: the oldest sector is
+// erased when the log wraps, so every sector wears at the same rate. Sectors
+// are only erased while no audio is streamed, that is while the wake word
+// gate is closed or the peer is down, when the I2S DMA ring covers the stall;
+// CONFIG_OAI_HISTORY_ERASE_AHEAD sectors are kept erased ahead of the log for
+// the conversation that follows. Should a conversation fill them, records
+// wait in RAM and are dropped, and counted in history_dropped, once the
+// buffer is full. With CONFIG_SPI_FLASH_AUTO_SUSPEND the flash suspends an
+// erase whenever the cache is needed, so sectors are erased at any time. The
+// history_flash_op_us histogram shows how long each flash operation held the
+// cache.
+//
+// Flash layout, all integers little endian:
+//
+//   sector  "OAIH" u32 sequence, one more than the previous sector
+//           then records until the first 0xFF kind byte
+//   record  u8 kind  u8 reserved  u16 length  u32 milliseconds since boot
+//           then length bytes of UTF-8 text
+//
+// On Linux the partition is emulated in RAM with the erase and program times
+// of the device's flash, backed by OAI_HISTORY_FILE when set.
+
+#define OAI_HISTORY_MAGIC "OAIH"
+#define OAI_HISTORY_SECTOR_SIZE 4096
+#define OAI_HISTORY_SECTOR_HEADER_SIZE 8
+#define OAI_HISTORY_RECORD_HEADER_SIZE 8
+// Longer text is truncated.
+#define OAI_HISTORY_MAX_TEXT 1024
+
+typedef enum {
+  OAI_HISTORY_BOOT = 1,   // Empty, starts the records of one boot
+  OAI_HISTORY_USER,       // Transcript of what the user said
+  OAI_HISTORY_ASSISTANT,  // Transcript of the assistant's answer
+  OAI_HISTORY_EVENT,      // Connection and diagnostic events
+} oai_history_kind_t;
+
+// Finds the end of the log and starts the history task. Without the
+// partition, or with a 0 KB buffer, appends are ignored.
+void oai_history_init(void);
+
+void oai_history_append(oai_history_kind_t kind, const char *text, size_t len);
+void oai_history_event(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+// Fed by the network task as the peer connects and goes down.
+void oai_history_on_peer_connected(bool connected);
+
+// Waits up to timeout_ms for buffered records to reach flash, erasing
+// whatever it takes regardless of the power profile. For use right before a
+// restart. Returns false if records are still buffered.
+bool oai_history_flush(uint32_t timeout_ms);
+
+// Copies the log into out starting at offset and returns the bytes copied,
+// 0 at the end. The log is read as whole sectors, oldest first; sectors not
+// yet written are skipped.
+size_t oai_history_read(size_t offset, uint8_t *out, size_t len);
+
+#ifndef LINUX_BUILD
+// Serves the log as application/octet-stream on GET /history.
+void oai_history_register_http(httpd_handle_t server);
+#else
+// Writes transcripts through the emulated flash while a second thread stands
+// in for the network task, first while audio streams and then with the
+// uplink closed, and a third stands in for the capture task, which needs the
+// emulated cache once per frame. Reports flash throughput and the longest
+// stall of the capture task in each phase, which with the uplink closed is
+// the stall per erase. Then reads the log back and checks that every record
+// that was not dropped is there, in order. Returns false on any mismatch, or
+// if a sector was erased while audio streamed.
+bool oai_history_bench(void);
+#endif
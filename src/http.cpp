@@ -1,8 +1,12 @@
 #include <esp_http_client.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <string.h>
 
+#include "dns_cache.h"
 #include "main.h"
+#include "metrics.h"
+#include "session_config.h"
 
 #ifndef LINUX_BUILD
 #include "wifi_config.h"
@@ -13,6 +17,22 @@
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #endif
 
+// Longest the offer waits for an address when none is cached at all
+#define HTTP_DNS_WAIT_MS 2000
+
+int oai_http_accumulate(char *buffer, int used, const char *data, int len) {
+  if (used == 0) {
+    memset(buffer, 0, MAX_HTTP_OUTPUT_BUFFER);
+  }
+  // The last byte in buffer is kept for the NULL character in case of
+  // out-of-bound access.
+  int copy_len = MIN(len, MAX_HTTP_OUTPUT_BUFFER - used);
+  if (copy_len) {
+    memcpy(buffer + used, data, copy_len);
+  }
+  return used + copy_len;
+}
+
 esp_err_t oai_http_event_handler(esp_http_client_event_t *evt) {
   static int output_len;
   switch (evt->event_id) {
@@ -37,29 +57,14 @@ esp_err_t oai_http_event_handler(esp_http_client_event_t *evt) {
       break;
     case HTTP_EVENT_ON_DATA: {
       ESP_LOGD(LOG_TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-      if (esp_http_client_is_chunked_response(evt->client)) {
-        ESP_LOGE(LOG_TAG, "Chunked HTTP response not supported");
-#ifndef LINUX_BUILD
-        esp_restart();
-#endif
+      // A chunked answer is not collected; oai_http_post() fails the offer.
+      if (evt->user_data &&
+          !esp_http_client_is_chunked_response(evt->client)) {
+        output_len = oai_http_accumulate((char *)evt->user_data, output_len,
+                                         (const char *)evt->data,
+                                         evt->data_len);
       }
 
-      if (output_len == 0 && evt->user_data) {
-        memset(evt->user_data, 0, MAX_HTTP_OUTPUT_BUFFER);
-      }
-
-      // If user_data buffer is configured, copy the response into the buffer
-      int copy_len = 0;
-      if (evt->user_data) {
-        // The last byte in evt->user_data is kept for the NULL character in
-        // case of out-of-bound access.
-        copy_len = MIN(evt->data_len, (MAX_HTTP_OUTPUT_BUFFER - output_len));
-        if (copy_len) {
-          memcpy(((char *)evt->user_data) + output_len, evt->data, copy_len);
-        }
-      }
-      output_len += copy_len;
-
       break;
     }
     case HTTP_EVENT_ON_FINISH:
@@ -74,13 +79,43 @@ esp_err_t oai_http_event_handler(esp_http_client_event_t *evt) {
   return ESP_OK;
 }
 
-void oai_http_request(char *offer, char *answer) {
+// Splits OPENAI_REALTIMEAPI into host and the path after it, returning the
+// path or NULL. *scheme_len covers "https://".
+static const char *oai_http_realtime_host(char host[OAI_DNS_HOST_SIZE],
+                                          int *scheme_len) {
+  const char *start = strstr(OPENAI_REALTIMEAPI, "://");
+  if (start == NULL) {
+    return NULL;
+  }
+  start += 3;
+  const char *path = strchr(start, '/');
+  if (path == NULL || path - start >= OAI_DNS_HOST_SIZE) {
+    return NULL;
+  }
+  memcpy(host, start, path - start);
+  host[path - start] = '\0';
+  *scheme_len = start - OPENAI_REALTIMEAPI;
+  return path;
+}
+
+void oai_http_prefetch(void) {
+  char host[OAI_DNS_HOST_SIZE];
+  int scheme_len;
+  if (oai_http_realtime_host(host, &scheme_len) != NULL) {
+    oai_dns_cache_prefetch(host);
+  }
+}
+
+// Posts the offer to url. A url with the host's address instead of its name
+// comes with the name, for the TLS handshake and the Host header.
+static bool oai_http_post(const char *url, const char *host, char *offer,
+                          char *answer) {
   esp_http_client_config_t config;
   memset(&config, 0, sizeof(esp_http_client_config_t));
-
-  config.url = OPENAI_REALTIMEAPI;
+  config.url = url;
   config.event_handler = oai_http_event_handler;
   config.user_data = answer;
+  config.common_name = host;
 
 #ifndef LINUX_BUILD
   wifi_config_data_t nvs_config = {0}; 
@@ -92,17 +127,51 @@ void oai_http_request(char *offer, char *answer) {
 
   esp_http_client_handle_t client = esp_http_client_init(&config);
   esp_http_client_set_method(client, HTTP_METHOD_POST);
+  if (host != NULL) {
+    esp_http_client_set_header(client, "Host", host);
+  }
   esp_http_client_set_header(client, "Content-Type", "application/sdp");
   esp_http_client_set_header(client, "Authorization", answer);
   esp_http_client_set_post_field(client, offer, strlen(offer));
 
   esp_err_t err = esp_http_client_perform(client);
-  if (err != ESP_OK || esp_http_client_get_status_code(client) != 201) {
+  bool ok = err == ESP_OK && esp_http_client_get_status_code(client) == 201;
+  if (!ok) {
     ESP_LOGE(LOG_TAG, "Error perform http request %s", esp_err_to_name(err));
-#ifndef LINUX_BUILD
-    esp_restart();
-#endif
+  } else if (esp_http_client_is_chunked_response(client)) {
+    ESP_LOGE(LOG_TAG, "Chunked HTTP response not supported");
+    ok = false;
   }
-
   esp_http_client_cleanup(client);
+  return ok;
+}
+
+bool oai_http_request(char *offer, char *answer) {
+  int64_t start = esp_timer_get_time();
+  char url[sizeof(OPENAI_REALTIMEAPI) + OAI_DNS_ADDR_SIZE +
+           OAI_SESSION_MODEL_SIZE + 8];
+  const char *model = oai_session_config_get()->model;
+
+  // The address resolved while ICE was gathering, if there is one.
+  char host[OAI_DNS_HOST_SIZE];
+  char addr[OAI_DNS_ADDR_SIZE];
+  int scheme_len;
+  const char *path = oai_http_realtime_host(host, &scheme_len);
+  bool ok = false;
+  if (path != NULL && oai_dns_cache_lookup(host, addr, HTTP_DNS_WAIT_MS)) {
+    snprintf(url, sizeof(url), "%.*s%s%s?model=%s", scheme_len,
+             OPENAI_REALTIMEAPI, addr, path, model);
+    ok = oai_http_post(url, host, offer, answer);
+    if (!ok) {
+      ESP_LOGW(LOG_TAG, "%s failed at %s, resolving again", host, addr);
+      oai_dns_cache_invalidate(host);
+    }
+  }
+  if (!ok) {
+    snprintf(url, sizeof(url), "%s?model=%s", OPENAI_REALTIMEAPI, model);
+    ok = oai_http_post(url, NULL, offer, answer);
+  }
+  oai_metrics_histogram_observe(OAI_HISTOGRAM_SIGNALING_US,
+                                (uint32_t)(esp_timer_get_time() - start));
+  return ok;
 }
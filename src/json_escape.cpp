@@ -0,0 +1,54 @@
+#include "json_escape.h"
+
+#include <stdio.h>
+#include <string.h>
+
+bool oai_json_escape(char *dst, size_t len, const char *src) {
+  if (len == 0) {
+    return false;
+  }
+  size_t n = 0;
+  for (; *src != '\0'; src++) {
+    unsigned char c = (unsigned char)*src;
+    char escape[8] = {0};
+    switch (c) {
+      case '"':
+        strcpy(escape, "\\\"");
+        break;
+      case '\\':
+        strcpy(escape, "\\\\");
+        break;
+      case '\b':
+        strcpy(escape, "\\b");
+        break;
+      case '\f':
+        strcpy(escape, "\\f");
+        break;
+      case '\n':
+        strcpy(escape, "\\n");
+        break;
+      case '\r':
+        strcpy(escape, "\\r");
+        break;
+      case '\t':
+        strcpy(escape, "\\t");
+        break;
+      default:
+        if (c < 0x20) {
+          snprintf(escape, sizeof(escape), "\\u%04x", c);
+        } else {
+          escape[0] = (char)c;
+        }
+        break;
+    }
+    size_t width = strlen(escape);
+    if (n + width >= len) {
+      dst[n] = '\0';
+      return false;
+    }
+    memcpy(dst + n, escape, width);
+    n += width;
+  }
+  dst[n] = '\0';
+  return true;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stddef.h>
+
+// Escapes src as the body of a JSON string for the client events built with
+// snprintf (session.update, response.create, conversation.item.create):
+// quotes, backslashes and every control character, the common ones in their
+// short form and the rest as \u00XX. Writes at most len bytes including the
+// terminator and never splits an escape. Returns false if src was cut short.
+bool oai_json_escape(char *dst, size_t len, const char *src);
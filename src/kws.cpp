@@ -0,0 +1,808 @@
+#include "kws.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <math.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "audio_format.h"
+#include "dsp.h"
+#include "mem_policy.h"
+#include "metrics.h"
+#include "sdkconfig.h"
+
+#ifndef LINUX_BUILD
+#include <esp_cpu.h>
+#include <esp_partition.h>
+#else
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#endif
+
+#ifndef CONFIG_OAI_KWS_THRESHOLD
+#define CONFIG_OAI_KWS_THRESHOLD 850
+#endif
+
+#define KWS_TAG "kws"
+#define KWS_PARTITION_SUBTYPE 0x40
+#define KWS_HEADER_SIZE 20
+#define KWS_LAYER_HEADER_SIZE 16
+
+#define KWS_WINDOW_SAMPLES (MicFormat::kSampleRate * 30 / 1000)
+#define KWS_HOP_SAMPLES (MicFormat::kSampleRate * 20 / 1000)
+#define KWS_FFT_SIZE 512
+#define KWS_BINS (KWS_FFT_SIZE / 2 + 1)
+#define KWS_MEL_BANDS 40
+#define KWS_MEL_LOW_HZ 20.0f
+#define KWS_COEFFS 10
+#define KWS_MAX_FRAMES 100
+#define KWS_MAX_LAYERS 16
+#define KWS_MAX_CHANNELS 256
+#define KWS_MAX_CLASSES 16
+// One inference per this many hops. A word spans many windows, so scoring
+// every 40 ms loses nothing and halves the model's share of the core.
+#define KWS_INFER_HOPS 2
+// The keyword probability is averaged over this many inferences, so one
+// noisy window can not trigger on its own.
+#define KWS_SMOOTHING 3
+
+static_assert(KWS_WINDOW_SAMPLES <= KWS_FFT_SIZE,
+              "the MFCC window must fit in one FFT");
+static_assert(KWS_FFT_SIZE <= OAI_DSP_FFT_MAX, "FFT larger than the tables");
+static_assert(KWS_HOP_SAMPLES < KWS_WINDOW_SAMPLES, "windows must overlap");
+
+typedef struct {
+  uint8_t type;
+  uint8_t flags;
+  uint8_t kernel_h;
+  uint8_t kernel_w;
+  uint8_t stride_h;
+  uint8_t stride_w;
+  int32_t multiplier;
+  int8_t shift;
+  uint16_t in_h, in_w, in_c;
+  uint16_t out_h, out_w, out_c;
+  int pad_top, pad_left;
+  const int8_t *weights;
+  const int32_t *bias;
+} layer_t;
+
+typedef struct {
+  // Model, pointing into the mapped blob
+  uint8_t frames;
+  uint8_t classes;
+  uint8_t keyword;
+  float input_scale;
+  float output_scale;
+  int layer_count;
+  layer_t layers[KWS_MAX_LAYERS];
+  int8_t *tensors[2];
+
+  // Front end
+  float hann[KWS_WINDOW_SAMPLES];
+  int8_t mel_segment[KWS_BINS];  // -1 below the first band
+  float mel_weight[KWS_BINS];
+  float dct[KWS_COEFFS][KWS_MEL_BANDS];
+  float re[KWS_FFT_SIZE];
+  float im[KWS_FFT_SIZE];
+  int16_t history[KWS_WINDOW_SAMPLES];
+  size_t hop_fill;
+  uint32_t hops;
+  uint32_t frames_filled;
+  int8_t features[KWS_MAX_FRAMES * KWS_COEFFS];
+
+  // Detector
+  int32_t acc[KWS_MAX_CHANNELS];
+  float probabilities[KWS_SMOOTHING];
+  uint32_t inferences;
+} kws_t;
+
+static kws_t *kws = NULL;
+static std::atomic<bool> uplink_open{true};
+static uint32_t inference_ticks = 0;
+
+static inline uint32_t kws_ticks(void) {
+#ifndef LINUX_BUILD
+  return esp_cpu_get_cycle_count();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+/**********************
+ * Model
+ **********************/
+static inline uint16_t read_u16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static inline uint32_t align4(uint32_t n) { return (n + 3) & ~3u; }
+
+static uint16_t out_size(uint16_t in, uint8_t kernel, uint8_t stride,
+                         bool same, int *pad) {
+  if (same) {
+    uint16_t out = (in + stride - 1) / stride;
+    int total = (out - 1) * stride + kernel - in;
+    *pad = total > 0 ? total / 2 : 0;
+    return out;
+  }
+  *pad = 0;
+  return in < kernel ? 0 : (in - kernel) / stride + 1;
+}
+
+static bool parse_layers(const uint8_t *blob, size_t len, size_t *max_tensor) {
+  uint16_t h = kws->frames, w = KWS_COEFFS, c = 1;
+  size_t pos = KWS_HEADER_SIZE;
+  *max_tensor = h * w * c;
+
+  for (int i = 0; i < kws->layer_count; i++) {
+    if (pos + KWS_LAYER_HEADER_SIZE > len) {
+      return false;
+    }
+    const uint8_t *p = blob + pos;
+    layer_t *l = &kws->layers[i];
+    l->type = p[0];
+    l->flags = p[1];
+    l->kernel_h = p[2];
+    l->kernel_w = p[3];
+    l->stride_h = p[4];
+    l->stride_w = p[5];
+    l->out_c = read_u16(p + 6);
+    memcpy(&l->multiplier, p + 8, sizeof(int32_t));
+    l->shift = (int8_t)p[12];
+    l->in_h = h;
+    l->in_w = w;
+    l->in_c = c;
+    if (l->shift < -31 || l->shift > 30) {
+      return false;
+    }
+
+    bool same = l->flags & OAI_KWS_FLAG_SAME_PADDING;
+    size_t weights = 0;
+    switch (l->type) {
+      case OAI_KWS_CONV2D:
+      case OAI_KWS_DEPTHWISE_CONV2D:
+        if (l->kernel_h == 0 || l->kernel_w == 0 || l->stride_h == 0 ||
+            l->stride_w == 0) {
+          return false;
+        }
+        l->out_h = out_size(h, l->kernel_h, l->stride_h, same, &l->pad_top);
+        l->out_w = out_size(w, l->kernel_w, l->stride_w, same, &l->pad_left);
+        if (l->type == OAI_KWS_CONV2D) {
+          weights = (size_t)l->out_c * l->kernel_h * l->kernel_w * c;
+        } else if (l->out_c == c) {
+          weights = (size_t)l->kernel_h * l->kernel_w * c;
+        } else {
+          return false;
+        }
+        break;
+      case OAI_KWS_AVG_POOL:
+        l->out_h = l->out_w = 1;
+        l->out_c = c;
+        break;
+      case OAI_KWS_FULLY_CONNECTED:
+        l->out_h = l->out_w = 1;
+        weights = (size_t)l->out_c * h * w * c;
+        break;
+      default:
+        return false;
+    }
+    if (l->out_h == 0 || l->out_w == 0 || l->out_c == 0 ||
+        l->out_c > KWS_MAX_CHANNELS || c > KWS_MAX_CHANNELS) {
+      return false;
+    }
+
+    size_t bias = l->type == OAI_KWS_AVG_POOL ? 0 : l->out_c;
+    pos += KWS_LAYER_HEADER_SIZE;
+    l->weights = (const int8_t *)(blob + pos);
+    pos += align4(weights);
+    l->bias = (const int32_t *)(blob + pos);
+    pos += bias * sizeof(int32_t);
+    if (pos > len) {
+      return false;
+    }
+
+    h = l->out_h;
+    w = l->out_w;
+    c = l->out_c;
+    size_t size = (size_t)h * w * c;
+    *max_tensor = size > *max_tensor ? size : *max_tensor;
+  }
+  return h == 1 && w == 1 && c == kws->classes;
+}
+
+// The blob can be shorter than len, which for a partition is its size.
+static bool load_model(const uint8_t *blob, size_t len) {
+  if (len < KWS_HEADER_SIZE || memcmp(blob, "OKWS", 4) != 0 ||
+      blob[4] != OAI_KWS_MODEL_VERSION) {
+    ESP_LOGW(KWS_TAG, "No version %d model found", OAI_KWS_MODEL_VERSION);
+    return false;
+  }
+
+  kws = (kws_t *)oai_mem_alloc(OAI_MEM_INTERNAL, sizeof(kws_t), "kws");
+  if (kws == NULL) {
+    return false;
+  }
+  memset(kws, 0, sizeof(kws_t));
+  kws->layer_count = blob[5];
+  kws->frames = blob[6];
+  kws->classes = blob[8];
+  kws->keyword = blob[9];
+  memcpy(&kws->input_scale, blob + 12, sizeof(float));
+  memcpy(&kws->output_scale, blob + 16, sizeof(float));
+
+  size_t max_tensor = 0;
+  if (kws->layer_count == 0 || kws->layer_count > KWS_MAX_LAYERS ||
+      kws->frames == 0 || kws->frames > KWS_MAX_FRAMES ||
+      blob[7] != KWS_COEFFS || kws->classes < 2 ||
+      kws->classes > KWS_MAX_CLASSES || kws->keyword >= kws->classes ||
+      !(kws->input_scale > 0.0f) || !parse_layers(blob, len, &max_tensor)) {
+    ESP_LOGE(KWS_TAG, "Model does not match this front end or is truncated");
+    oai_mem_free(kws);
+    kws = NULL;
+    return false;
+  }
+
+  // Activations ping-pong between two buffers sized for the largest tensor.
+  kws->tensors[0] = (int8_t *)oai_mem_alloc(OAI_MEM_INTERNAL, 2 * max_tensor,
+                                            "kws tensors");
+  if (kws->tensors[0] == NULL) {
+    oai_mem_free(kws);
+    kws = NULL;
+    return false;
+  }
+  kws->tensors[1] = kws->tensors[0] + max_tensor;
+  ESP_LOGI(KWS_TAG, "%d layer model, %d classes, %u byte activations",
+           kws->layer_count, kws->classes, (unsigned)(2 * max_tensor));
+  return true;
+}
+
+/**********************
+ * Kernels
+ **********************/
+// acc * multiplier * 2^(shift - 31), rounded to nearest.
+static inline int8_t requantize(int32_t acc, const layer_t *l) {
+  int total = 31 - l->shift;
+  int64_t v = ((int64_t)acc * l->multiplier + ((int64_t)1 << (total - 1))) >>
+              total;
+  if ((l->flags & OAI_KWS_FLAG_RELU) && v < 0) {
+    v = 0;
+  }
+  return (int8_t)(v > 127 ? 127 : v < -128 ? -128 : v);
+}
+
+// The inner loops walk contiguous int8 runs with an int32 accumulator, which
+// is the shape the compiler vectorises.
+static inline int32_t dot_s8(const int8_t *a, const int8_t *b, size_t n) {
+  int32_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+static inline void mac_s8(int32_t *acc, const int8_t *a, const int8_t *b,
+                          size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    acc[i] += a[i] * b[i];
+  }
+}
+
+static void conv2d(const layer_t *l, const int8_t *in, int8_t *out) {
+  const size_t kernel_size = (size_t)l->kernel_h * l->kernel_w * l->in_c;
+  for (int oy = 0; oy < l->out_h; oy++) {
+    for (int ox = 0; ox < l->out_w; ox++) {
+      int y0 = oy * l->stride_h - l->pad_top;
+      int x0 = ox * l->stride_w - l->pad_left;
+      for (int oc = 0; oc < l->out_c; oc++) {
+        const int8_t *w = l->weights + oc * kernel_size;
+        int32_t acc = l->bias[oc];
+        for (int ky = 0; ky < l->kernel_h; ky++) {
+          int iy = y0 + ky;
+          if (iy < 0 || iy >= l->in_h) {
+            continue;
+          }
+          for (int kx = 0; kx < l->kernel_w; kx++) {
+            int ix = x0 + kx;
+            if (ix < 0 || ix >= l->in_w) {
+              continue;
+            }
+            acc += dot_s8(in + (iy * l->in_w + ix) * l->in_c,
+                          w + (ky * l->kernel_w + kx) * l->in_c, l->in_c);
+          }
+        }
+        *out++ = requantize(acc, l);
+      }
+    }
+  }
+}
+
+static void depthwise_conv2d(const layer_t *l, const int8_t *in, int8_t *out) {
+  int32_t *acc = kws->acc;
+  for (int oy = 0; oy < l->out_h; oy++) {
+    for (int ox = 0; ox < l->out_w; ox++) {
+      int y0 = oy * l->stride_h - l->pad_top;
+      int x0 = ox * l->stride_w - l->pad_left;
+      memcpy(acc, l->bias, l->in_c * sizeof(int32_t));
+      for (int ky = 0; ky < l->kernel_h; ky++) {
+        int iy = y0 + ky;
+        if (iy < 0 || iy >= l->in_h) {
+          continue;
+        }
+        for (int kx = 0; kx < l->kernel_w; kx++) {
+          int ix = x0 + kx;
+          if (ix < 0 || ix >= l->in_w) {
+            continue;
+          }
+          mac_s8(acc, in + (iy * l->in_w + ix) * l->in_c,
+                 l->weights + (ky * l->kernel_w + kx) * l->in_c, l->in_c);
+        }
+      }
+      for (int c = 0; c < l->in_c; c++) {
+        *out++ = requantize(acc[c], l);
+      }
+    }
+  }
+}
+
+static void avg_pool(const layer_t *l, const int8_t *in, int8_t *out) {
+  int32_t *acc = kws->acc;
+  int32_t count = l->in_h * l->in_w;
+  memset(acc, 0, l->in_c * sizeof(int32_t));
+  for (int i = 0; i < count; i++) {
+    for (int c = 0; c < l->in_c; c++) {
+      acc[c] += in[i * l->in_c + c];
+    }
+  }
+  for (int c = 0; c < l->in_c; c++) {
+    int32_t v = acc[c] >= 0 ? (acc[c] + count / 2) / count
+                            : (acc[c] - count / 2) / count;
+    out[c] = (int8_t)(v > 127 ? 127 : v < -128 ? -128 : v);
+  }
+}
+
+static void fully_connected(const layer_t *l, const int8_t *in, int8_t *out) {
+  size_t n = (size_t)l->in_h * l->in_w * l->in_c;
+  for (int o = 0; o < l->out_c; o++) {
+    out[o] = requantize(l->bias[o] + dot_s8(in, l->weights + o * n, n), l);
+  }
+}
+
+// Probability of the keyword class, smoothed over the last inferences.
+static float infer(void) {
+  int64_t start_us = esp_timer_get_time();
+  uint32_t start = kws_ticks();
+  const int8_t *in = kws->features;
+  for (int i = 0; i < kws->layer_count; i++) {
+    const layer_t *l = &kws->layers[i];
+    int8_t *out = kws->tensors[i & 1];
+    switch (l->type) {
+      case OAI_KWS_CONV2D:
+        conv2d(l, in, out);
+        break;
+      case OAI_KWS_DEPTHWISE_CONV2D:
+        depthwise_conv2d(l, in, out);
+        break;
+      case OAI_KWS_AVG_POOL:
+        avg_pool(l, in, out);
+        break;
+      case OAI_KWS_FULLY_CONNECTED:
+        fully_connected(l, in, out);
+        break;
+    }
+    in = out;
+  }
+
+  int8_t max = in[0];
+  for (int c = 1; c < kws->classes; c++) {
+    max = in[c] > max ? in[c] : max;
+  }
+  float sum = 0.0f;
+  for (int c = 0; c < kws->classes; c++) {
+    sum += expf((in[c] - max) * kws->output_scale);
+  }
+  float p = expf((in[kws->keyword] - max) * kws->output_scale) / sum;
+  inference_ticks = kws_ticks() - start;
+  oai_metrics_histogram_observe(OAI_HISTOGRAM_KWS_INFERENCE_US,
+                                (uint32_t)(esp_timer_get_time() - start_us));
+
+  kws->probabilities[kws->inferences++ % KWS_SMOOTHING] = p;
+  if (kws->inferences < KWS_SMOOTHING) {
+    return 0.0f;
+  }
+  float mean = 0.0f;
+  for (int i = 0; i < KWS_SMOOTHING; i++) {
+    mean += kws->probabilities[i];
+  }
+  return mean / KWS_SMOOTHING;
+}
+
+/**********************
+ * MFCC front end
+ **********************/
+static float hz_to_mel(float hz) { return 2595.0f * log10f(1.0f + hz / 700.0f); }
+
+static float mel_to_hz(float mel) {
+  return 700.0f * (powf(10.0f, mel / 2595.0f) - 1.0f);
+}
+
+static void front_end_init(void) {
+  for (size_t n = 0; n < KWS_WINDOW_SAMPLES; n++) {
+    kws->hann[n] =
+        0.5f - 0.5f * cosf(2.0f * (float)M_PI * n / (KWS_WINDOW_SAMPLES - 1));
+  }
+
+  // Triangular filters with edges equally spaced in mel. A bin between
+  // edges j and j + 1 is on the rising slope of band j and the falling slope
+  // of band j - 1, so one segment index and one weight describe it.
+  float edges[KWS_MEL_BANDS + 2];
+  float low = hz_to_mel(KWS_MEL_LOW_HZ);
+  float high = hz_to_mel(MicFormat::kSampleRate / 2.0f);
+  for (int j = 0; j < KWS_MEL_BANDS + 2; j++) {
+    edges[j] = mel_to_hz(low + (high - low) * j / (KWS_MEL_BANDS + 1));
+  }
+  for (int k = 0; k < KWS_BINS; k++) {
+    float hz = (float)k * MicFormat::kSampleRate / KWS_FFT_SIZE;
+    kws->mel_segment[k] = -1;
+    kws->mel_weight[k] = 0.0f;
+    for (int j = 0; j < KWS_MEL_BANDS + 1; j++) {
+      if (hz >= edges[j] && hz < edges[j + 1]) {
+        kws->mel_segment[k] = j;
+        kws->mel_weight[k] = (hz - edges[j]) / (edges[j + 1] - edges[j]);
+        break;
+      }
+    }
+  }
+
+  // Orthonormal DCT-II
+  for (int j = 0; j < KWS_COEFFS; j++) {
+    float scale = sqrtf((j == 0 ? 1.0f : 2.0f) / KWS_MEL_BANDS);
+    for (int b = 0; b < KWS_MEL_BANDS; b++) {
+      kws->dct[j][b] =
+          scale * cosf((float)M_PI * j * (b + 0.5f) / KWS_MEL_BANDS);
+    }
+  }
+}
+
+// Appends one row of quantised MFCCs computed over the history window.
+static void push_features(void) {
+  for (size_t n = 0; n < KWS_FFT_SIZE; n++) {
+    kws->re[n] = n < KWS_WINDOW_SAMPLES
+                     ? kws->history[n] * kws->hann[n] * (1.0f / 32768.0f)
+                     : 0.0f;
+    kws->im[n] = 0.0f;
+  }
+  oai_dsp_fft(kws->re, kws->im, KWS_FFT_SIZE, false);
+
+  float mel[KWS_MEL_BANDS] = {};
+  for (int k = 0; k < KWS_BINS; k++) {
+    int j = kws->mel_segment[k];
+    if (j < 0) {
+      continue;
+    }
+    float power = kws->re[k] * kws->re[k] + kws->im[k] * kws->im[k];
+    float w = kws->mel_weight[k];
+    if (j < KWS_MEL_BANDS) {
+      mel[j] += w * power;
+    }
+    if (j > 0) {
+      mel[j - 1] += (1.0f - w) * power;
+    }
+  }
+  for (int b = 0; b < KWS_MEL_BANDS; b++) {
+    mel[b] = logf(mel[b] + 1e-6f);
+  }
+
+  int8_t *row = kws->features + (kws->frames - 1) * KWS_COEFFS;
+  memmove(kws->features, kws->features + KWS_COEFFS,
+          (kws->frames - 1) * KWS_COEFFS);
+  for (int j = 0; j < KWS_COEFFS; j++) {
+    float coeff = 0.0f;
+    for (int b = 0; b < KWS_MEL_BANDS; b++) {
+      coeff += kws->dct[j][b] * mel[b];
+    }
+    long q = lrintf(coeff / kws->input_scale);
+    row[j] = (int8_t)(q > 127 ? 127 : q < -128 ? -128 : q);
+  }
+  if (kws->frames_filled < kws->frames) {
+    kws->frames_filled++;
+  }
+}
+
+/**********************
+ * API
+ **********************/
+bool oai_kws_init(void) {
+  if (kws != NULL) {
+    return true;
+  }
+  bool loaded = false;
+#ifndef LINUX_BUILD
+#ifdef CONFIG_OAI_KWS
+  // Mapped for the life of the process; the weights are read through the
+  // flash cache instead of taking RAM.
+  const esp_partition_t *partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)KWS_PARTITION_SUBTYPE,
+      "kws");
+  const void *blob = NULL;
+  esp_partition_mmap_handle_t handle;
+  if (partition == NULL) {
+    ESP_LOGW(KWS_TAG, "No kws partition, streaming without a wake word");
+  } else if (esp_partition_mmap(partition, 0, partition->size,
+                                ESP_PARTITION_MMAP_DATA, &blob,
+                                &handle) == ESP_OK) {
+    loaded = load_model((const uint8_t *)blob, partition->size);
+  }
+#endif
+#else
+  const char *path = getenv("OAI_KWS_MODEL");
+  FILE *file = path != NULL ? fopen(path, "rb") : NULL;
+  if (file != NULL) {
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    // Kept for the life of the process, like the mapped partition.
+    uint8_t *blob = (uint8_t *)malloc(size > 0 ? size : 1);
+    loaded = blob != NULL && fread(blob, 1, size, file) == (size_t)size &&
+             load_model(blob, size);
+    fclose(file);
+    if (!loaded) {
+      free(blob);
+    }
+  } else if (path != NULL) {
+    ESP_LOGE(KWS_TAG, "Can not open %s", path);
+  }
+#endif
+  if (!loaded) {
+    return false;
+  }
+  front_end_init();
+  oai_kws_rearm();
+  return true;
+}
+
+bool oai_kws_process(const int16_t *pcm, size_t samples) {
+  if (kws == NULL || uplink_open.load(std::memory_order_acquire)) {
+    return false;
+  }
+
+  bool detected = false;
+  size_t i = 0;
+  while (i < samples && !detected) {
+    size_t take = KWS_HOP_SAMPLES - kws->hop_fill;
+    take = take < samples - i ? take : samples - i;
+    memmove(kws->history, kws->history + take,
+            (KWS_WINDOW_SAMPLES - take) * sizeof(int16_t));
+    memcpy(kws->history + KWS_WINDOW_SAMPLES - take, pcm + i,
+           take * sizeof(int16_t));
+    kws->hop_fill += take;
+    i += take;
+    if (kws->hop_fill < KWS_HOP_SAMPLES) {
+      break;
+    }
+
+    kws->hop_fill = 0;
+    push_features();
+    if (kws->frames_filled == kws->frames &&
+        ++kws->hops % KWS_INFER_HOPS == 0) {
+      detected = infer() * 1000.0f >= CONFIG_OAI_KWS_THRESHOLD;
+    }
+  }
+
+  if (detected) {
+    ESP_LOGI(KWS_TAG, "Wake word detected");
+    oai_metrics_counter_add(OAI_COUNTER_KWS_DETECTIONS, 1);
+    uplink_open.store(true, std::memory_order_release);
+  }
+  return detected;
+}
+
+bool oai_kws_enabled(void) { return kws != NULL; }
+
+bool oai_kws_uplink_open(void) {
+  return uplink_open.load(std::memory_order_acquire);
+}
+
+// Only called while the uplink is open, when the capture task has stopped
+// touching the detector state.
+void oai_kws_rearm(void) {
+  if (kws == NULL) {
+    return;
+  }
+  memset(kws->history, 0, sizeof(kws->history));
+  kws->hop_fill = 0;
+  kws->hops = 0;
+  kws->frames_filled = 0;
+  kws->inferences = 0;
+  uplink_open.store(false, std::memory_order_release);
+}
+
+uint32_t oai_kws_inference_ticks(void) { return inference_ticks; }
+
+#ifdef LINUX_BUILD
+/**********************
+ * Accuracy benchmark
+ **********************/
+// What a model has to reach for the benchmark to pass
+#define KWS_BENCH_MIN_DETECTED_PERCENT 90.0
+#define KWS_BENCH_MAX_FALSE_PER_HOUR 1.0
+
+typedef struct {
+  uint32_t clips;
+  uint32_t detected_clips;
+  uint32_t detections;
+  double seconds;
+} bench_set_t;
+
+typedef struct {
+  uint64_t frame_ticks;
+  uint32_t frame_max;
+  uint32_t frames;
+  uint64_t inference_ticks;
+  uint32_t inference_max;
+  uint32_t inferences;
+} bench_cost_t;
+
+// Returns the samples of a 16-bit mono WAV at the microphone rate, or NULL.
+static int16_t *read_wav(const char *path, size_t *samples) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  uint8_t *wav = (uint8_t *)malloc(size > 0 ? size : 1);
+  bool ok = wav != NULL && size >= 12 &&
+            fread(wav, 1, size, file) == (size_t)size &&
+            memcmp(wav, "RIFF", 4) == 0 && memcmp(wav + 8, "WAVE", 4) == 0;
+  fclose(file);
+
+  bool pcm16_mono = false;
+  const uint8_t *data = NULL;
+  uint32_t data_size = 0;
+  for (long pos = 12; ok && pos + 8 <= size;) {
+    uint32_t chunk;
+    memcpy(&chunk, wav + pos + 4, sizeof(chunk));
+    const uint8_t *body = wav + pos + 8;
+    if (memcmp(wav + pos, "fmt ", 4) == 0 && chunk >= 16) {
+      uint32_t rate;
+      memcpy(&rate, body + 4, sizeof(rate));
+      pcm16_mono = read_u16(body) == 1 && read_u16(body + 2) == 1 &&
+                   read_u16(body + 14) == 16 &&
+                   rate == MicFormat::kSampleRate;
+    } else if (memcmp(wav + pos, "data", 4) == 0) {
+      data = body;
+      data_size = chunk < size - pos - 8 ? chunk : size - pos - 8;
+    }
+    pos += 8 + chunk + (chunk & 1);
+  }
+
+  int16_t *pcm = NULL;
+  if (ok && pcm16_mono && data != NULL) {
+    *samples = data_size / sizeof(int16_t);
+    pcm = (int16_t *)malloc(data_size > 0 ? data_size : 1);
+    memcpy(pcm, data, data_size);
+  } else {
+    ESP_LOGW(KWS_TAG, "Skipping %s, not 16-bit mono PCM at %u Hz", path,
+             (unsigned)MicFormat::kSampleRate);
+  }
+  free(wav);
+  return pcm;
+}
+
+// Runs a clip through the same DSP chain and detector as the capture task,
+// listening again after every detection.
+static void bench_clip(const int16_t *pcm, size_t samples, bench_set_t *set,
+                       bench_cost_t *cost) {
+  static int16_t frame[MicFormat::kSamples];
+  oai_dsp_init(MicFormat::kSampleRate);
+  oai_kws_rearm();
+
+  uint32_t detections = 0;
+  for (size_t pos = 0; pos + MicFormat::kSamples <= samples;
+       pos += MicFormat::kSamples) {
+    memcpy(frame, pcm + pos, sizeof(frame));
+    oai_dsp_process(frame, MicFormat::kSamples);
+
+    uint32_t inferences = kws->inferences;
+    uint32_t start = kws_ticks();
+    bool detected = oai_kws_process(frame, MicFormat::kSamples);
+    uint32_t ticks = kws_ticks() - start;
+    cost->frame_ticks += ticks;
+    cost->frame_max = ticks > cost->frame_max ? ticks : cost->frame_max;
+    cost->frames++;
+    if (kws->inferences != inferences || detected) {
+      cost->inference_ticks += inference_ticks;
+      cost->inference_max = inference_ticks > cost->inference_max
+                                ? inference_ticks
+                                : cost->inference_max;
+      cost->inferences++;
+    }
+    if (detected) {
+      detections++;
+      oai_kws_rearm();
+    }
+  }
+  set->clips++;
+  set->detected_clips += detections > 0;
+  set->detections += detections;
+  set->seconds += (double)samples / MicFormat::kSampleRate;
+}
+
+static void bench_set(const char *dir, const char *name, bench_set_t *set,
+                      bench_cost_t *cost) {
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  DIR *d = opendir(path);
+  if (d == NULL) {
+    ESP_LOGW(KWS_TAG, "No %s directory", path);
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL) {
+    size_t len = strlen(entry->d_name);
+    if (len < 4 || strcmp(entry->d_name + len - 4, ".wav") != 0) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s/%s", dir, name, entry->d_name);
+    size_t samples = 0;
+    int16_t *pcm = read_wav(path, &samples);
+    if (pcm != NULL) {
+      bench_clip(pcm, samples, set, cost);
+      free(pcm);
+    }
+  }
+  closedir(d);
+}
+
+bool oai_kws_bench(const char *dir) {
+  if (!oai_kws_init()) {
+    ESP_LOGE(KWS_TAG, "Set OAI_KWS_MODEL to a model file");
+    return false;
+  }
+  bench_set_t positive = {};
+  bench_set_t negative = {};
+  bench_cost_t cost = {};
+  bench_set(dir, "positive", &positive, &cost);
+  bench_set(dir, "negative", &negative, &cost);
+
+  double detected_percent =
+      positive.clips ? 100.0 * positive.detected_clips / positive.clips : 0.0;
+  double false_per_hour = negative.seconds > 0
+                              ? negative.detections * 3600 / negative.seconds
+                              : 0.0;
+  ESP_LOGI(KWS_TAG, "positive: %u of %u clips detected (%.1f%%)",
+           (unsigned)positive.detected_clips, (unsigned)positive.clips,
+           detected_percent);
+  ESP_LOGI(KWS_TAG, "negative: %u false alarms in %.1f min (%.2f per hour)",
+           (unsigned)negative.detections, negative.seconds / 60,
+           false_per_hour);
+  ESP_LOGI(KWS_TAG, "per frame: mean %llu ns, max %u ns over %u frames",
+           (unsigned long long)(cost.frames ? cost.frame_ticks / cost.frames
+                                            : 0),
+           (unsigned)cost.frame_max, (unsigned)cost.frames);
+  ESP_LOGI(KWS_TAG, "inference: mean %llu ns, max %u ns over %u runs",
+           (unsigned long long)(cost.inferences
+                                    ? cost.inference_ticks / cost.inferences
+                                    : 0),
+           (unsigned)cost.inference_max, (unsigned)cost.inferences);
+
+  if (positive.clips == 0 || negative.clips == 0) {
+    ESP_LOGE(KWS_TAG, "Need clips in both %s/positive and %s/negative", dir,
+             dir);
+    return false;
+  }
+  bool ok = detected_percent >= KWS_BENCH_MIN_DETECTED_PERCENT &&
+            false_per_hour <= KWS_BENCH_MAX_FALSE_PER_HOUR;
+  ESP_LOGI(KWS_TAG, "%s: needs %.0f%% detected and at most %.1f false alarms "
+           "per hour",
+           ok ? "PASS" : "FAIL", KWS_BENCH_MIN_DETECTED_PERCENT,
+           KWS_BENCH_MAX_FALSE_PER_HOUR);
+  return ok;
+}
+#endif
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Wake word detection on the capture path. While armed, each microphone
+// frame is turned into MFCC features (30 ms Hann window, 20 ms hop, 40 mel
+// bands, 10 coefficients) and a small int8 convolutional model scores the
+// last second of them. Once the keyword is heard the uplink opens: the
+// session is created if it was waiting, and frames are encoded and sent.
+// oai_kws_rearm() closes the uplink again. Detection stops while the uplink
+// is open, so the model and Opus never compete for the capture core.
+//
+// The model is a blob in the "kws" flash partition, mapped rather than
+// copied. All integers little endian, every record 4 byte aligned:
+//
+//   header  "OKWS" u8 version u8 layers u8 frames u8 coefficients
+//           u8 classes u8 keyword class u16 reserved
+//           f32 input scale   (feature = int8 input * scale)
+//           f32 output scale  (logit = int8 output * scale)
+//   layer   u8 type u8 flags u8 kernel_h u8 kernel_w
+//           u8 stride_h u8 stride_w u16 out_channels
+//           i32 multiplier (Q31) i8 shift u8[3] reserved
+//           int8 weights, padded to 4 bytes, then i32 bias[out_channels]
+//
+// Tensors are height x width x channels, starting from frames x
+// coefficients x 1. Weights are [out][kh][kw][in] for CONV2D, [kh][kw][ch]
+// for DEPTHWISE_CONV2D and [out][in] for FULLY_CONNECTED. Quantisation is
+// symmetric; accumulators are rescaled by multiplier * 2^(shift - 31). The
+// last layer must produce one logit per class.
+
+#define OAI_KWS_MODEL_VERSION 1
+
+typedef enum {
+  OAI_KWS_CONV2D = 1,
+  OAI_KWS_DEPTHWISE_CONV2D,
+  OAI_KWS_AVG_POOL,  // Global average over height and width
+  OAI_KWS_FULLY_CONNECTED,
+} oai_kws_layer_type_t;
+
+#define OAI_KWS_FLAG_RELU 0x01
+#define OAI_KWS_FLAG_SAME_PADDING 0x02
+
+// Loads and checks the model. Returns false, leaving the uplink open, when
+// CONFIG_OAI_KWS is off or no valid model is present. On Linux the model is
+// read from the file named by OAI_KWS_MODEL.
+bool oai_kws_init(void);
+
+// Feeds one captured frame of mono PCM. Returns true on the frame the
+// keyword is detected, which also opens the uplink.
+bool oai_kws_process(const int16_t *pcm, size_t samples);
+
+// True once oai_kws_init() has loaded a model.
+bool oai_kws_enabled(void);
+bool oai_kws_uplink_open(void);
+// Closes the uplink and listens for the keyword again. No-op without a model.
+void oai_kws_rearm(void);
+
+// Time the last inference took, in CPU cycles on the device and nanoseconds
+// on the Linux build.
+uint32_t oai_kws_inference_ticks(void);
+
+#ifdef LINUX_BUILD
+// Runs every 16-bit mono WAV under dir/positive and dir/negative through the
+// capture front end and the detector, then logs the detection rate, false
+// alarms per hour and the per-frame cost. Returns false without a model or
+// clips, or if the model misses its detection or false alarm target.
+bool oai_kws_bench(const char *dir);
+#endif
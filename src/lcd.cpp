@@ -5,9 +5,22 @@
 #include "esp_lcd_panel_io.h"
 #include "esp_lcd_panel_vendor.h"
 #include "esp_lcd_panel_ops.h"
+#include "esp_heap_caps.h"
 #include <esp_log.h>
-
+#include <esp_timer.h>
+#include <math.h>
+#include <peer.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "board.h"
+#include "governor.h"
 #include "lcd.h"
+#include "metrics.h"
+#include "tasks.h"
 #include "lvgl.h"
 #include "esp_lvgl_port.h"
 
@@ -15,49 +28,24 @@
 
 /**********************
  *     Define Pins and Parameters
+ *
+ * Panel geometry, pins and init tables come from the board profile selected
+ * in menuconfig (board.h).
  **********************/
-#define FREENOVE_DEDIA_KIT_1_14_INCH
-//#define FREENOVE_DEDIA_KIT_3_5_INCH
-
-#define LCD_SPI_HOST SPI3_HOST
-#define DISPLAY_MOSI_PIN GPIO_NUM_21
-#define DISPLAY_CLK_PIN GPIO_NUM_47
-#define DISPLAY_DC_PIN GPIO_NUM_45
-#define DISPLAY_RST_PIN GPIO_NUM_20
-#define DISPLAY_CS_PIN GPIO_NUM_NC
-
-#define LCD_RST_PIN GPIO_NUM_20
-#define DISPLAY_BACKLIGHT_PIN GPIO_NUM_2
+constexpr DisplayProfile kDisplay = Board::kDisplay;
+
 #define BACKLIGHT_PWM_TIMER LEDC_TIMER_0
 #define BACKLIGHT_PWM_CHANNEL LEDC_CHANNEL_0
 #define BACKLIGHT_PWM_FREQ 1000                // PWM frequency: 5kHz
 #define BACKLIGHT_RESOLUTION LEDC_TIMER_13_BIT // 13-bit resolution (0 ~ 8191)
 
-// Screen resolution and offset
-#ifdef FREENOVE_DEDIA_KIT_1_14_INCH
-#define DISPLAY_WIDTH 240
-#define DISPLAY_HEIGHT 135
-#define DISPLAY_MIRROR_X true
-#define DISPLAY_MIRROR_Y false
-#define DISPLAY_SWAP_XY true
-#define DISPLAY_INVERT_COLOR true
-#define DISPLAY_RGB_ORDER LCD_RGB_ELEMENT_ORDER_RGB
-#define DISPLAY_OFFSET_X 40
-#define DISPLAY_OFFSET_Y 53
-
-#elif defined FREENOVE_DEDIA_KIT_3_5_INCH
-#define LCD_TYPE_ST7789_SERIAL
-#define DISPLAY_WIDTH 480
-#define DISPLAY_HEIGHT 320
-#define DISPLAY_MIRROR_X false
-#define DISPLAY_MIRROR_Y false
-#define DISPLAY_SWAP_XY true
-#define DISPLAY_INVERT_COLOR true
-#define DISPLAY_RGB_ORDER LCD_RGB_ELEMENT_ORDER_RGB
-#define DISPLAY_OFFSET_X 0
-#define DISPLAY_OFFSET_Y 0
+// Lines sent per transaction when clearing the panel at boot
+#define LCD_CLEAR_LINES 16
 
-#endif
+// Define LCD_BENCHMARK to redraw the whole screen every refresh and log the
+// frame rate and flush timings once a second.
+// #define LCD_BENCHMARK
+#define LCD_BENCHMARK_LOG_MS 1000
 
 esp_lcd_panel_handle_t panel = NULL;
 lv_disp_t * disp_handle;
@@ -70,39 +58,11 @@ typedef struct {
 
 lvgl_screen_t lvgl_screen;
 
-#ifdef FREENOVE_DEDIA_KIT_3_5_INCH
+// Passed to the panel driver as vendor_config
 typedef struct {
-    int cmd;              
-    const void *data;      
-    size_t data_bytes;    
-    unsigned int delay_ms;  
-} st7796_lcd_init_cmd_t;
-
-typedef struct {
-    const st7796_lcd_init_cmd_t *init_cmds;     
-    uint16_t init_cmds_size;                   
-} st7796_vendor_config_t;
-
-st7796_lcd_init_cmd_t st7796_lcd_init_cmds[] = {
-    {0x11, (uint8_t []){ 0x00 }, 0, 120},
-    {0x3A, (uint8_t []){ 0x05 }, 1, 0},
-    {0xF0, (uint8_t []){ 0xC3 }, 1, 0},
-    {0xF0, (uint8_t []){ 0x96 }, 1, 0},
-    {0xB4, (uint8_t []){ 0x01 }, 1, 0},
-    {0xB7, (uint8_t []){ 0xC6 }, 1, 0},
-    {0xC0, (uint8_t []){ 0x80, 0x45 }, 2, 0},
-    {0xC1, (uint8_t []){ 0x13 }, 1, 0},
-    {0xC2, (uint8_t []){ 0xA7 }, 1, 0},
-    {0xC5, (uint8_t []){ 0x0A }, 1, 0},
-    {0xE8, (uint8_t []){ 0x40, 0x8A, 0x00, 0x00, 0x29, 0x19, 0xA5, 0x33}, 8, 0},
-    {0xE0, (uint8_t []){ 0xD0, 0x08, 0x0F, 0x06, 0x06, 0x33, 0x30, 0x33, 0x47, 0x17, 0x13, 0x13, 0x2B, 0x31}, 14, 0},
-    {0xE1, (uint8_t []){ 0xD0, 0x0A, 0x11, 0x0B, 0x09, 0x07, 0x2F, 0x33, 0x47, 0x38, 0x15, 0x16, 0x2C, 0x32},14, 0},
-    {0xF0, (uint8_t []){ 0x3C }, 1, 0},
-    {0xF0, (uint8_t []){ 0x69 }, 1, 120},
-    {0x21, (uint8_t []){ 0x00 }, 0, 0},
-    {0x29, (uint8_t []){ 0x00 }, 0, 0},
-};
-#endif
+    const LcdInitCmd *init_cmds;
+    uint16_t init_cmds_size;
+} lcd_vendor_config_t;
 
 /**********************
  * @brief Initialize backlight PWM control
@@ -120,7 +80,7 @@ void backlight_init(void)
     ledc_timer_config(&timer);
 
     ledc_channel_config_t channel={
-        .gpio_num = DISPLAY_BACKLIGHT_PIN,
+        .gpio_num = kDisplay.backlight_pin,
         .speed_mode = LEDC_LOW_SPEED_MODE,
         .channel = BACKLIGHT_PWM_CHANNEL,
         .intr_type = LEDC_INTR_DISABLE,
@@ -156,89 +116,214 @@ void reset_lcd(void) {
     gpio_config_t io_20_conf = {};
     io_20_conf.intr_type = GPIO_INTR_DISABLE;
     io_20_conf.mode = GPIO_MODE_OUTPUT;
-    io_20_conf.pin_bit_mask = (1ULL << LCD_RST_PIN);
+    io_20_conf.pin_bit_mask = (1ULL << kDisplay.rst_pin);
     io_20_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
     io_20_conf.pull_up_en = GPIO_PULLUP_DISABLE;
     gpio_config(&io_20_conf);
-    gpio_set_level(LCD_RST_PIN, 0); // Set pin to low level
+    gpio_set_level((gpio_num_t)kDisplay.rst_pin, 0); // Set pin to low level
     vTaskDelay(pdMS_TO_TICKS(10));
-    gpio_set_level(LCD_RST_PIN, 1);
+    gpio_set_level((gpio_num_t)kDisplay.rst_pin, 1);
     vTaskDelay(pdMS_TO_TICKS(10));
     io_20_conf.mode = GPIO_MODE_INPUT_OUTPUT_OD;
     gpio_config(&io_20_conf);
 }
 
-void init_lvgl(void)
+static bool clear_trans_done(esp_lcd_panel_io_handle_t io, esp_lcd_panel_io_event_data_t *edata, void *user_ctx)
 {
-    ESP_LOGD(TAG, "Install BL IO");
-    backlight_init();
-    set_backlight_brightness(100);
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR((SemaphoreHandle_t)user_ctx, &woken);
+    return woken == pdTRUE;
+}
 
-    ESP_LOGD(TAG, "Install Spi IO");
-    spi_bus_config_t spi_bus_io = {};
-    spi_bus_io.mosi_io_num = DISPLAY_MOSI_PIN;
-    spi_bus_io.miso_io_num = GPIO_NUM_NC;
-    spi_bus_io.sclk_io_num = DISPLAY_CLK_PIN;
-    spi_bus_io.quadwp_io_num = GPIO_NUM_NC;
-    spi_bus_io.quadhd_io_num = GPIO_NUM_NC;
-    spi_bus_io.max_transfer_sz = DISPLAY_WIDTH * DISPLAY_HEIGHT * sizeof(uint16_t);
-    ESP_ERROR_CHECK(spi_bus_initialize(LCD_SPI_HOST, &spi_bus_io, SPI_DMA_CH_AUTO));
+/**********************
+ * @brief Fill the panel with white in a few large DMA transfers
+ * @param io_handle - panel IO, before LVGL takes over its callbacks
+ **********************/
+static void clear_screen(esp_lcd_panel_io_handle_t io_handle)
+{
+    const int chunks = (kDisplay.height + LCD_CLEAR_LINES - 1) / LCD_CLEAR_LINES;
+    size_t pixels = kDisplay.width * LCD_CLEAR_LINES;
+    uint16_t *buffer = (uint16_t *)heap_caps_malloc(pixels * sizeof(uint16_t), MALLOC_CAP_DMA);
+    SemaphoreHandle_t done = xSemaphoreCreateCounting(chunks, 0);
+    if (buffer == NULL || done == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for display buffer");
+        heap_caps_free(buffer);
+        if (done != NULL) {
+            vSemaphoreDelete(done);
+        }
+        return;
+    }
+    for (size_t i = 0; i < pixels; i++) {
+        buffer[i] = 0xFFFF; // Fill with white color (RGB565 format)
+    }
+
+    // lvgl_port_add_disp() replaces this callback with its own later on.
+    esp_lcd_panel_io_callbacks_t cbs = {};
+    cbs.on_color_trans_done = clear_trans_done;
+    esp_lcd_panel_io_register_event_callbacks(io_handle, &cbs, done);
+
+    // Every chunk sends the same white pixels, so the transfers are queued
+    // back to back and the buffer is only released once all have finished.
+    int64_t start = esp_timer_get_time();
+    for (int y = 0; y < kDisplay.height; y += LCD_CLEAR_LINES) {
+        int y_end = y + LCD_CLEAR_LINES > kDisplay.height ? kDisplay.height : y + LCD_CLEAR_LINES;
+        esp_lcd_panel_draw_bitmap(panel, 0, y, kDisplay.width, y_end, buffer);
+    }
+    for (int i = 0; i < chunks; i++) {
+        xSemaphoreTake(done, portMAX_DELAY);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "Cleared %s panel in %d transfers, %lld us", kDisplay.name, chunks, elapsed);
+
+    vSemaphoreDelete(done);
+    heap_caps_free(buffer);
+}
+
+/**********************
+ * Display timing
+ *
+ * Refresh time covers one LVGL refresh that drew something, flush wait is
+ * how long rendering stalled waiting for the SPI transfer of the other
+ * buffer. With double buffering the latter should stay near zero unless the
+ * bus is the bottleneck.
+ **********************/
+static int64_t refresh_start_us = 0;
+static int64_t flush_wait_start_us = 0;
+static bool frame_rendered = false;
+static uint32_t fps_frames = 0;
+static int64_t fps_window_start_us = 0;
+
+static void display_event_cb(lv_event_t *e)
+{
+    int64_t now = esp_timer_get_time();
+    switch (lv_event_get_code(e)) {
+    case LV_EVENT_REFR_START:
+        refresh_start_us = now;
+        frame_rendered = false;
+        break;
+    case LV_EVENT_RENDER_START:
+        frame_rendered = true;
+        break;
+    case LV_EVENT_FLUSH_WAIT_START:
+        flush_wait_start_us = now;
+        break;
+    case LV_EVENT_FLUSH_WAIT_FINISH:
+        oai_metrics_histogram_observe(OAI_HISTOGRAM_DISPLAY_FLUSH_WAIT_US, (uint32_t)(now - flush_wait_start_us));
+        break;
+    case LV_EVENT_REFR_READY:
+        if (frame_rendered) {
+            oai_metrics_histogram_observe(OAI_HISTOGRAM_DISPLAY_REFRESH_US, (uint32_t)(now - refresh_start_us));
+            fps_frames++;
+        }
+        if (now - fps_window_start_us >= 1000000) {
+            oai_metrics_gauge_set(OAI_GAUGE_DISPLAY_FPS, (int32_t)(fps_frames * 1000000LL / (now - fps_window_start_us)));
+            fps_frames = 0;
+            fps_window_start_us = now;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+#ifdef LCD_BENCHMARK
+// Forces a full-screen redraw on every refresh.
+static void benchmark_invalidate_cb(lv_timer_t *timer)
+{
+    lv_obj_invalidate(lv_screen_active());
+}
+
+static void benchmark_log_cb(lv_timer_t *timer)
+{
+    oai_histogram_snapshot_t refresh, flush_wait;
+    oai_metrics_histogram_get(OAI_HISTOGRAM_DISPLAY_REFRESH_US, &refresh);
+    oai_metrics_histogram_get(OAI_HISTOGRAM_DISPLAY_FLUSH_WAIT_US, &flush_wait);
+    ESP_LOGI(TAG, "%s %dx%d, %d lines x2: %ld fps, refresh p50 %lu us p99 %lu us, flush wait p50 %lu us p99 %lu us",
+             kDisplay.name, kDisplay.width, kDisplay.height, kDisplay.draw_buffer_lines,
+             (long)oai_metrics_gauge_get(OAI_GAUGE_DISPLAY_FPS),
+             (unsigned long)oai_metrics_histogram_quantile(&refresh, 0.5f),
+             (unsigned long)oai_metrics_histogram_quantile(&refresh, 0.99f),
+             (unsigned long)oai_metrics_histogram_quantile(&flush_wait, 0.5f),
+             (unsigned long)oai_metrics_histogram_quantile(&flush_wait, 0.99f));
+}
+#endif
+
+/**********************
+ * @brief Create the panel IO and panel driver for a board profile
+ *
+ * Instantiated once for the selected board, so the profile's constants are
+ * folded into the calls and boards without an init table carry no code for
+ * one.
+ **********************/
+template <typename B>
+static esp_lcd_panel_io_handle_t install_panel(void)
+{
+    constexpr DisplayProfile display = B::kDisplay;
 
     ESP_LOGD(TAG, "Install Panel IO");
     esp_lcd_panel_io_handle_t io_handle  = NULL;
     esp_lcd_panel_io_spi_config_t io_config={};
-    io_config.cs_gpio_num = DISPLAY_CS_PIN;
-    io_config.dc_gpio_num = DISPLAY_DC_PIN;
-#ifdef FREENOVE_DEDIA_KIT_1_14_INCH
-    io_config.spi_mode = 3;
-#elif defined FREENOVE_DEDIA_KIT_3_5_INCH
-    io_config.spi_mode = 0;
-#endif
-    io_config.pclk_hz = 80 * 1000 * 1000;
-    io_config.trans_queue_depth = 10;
+    io_config.cs_gpio_num = (gpio_num_t)display.cs_pin;
+    io_config.dc_gpio_num = (gpio_num_t)display.dc_pin;
+    io_config.spi_mode = display.spi_mode;
+    io_config.pclk_hz = display.pclk_hz;
+    io_config.trans_queue_depth = display.trans_queue_depth;
     io_config.lcd_cmd_bits = 8;
     io_config.lcd_param_bits = 8;
-    ESP_ERROR_CHECK(esp_lcd_new_panel_io_spi(LCD_SPI_HOST, &io_config, &io_handle));
-#ifdef FREENOVE_DEDIA_KIT_3_5_INCH
-    st7796_vendor_config_t st7796_vendor_config = {
-        .init_cmds = st7796_lcd_init_cmds,
-        .init_cmds_size = sizeof(st7796_lcd_init_cmds) / sizeof(st7796_lcd_init_cmd_t),
-    };     
-#endif
+    ESP_ERROR_CHECK(esp_lcd_new_panel_io_spi((spi_host_device_t)display.spi_host, &io_config, &io_handle));
+
     ESP_LOGD(TAG, "Install Panel Config");
     esp_lcd_panel_dev_config_t panel_config={};
-    panel_config.reset_gpio_num = LCD_RST_PIN;
-    panel_config.rgb_ele_order = DISPLAY_RGB_ORDER;
+    panel_config.reset_gpio_num = (gpio_num_t)display.rst_pin;
+    panel_config.rgb_ele_order = display.bgr_order ? LCD_RGB_ELEMENT_ORDER_BGR : LCD_RGB_ELEMENT_ORDER_RGB;
     panel_config.bits_per_pixel = 16;
-#ifdef FREENOVE_DEDIA_KIT_3_5_INCH
-    panel_config.vendor_config = &st7796_vendor_config;
-#endif
+    if constexpr (display.init_cmds != nullptr) {
+        // Static so the driver can hold on to it; the table itself stays in flash
+        static lcd_vendor_config_t vendor_config = {
+            .init_cmds = display.init_cmds,
+            .init_cmds_size = (uint16_t)display.init_cmds_size,
+        };
+        panel_config.vendor_config = &vendor_config;
+    }
     ESP_ERROR_CHECK(esp_lcd_new_panel_st7789(io_handle, &panel_config, &panel));
     esp_lcd_panel_reset(panel);               // Reset LCD screen
+    return io_handle;
+}
+
+void init_lvgl(void)
+{
+    ESP_LOGD(TAG, "Install BL IO");
+    backlight_init();
+    set_backlight_brightness(100);
+
+    ESP_LOGD(TAG, "Install Spi IO");
+    spi_bus_config_t spi_bus_io = {};
+    spi_bus_io.mosi_io_num = (gpio_num_t)kDisplay.mosi_pin;
+    spi_bus_io.miso_io_num = GPIO_NUM_NC;
+    spi_bus_io.sclk_io_num = (gpio_num_t)kDisplay.clk_pin;
+    spi_bus_io.quadwp_io_num = GPIO_NUM_NC;
+    spi_bus_io.quadhd_io_num = GPIO_NUM_NC;
+    spi_bus_io.max_transfer_sz = kDisplay.width * kDisplay.height * sizeof(uint16_t);
+    ESP_ERROR_CHECK(spi_bus_initialize((spi_host_device_t)kDisplay.spi_host, &spi_bus_io, SPI_DMA_CH_AUTO));
+
+    esp_lcd_panel_io_handle_t io_handle = install_panel<Board>();
 
     reset_lcd();
     esp_lcd_panel_init(panel);                // Initialize configuration registers
-    esp_lcd_panel_invert_color(panel, DISPLAY_INVERT_COLOR);  // Color inversion
-    esp_lcd_panel_swap_xy(panel, DISPLAY_SWAP_XY);       // Display rotation 
-    esp_lcd_panel_mirror(panel, DISPLAY_MIRROR_X, DISPLAY_MIRROR_Y); // Mirror
+    esp_lcd_panel_invert_color(panel, kDisplay.invert_color);  // Color inversion
+    esp_lcd_panel_swap_xy(panel, kDisplay.swap_xy);       // Display rotation 
+    esp_lcd_panel_mirror(panel, kDisplay.mirror_x, kDisplay.mirror_y); // Mirror
 
-    uint16_t *buffer = (uint16_t *)malloc(DISPLAY_WIDTH * sizeof(uint16_t));
-    if (buffer == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for display buffer");
-        return;
-    }
-    for (int i = 0; i < DISPLAY_WIDTH; i++) {
-        buffer[i] = 0xFFFF; // Fill with white color (RGB565 format)
-    }
-    for (int y = 0; y < DISPLAY_HEIGHT; y++) {
-        esp_lcd_panel_draw_bitmap(panel, 0, y, DISPLAY_WIDTH, y + 1, buffer);
-    }
+    clear_screen(io_handle);
     ESP_ERROR_CHECK(esp_lcd_panel_disp_on_off(panel, true));
-    free(buffer);
 
     lv_init();
 
-    const lvgl_port_cfg_t lvgl_cfg = ESP_LVGL_PORT_INIT_CONFIG();
+    const oai_task_spec_t *ui_task = oai_task_spec(OAI_TASK_UI);
+    lvgl_port_cfg_t lvgl_cfg = ESP_LVGL_PORT_INIT_CONFIG();
+    lvgl_cfg.task_priority = ui_task->priority;
+    lvgl_cfg.task_stack = ui_task->stack_size;
+    lvgl_cfg.task_affinity = ui_task->core;
     esp_err_t err = lvgl_port_init(&lvgl_cfg);
     ESP_LOGI(TAG, "lvgl_port_init: %s", err == ESP_OK ? "OK" : "Failed");
 
@@ -246,17 +331,17 @@ void init_lvgl(void)
     disp_cfg.io_handle = io_handle;
     disp_cfg.panel_handle = panel;
     disp_cfg.control_handle = NULL;
-    disp_cfg.buffer_size = DISPLAY_WIDTH * 20;
-    disp_cfg.double_buffer = 0;
+    disp_cfg.buffer_size = kDisplay.width * kDisplay.draw_buffer_lines;
+    disp_cfg.double_buffer = 1;
     disp_cfg.trans_size = 0;
-    disp_cfg.hres = DISPLAY_WIDTH;
-    disp_cfg.vres = DISPLAY_HEIGHT;
+    disp_cfg.hres = kDisplay.width;
+    disp_cfg.vres = kDisplay.height;
     disp_cfg.monochrome = false;
     disp_cfg.color_format = LV_COLOR_FORMAT_RGB565;
 
-    disp_cfg.rotation.swap_xy = DISPLAY_SWAP_XY;
-    disp_cfg.rotation.mirror_x = DISPLAY_MIRROR_X;
-    disp_cfg.rotation.mirror_y = DISPLAY_MIRROR_Y;
+    disp_cfg.rotation.swap_xy = kDisplay.swap_xy;
+    disp_cfg.rotation.mirror_x = kDisplay.mirror_x;
+    disp_cfg.rotation.mirror_y = kDisplay.mirror_y;
 
     disp_cfg.flags.buff_dma = 1;
     disp_cfg.flags.buff_spiram = 0;
@@ -266,20 +351,336 @@ void init_lvgl(void)
     disp_cfg.flags.direct_mode = 0;
 
     disp_handle = lvgl_port_add_disp(&disp_cfg);
-    lv_display_set_offset(disp_handle, DISPLAY_OFFSET_X, DISPLAY_OFFSET_Y);
+    lv_display_set_offset(disp_handle, kDisplay.offset_x, kDisplay.offset_y);
+
+    lvgl_port_lock(0);
+    lv_display_add_event_cb(disp_handle, display_event_cb, LV_EVENT_ALL, NULL);
+    lvgl_port_unlock();
+}
+
+/**********************
+ * Transcript bubbles
+ *
+ * A fixed pool of bubbles is created once and recycled oldest-first, so
+ * streaming text never creates or deletes LVGL objects. Other tasks never
+ * touch LVGL directly: they post to ui_queue and a timer running inside the
+ * LVGL task applies the updates.
+ **********************/
+#define MESSAGE_POOL_SIZE 5
+#define MESSAGE_MAX_LENGTH 1024
+#define UI_MESSAGE_TEXT_SIZE 96
+/* Queue depth and drain period come from the task table (tasks.cpp) */
+/* While the CPU governor sheds UI work only one drain in this many runs */
+#define UI_THROTTLE_TICKS 4
+
+typedef enum {
+    UI_OP_NEW,        // Start a bubble, closed by the UI_OP_END that follows
+    UI_OP_APPEND,     // Append to the open bubble, opening one if needed
+    UI_OP_END,        // Close the open bubble
+} ui_op_t;
+
+typedef struct {
+    ui_op_t op;
+    char text[UI_MESSAGE_TEXT_SIZE];
+} ui_message_t;
+
+typedef struct {
+    lv_obj_t *bubble;
+    lv_obj_t *label;
+    size_t length;
+} message_slot_t;
+
+static message_slot_t message_pool[MESSAGE_POOL_SIZE];
+static uint8_t message_next = 0;
+static message_slot_t *message_open = NULL;
+static QueueHandle_t ui_queue = NULL;
+
+static message_slot_t *message_take_slot(void)
+{
+    message_slot_t *slot = &message_pool[message_next];
+    message_next = (message_next + 1) % MESSAGE_POOL_SIZE;
+
+    lv_label_set_text(slot->label, "");
+    slot->length = 0;
+    lv_obj_remove_flag(slot->bubble, LV_OBJ_FLAG_HIDDEN);
+    lv_obj_move_to_index(slot->bubble, -1);                                    // Newest goes last
+    return slot;
+}
+
+// Text past MESSAGE_MAX_LENGTH is cut on a character boundary and the bubble
+// then takes nothing more, so a later, shorter chunk can not follow a gap.
+static void message_append(message_slot_t *slot, const char *text)
+{
+    size_t len = strlen(text);
+    if (slot->length + len <= MESSAGE_MAX_LENGTH) {
+        lv_label_ins_text(slot->label, LV_LABEL_POS_LAST, text);
+        slot->length += len;
+        return;
+    }
+
+    char head[UI_MESSAGE_TEXT_SIZE];
+    len = MESSAGE_MAX_LENGTH - slot->length;
+    if (len >= sizeof(head)) {
+        len = sizeof(head) - 1;
+    }
+    while (len > 0 && ((uint8_t)text[len] & 0xC0) == 0x80) {                    // UTF-8 continuation byte
+        len--;
+    }
+    if (len > 0) {
+        memcpy(head, text, len);
+        head[len] = '\0';
+        lv_label_ins_text(slot->label, LV_LABEL_POS_LAST, head);
+    }
+    slot->length = MESSAGE_MAX_LENGTH;
+}
+
+static void ui_apply(const ui_message_t *msg)
+{
+    switch (msg->op) {
+    case UI_OP_NEW:
+        // Stays open for the APPEND chunks of long text until UI_OP_END.
+        message_open = message_take_slot();
+        message_append(message_open, msg->text);
+        break;
+    case UI_OP_APPEND:
+        if (message_open == NULL) {
+            message_open = message_take_slot();
+        }
+        message_append(message_open, msg->text);
+        break;
+    case UI_OP_END:
+        message_open = NULL;
+        break;
+    }
+}
+
+// Runs in the LVGL task with the port lock held.
+static void ui_drain_cb(lv_timer_t *timer)
+{
+    oai_task_tick(OAI_TASK_UI, esp_timer_get_time());
+
+    // The queue holds a few drain periods of updates, so they are applied
+    // late rather than lost.
+    static uint32_t skipped = 0;
+    if (oai_governor_shedding(OAI_GOVERNOR_SHED_UI) && ++skipped % UI_THROTTLE_TICKS != 0) {
+        return;
+    }
+
+    ui_message_t msg;
+    bool changed = false;
+    while (xQueueReceive(ui_queue, &msg, 0) == pdTRUE) {
+        ui_apply(&msg);
+        changed = true;
+    }
+    if (!changed) {
+        return;
+    }
+
+    // Only the newest bubble changes size, so scrolling it into view is the
+    // only layout work needed; LVGL invalidates just the label's area.
+    uint8_t newest = (message_next + MESSAGE_POOL_SIZE - 1) % MESSAGE_POOL_SIZE;
+    lv_obj_scroll_to_view(message_pool[newest].bubble, LV_ANIM_OFF);
+}
+
+static void ui_post(ui_op_t op, const char *text)
+{
+    if (ui_queue == NULL) {
+        return;
+    }
+
+    ui_message_t msg;
+    msg.op = op;
+    if (text == NULL) {
+        msg.text[0] = '\0';
+        xQueueSend(ui_queue, &msg, 0);
+        return;
+    }
+
+    // Long text is split into queue-sized chunks that append to one bubble,
+    // each cut on a character boundary so a dropped chunk never leaves half
+    // a UTF-8 sequence in the label.
+    size_t len = strlen(text);
+    do {
+        size_t chunk = len < UI_MESSAGE_TEXT_SIZE - 1 ? len : UI_MESSAGE_TEXT_SIZE - 1;
+        size_t cut = chunk;
+        while (cut > 0 && cut < len && ((uint8_t)text[cut] & 0xC0) == 0x80) {      // UTF-8 continuation byte
+            cut--;
+        }
+        if (cut > 0) {                                                              // Not UTF-8 at all otherwise
+            chunk = cut;
+        }
+        memcpy(msg.text, text, chunk);
+        msg.text[chunk] = '\0';
+        if (xQueueSend(ui_queue, &msg, 0) != pdTRUE) {
+            ESP_LOGW(TAG, "UI queue full, dropping text");
+            return;
+        }
+        text += chunk;
+        len -= chunk;
+        if (msg.op == UI_OP_NEW) {
+            msg.op = UI_OP_APPEND;
+        }
+    } while (len > 0);
+
+    if (op == UI_OP_NEW) {
+        msg.op = UI_OP_END;
+        msg.text[0] = '\0';
+        xQueueSend(ui_queue, &msg, 0);
+    }
+}
+
+/**********************
+ * Status bar
+ *
+ * Connection state, mic and speaker levels, RTT and inbound loss. Everything
+ * is read from the metrics registry, so the audio and network tasks only do
+ * their usual relaxed atomic stores and never wait on the UI. The bar is
+ * polled at HUD_PERIOD_MS and each widget is only touched when its value
+ * changes, so LVGL redraws just that widget's area.
+ **********************/
+#define HUD_HEIGHT 20
+#define HUD_PERIOD_MS 100
+#define HUD_STATS_TICKS 10          // RTT and loss refresh once a second
+#define HUD_THROTTLE_TICKS 5        // One update in this many while the CPU governor sheds UI work
+#define HUD_LEVEL_FLOOR_DB -60.0f
+
+typedef struct {
+    lv_obj_t *state;
+    lv_obj_t *mic;
+    lv_obj_t *spk;
+    lv_obj_t *net;
+    int32_t last_state;
+    int32_t last_mic;
+    int32_t last_spk;
+    uint32_t last_tx_frames;
+    uint32_t last_rx_packets;
+    uint32_t window_rx_packets;
+    uint32_t window_rx_lost;
+    uint32_t ticks;
+} hud_t;
+
+static hud_t hud;
+
+// Maps an RMS value onto a 0 - 100 meter covering HUD_LEVEL_FLOOR_DB to 0 dBFS
+static int32_t hud_level(uint32_t rms)
+{
+    if (rms == 0) {
+        return 0;
+    }
+    float db = 20.0f * log10f((float)rms / 32768.0f);
+    if (db <= HUD_LEVEL_FLOOR_DB) {
+        return 0;
+    }
+    if (db >= 0.0f) {
+        return 100;
+    }
+    return (int32_t)(100.0f * (1.0f - db / HUD_LEVEL_FLOOR_DB));
+}
+
+static void hud_set_bar(lv_obj_t *bar, int32_t *last, int32_t value)
+{
+    if (value != *last) {
+        lv_bar_set_value(bar, value, LV_ANIM_OFF);
+        *last = value;
+    }
+}
+
+static void hud_update_cb(lv_timer_t *timer)
+{
+    static uint32_t skipped = 0;
+    if (oai_governor_shedding(OAI_GOVERNOR_SHED_UI) && ++skipped % HUD_THROTTLE_TICKS != 0) {
+        return;
+    }
+
+    int32_t state = oai_metrics_gauge_get(OAI_GAUGE_PEER_STATE);
+    if (state != hud.last_state) {
+        lv_label_set_text(hud.state, peer_connection_state_to_string((PeerConnectionState)state));
+        hud.last_state = state;
+    }
+
+    // A level only counts while frames are flowing, otherwise the meters
+    // would freeze on the last frame of a turn.
+    uint32_t tx_frames = oai_metrics_counter_get(OAI_COUNTER_AUDIO_TX_FRAMES);
+    uint32_t rx_packets = oai_metrics_counter_get(OAI_COUNTER_AUDIO_RX_PACKETS);
+    hud_set_bar(hud.mic, &hud.last_mic,
+                tx_frames != hud.last_tx_frames ? hud_level(oai_metrics_gauge_get(OAI_GAUGE_MIC_RMS)) : 0);
+    hud_set_bar(hud.spk, &hud.last_spk,
+                rx_packets != hud.last_rx_packets ? hud_level(oai_metrics_gauge_get(OAI_GAUGE_SPK_RMS)) : 0);
+    hud.last_tx_frames = tx_frames;
+    hud.last_rx_packets = rx_packets;
+
+    if (++hud.ticks < HUD_STATS_TICKS) {
+        return;
+    }
+    hud.ticks = 0;
+
+    uint32_t rx_lost = oai_metrics_counter_get(OAI_COUNTER_AUDIO_RX_LOST);
+    uint32_t received = rx_packets - hud.window_rx_packets;
+    uint32_t lost = rx_lost - hud.window_rx_lost;
+    uint32_t loss_permille = received + lost ? lost * 1000 / (received + lost) : 0;
+    hud.window_rx_packets = rx_packets;
+    hud.window_rx_lost = rx_lost;
+
+    char text[32];
+    snprintf(text, sizeof(text), "%ldms %lu.%lu%%", (long)oai_metrics_gauge_get(OAI_GAUGE_DATACHANNEL_RTT_MS),
+             (unsigned long)(loss_permille / 10), (unsigned long)(loss_permille % 10));
+    if (strcmp(text, lv_label_get_text(hud.net)) != 0) {
+        lv_label_set_text(hud.net, text);
+    }
+}
+
+static lv_obj_t *hud_create_bar(lv_obj_t *parent, uint32_t color)
+{
+    lv_obj_t *bar = lv_bar_create(parent);
+    lv_obj_set_size(bar, lv_pct(18), HUD_HEIGHT / 2);
+    lv_bar_set_range(bar, 0, 100);
+    lv_obj_set_style_bg_color(bar, lv_color_hex(color), LV_PART_INDICATOR);
+    return bar;
+}
+
+static void hud_create(lv_obj_t *parent)
+{
+    lv_obj_t *bar = lv_obj_create(parent);
+    lv_obj_set_size(bar, kDisplay.width - 10, HUD_HEIGHT);
+    lv_obj_align(bar, LV_ALIGN_TOP_MID, 0, 5);
+    lv_obj_set_style_pad_all(bar, 0, LV_PART_MAIN);
+    lv_obj_set_style_pad_column(bar, 4, LV_PART_MAIN);
+    lv_obj_set_style_border_width(bar, 0, LV_PART_MAIN);
+    lv_obj_set_style_radius(bar, 0, LV_PART_MAIN);
+    lv_obj_set_style_bg_color(bar, lv_color_hex(0xE0E0E0), LV_PART_MAIN);     // Light grey background
+    lv_obj_remove_flag(bar, LV_OBJ_FLAG_SCROLLABLE);
+    lv_obj_set_flex_flow(bar, LV_FLEX_FLOW_ROW);                               // Horizontal layout
+    lv_obj_set_flex_align(bar, LV_FLEX_ALIGN_SPACE_BETWEEN, LV_FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_CENTER);
+
+    hud.state = lv_label_create(bar);
+    lv_label_set_text(hud.state, "");
+    hud.mic = hud_create_bar(bar, 0x00A000);                                   // Green mic meter
+    hud.spk = hud_create_bar(bar, 0x0060FF);                                   // Blue speaker meter
+    hud.net = lv_label_create(bar);
+    lv_label_set_text(hud.net, "");
+
+    hud.last_state = -1;
+    hud.last_mic = -1;
+    hud.last_spk = -1;
+    lv_timer_create(hud_update_cb, HUD_PERIOD_MS, NULL);
 }
 
 void lvgl_ui(void)
 {
+    ui_queue = xQueueCreate(oai_task_spec(OAI_TASK_UI)->queue_depth, sizeof(ui_message_t));
+
     lvgl_port_lock(0);  // Lock LVGL
     // Create main screen object
     lvgl_screen.screen = lv_obj_create(lv_scr_act());
-    lv_obj_set_size(lvgl_screen.screen, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    lv_obj_set_size(lvgl_screen.screen, kDisplay.width, kDisplay.height);
+    lv_obj_set_style_pad_all(lvgl_screen.screen, 0, LV_PART_MAIN);
 
-    // Create container
+    hud_create(lvgl_screen.screen);
+
+    // Create container below the status bar
     lvgl_screen.container = lv_obj_create(lvgl_screen.screen);
-    lv_obj_set_size(lvgl_screen.container, DISPLAY_WIDTH-10, DISPLAY_HEIGHT-10);
-    lv_obj_center(lvgl_screen.container);                                                   // Center
+    lv_obj_set_size(lvgl_screen.container, kDisplay.width-10, kDisplay.height-12-HUD_HEIGHT);
+    lv_obj_align(lvgl_screen.container, LV_ALIGN_BOTTOM_MID, 0, -5);
     // Hide the right scrollbar of the container
     lv_obj_set_style_pad_all(lvgl_screen.container, 0, LV_PART_MAIN);
 
@@ -287,47 +688,53 @@ void lvgl_ui(void)
     lv_obj_set_flex_flow(lvgl_screen.container, LV_FLEX_FLOW_COLUMN);                       // Vertical layout
     lv_obj_set_scroll_dir(lvgl_screen.container, LV_DIR_VER);                               // Vertical scroll
     lv_obj_set_scrollbar_mode(lvgl_screen.container, LV_SCROLLBAR_MODE_AUTO);               // Auto scroll
+    lv_obj_set_style_pad_column(lvgl_screen.container, 10, LV_PART_MAIN);
+
+    // Each bubble is a green button holding a wrapping label
+    for (int i = 0; i < MESSAGE_POOL_SIZE; i++) {
+        lv_obj_t *btn = lv_btn_create(lvgl_screen.container);
+        lv_obj_set_style_bg_color(btn, lv_color_hex(0x00FF00), LV_STATE_DEFAULT);
+        lv_obj_set_width(btn, lv_pct(98));                                           // Full width
+        lv_obj_set_height(btn, LV_SIZE_CONTENT);                                     // Height adapts to content
+        lv_obj_set_style_radius(btn, 5, LV_STATE_DEFAULT);                           // Rounded corners
+        lv_obj_add_flag(btn, LV_OBJ_FLAG_HIDDEN);                                    // Shown on first use
+
+        lv_obj_t *label = lv_label_create(btn);                                      // Create label
+        lv_label_set_text(label, "");
+        lv_obj_set_style_text_color(label, lv_color_hex(0x000000), LV_STATE_DEFAULT); // Set text color to black
+        lv_obj_set_style_text_font(label, &lv_font_montserrat_20, LV_PART_MAIN);     // Set font size to 20
+        lv_obj_set_style_text_align(label, LV_TEXT_ALIGN_LEFT, LV_PART_MAIN);        // Text align left
+        lv_label_set_long_mode(label, LV_LABEL_LONG_WRAP);                           // Auto-wrap
+        lv_obj_set_width(label, lv_pct(100));                                        // Full width
+        lv_obj_set_height(label, LV_SIZE_CONTENT);                                   // Height adapts to content
+
+        message_pool[i].bubble = btn;
+        message_pool[i].label = label;
+        message_pool[i].length = 0;
+    }
+
+    lv_timer_create(ui_drain_cb, oai_task_spec(OAI_TASK_UI)->period_us / 1000, NULL);
+#ifdef LCD_BENCHMARK
+    lv_timer_create(benchmark_invalidate_cb, 1, NULL);
+    lv_timer_create(benchmark_log_cb, LCD_BENCHMARK_LOG_MS, NULL);
+#endif
     lvgl_port_unlock(); // Unlock LVGL
 }
 
-// Each time this function is called, create a label in the container with text content.
-// The label can wrap lines if needed. The background color of the label is green.
+// Shows text in a new bubble. Safe to call from any task.
 void lvgl_ui_label_set_text(const char *text)
 {
-    lvgl_port_lock(0); 
-    lv_obj_t *btn = lv_btn_create(lvgl_screen.container);
-    lv_obj_set_style_bg_color(btn, lv_color_hex(0x00FF00), LV_STATE_DEFAULT);
-    lv_obj_set_width(btn, lv_pct(98));                                           // Full width
-    lv_obj_set_height(btn, LV_SIZE_CONTENT);                                     // Height adapts to content
-    lv_obj_set_style_radius(btn, 5, LV_STATE_DEFAULT);                           // Rounded corners
-
-    lv_obj_t *label = lv_label_create(btn);                                      // Create label
-    lv_label_set_text(label, text);                                              // Set label text
-    lv_obj_set_style_text_color(label, lv_color_hex(0x000000), LV_STATE_DEFAULT); // Set text color to black
-    lv_obj_set_style_text_font(label, &lv_font_montserrat_20, LV_PART_MAIN);     // Set font size to 20
-    lv_obj_set_style_text_align(label, LV_TEXT_ALIGN_LEFT, LV_PART_MAIN);        // Text align left
-    lv_label_set_long_mode(label, LV_LABEL_LONG_WRAP);                           // Auto-wrap
-    lv_obj_set_width(label, lv_pct(100));                                        // Full width
-    lv_obj_set_height(label, LV_SIZE_CONTENT);                                   // Height adapts to content
+    ui_post(UI_OP_NEW, text);
+}
 
-    lv_obj_set_style_pad_column(lvgl_screen.container, 10, LV_PART_MAIN);
+// Appends text to the bubble being streamed, starting one if needed.
+void lvgl_ui_label_append_text(const char *text)
+{
+    ui_post(UI_OP_APPEND, text);
+}
 
-    const uint8_t max_labels = 5;
-    if (lv_obj_get_child_cnt(lvgl_screen.container) > max_labels) {
-        lv_obj_t *first_child = lv_obj_get_child(lvgl_screen.container, 0);
-        if (first_child) {
-            lv_obj_del(first_child);
-        }
-    }
-    lv_obj_update_layout(lvgl_screen.container);
-
-    int index = lv_obj_get_child_cnt(lvgl_screen.container);
-    if(index > 0)
-    {
-        lv_obj_t *last_child = lv_obj_get_child(lvgl_screen.container, index - 1);
-        lv_coord_t visible_height = lv_obj_get_content_height(lvgl_screen.container); 
-        lv_coord_t y_aligned = lv_obj_get_y(last_child) - (visible_height / 2) + (lv_obj_get_height(last_child) / 2);
-        lv_obj_scroll_to_y(lvgl_screen.container, y_aligned, LV_ANIM_OFF);
-    }
-    lvgl_port_unlock(); 
-}
\ No newline at end of file
+// Closes the bubble being streamed; the next append starts a new one.
+void lvgl_ui_label_end(void)
+{
+    ui_post(UI_OP_END, NULL);
+}
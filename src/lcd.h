@@ -14,8 +14,11 @@ extern "C" {
 extern lv_disp_t * disp_handle;
 
 void init_lvgl(void);
+void set_backlight_brightness(int brightness);
 void lvgl_ui(void);
 void lvgl_ui_label_set_text(const char *text);
+void lvgl_ui_label_append_text(const char *text);
+void lvgl_ui_label_end(void);
 
 #ifdef __cplusplus
 }
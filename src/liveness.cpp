@@ -0,0 +1,60 @@
+#include "liveness.h"
+
+#include <atomic>
+
+#include "metrics.h"
+#include "sdkconfig.h"
+
+static std::atomic<uint32_t> idle_ms{CONFIG_OAI_LIVENESS_IDLE_MS};
+static std::atomic<uint32_t> timeout_ms{CONFIG_OAI_LIVENESS_TIMEOUT_MS};
+
+static int64_t last_rx_us = 0;
+static int64_t probe_sent_us = 0;
+static bool probe_outstanding = false;  // Nothing received since the probe
+static bool reply_outstanding = false;  // The probe itself not answered yet
+
+void oai_liveness_configure(uint32_t idle, uint32_t timeout) {
+  idle_ms.store(idle, std::memory_order_relaxed);
+  timeout_ms.store(timeout, std::memory_order_relaxed);
+}
+
+void oai_liveness_reset(int64_t now_us) {
+  last_rx_us = now_us;
+  probe_outstanding = false;
+  reply_outstanding = false;
+}
+
+void oai_liveness_on_rx(int64_t now_us) {
+  probe_outstanding = false;
+  last_rx_us = now_us;
+}
+
+void oai_liveness_on_probe_reply(int64_t now_us) {
+  if (reply_outstanding) {
+    oai_metrics_gauge_set(OAI_GAUGE_LIVENESS_RTT_MS,
+                          (int32_t)((now_us - probe_sent_us) / 1000));
+    reply_outstanding = false;
+  }
+}
+
+oai_liveness_action_t oai_liveness_poll(int64_t now_us) {
+  uint32_t idle = idle_ms.load(std::memory_order_relaxed);
+  if (idle == 0) {
+    return OAI_LIVENESS_OK;
+  }
+
+  if (probe_outstanding) {
+    uint32_t timeout = timeout_ms.load(std::memory_order_relaxed);
+    return now_us - probe_sent_us >= timeout * 1000LL ? OAI_LIVENESS_DEAD
+                                                      : OAI_LIVENESS_OK;
+  }
+
+  if (now_us - last_rx_us >= idle * 1000LL) {
+    probe_sent_us = now_us;
+    probe_outstanding = true;
+    reply_outstanding = true;
+    oai_metrics_counter_add(OAI_COUNTER_LIVENESS_PROBES, 1);
+    return OAI_LIVENESS_PROBE;
+  }
+  return OAI_LIVENESS_OK;
+}
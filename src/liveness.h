@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+// Application-level consent freshness for the peer connection, on top of
+// libpeer's STUN checks (CONFIG_OAI_ICE_KEEPALIVE_MS). Any inbound audio or
+// data-channel message proves the path is alive. Once the link has been
+// quiet for idle_ms the caller sends a probe the server must answer, and if
+// nothing at all arrives within timeout_ms of the probe the path is declared
+// dead so the caller can rebuild the connection, which starts a new session.
+// Both default to several seconds so a jittery link is not mistaken for a
+// dead one. The reply to the probe itself, and nothing else, gives the
+// liveness_rtt_ms sample.
+//
+// Everything runs on the task driving peer_connection_loop(); the settings
+// may be changed from any task.
+
+typedef enum {
+  OAI_LIVENESS_OK,
+  OAI_LIVENESS_PROBE,  // Send a probe now
+  OAI_LIVENESS_DEAD,   // The probe went unanswered
+} oai_liveness_action_t;
+
+// idle_ms of 0 turns the checks off.
+void oai_liveness_configure(uint32_t idle_ms, uint32_t timeout_ms);
+
+// Starts tracking a freshly connected path.
+void oai_liveness_reset(int64_t now_us);
+void oai_liveness_on_rx(int64_t now_us);
+// Called for the server's answer to a probe, after oai_liveness_on_rx().
+void oai_liveness_on_probe_reply(int64_t now_us);
+oai_liveness_action_t oai_liveness_poll(int64_t now_us);
@@ -3,6 +3,17 @@
 #include <esp_event.h>
 #include <esp_log.h>
 #include <peer.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "crypto_bench.h"
+#include "history.h"
+#include "kws.h"
+#include "power.h"
+#include "recorder.h"
+#include "sdkconfig.h"
+#include "srtp_cipher.h"
 
 #ifndef LINUX_BUILD
 #include "nvs_flash.h"
@@ -14,9 +25,13 @@
 #include "lvgl.h"
 #include "esp_http_server.h"
 #include "wifi_config.h"
+#include "metrics.h"
+#include "tasks.h"
 
 static const char *TAG = "Main";
 
+static void oai_network_task(void *user_data) { oai_webrtc(); }
+
 extern "C" void app_main(void) {
   esp_err_t ret = nvs_flash_init();
   if (ret == ESP_ERR_NVS_NO_FREE_PAGES ||
@@ -26,20 +41,58 @@ extern "C" void app_main(void) {
   }
   ESP_ERROR_CHECK(ret);
 
+  oai_power_init();
+  oai_history_init();
   ESP_ERROR_CHECK(esp_event_loop_create_default());
   peer_init();
+  oai_srtp_cipher_select();
+#ifdef CONFIG_OAI_CRYPTO_BENCH
+  oai_crypto_bench_run();
+#endif
   oai_init_audio_capture();
   oai_init_audio_decoder();
+  oai_init_audio_playout();
+  // Listening starts before Wi-Fi, into the wake word detector or the
+  // pre-roll.
+  oai_kws_init();
+  oai_start_audio_publisher();
 
   init_lvgl();      
   lvgl_ui();         
   wifi_config_init();
-  oai_webrtc();
+  httpd_handle_t server = oai_metrics_start_http_server();
+  oai_recorder_register_http(server);
+  oai_history_register_http(server);
+  // app_main returns and its stack is freed; the loop runs where the task
+  // table puts it.
+  oai_task_start(OAI_TASK_NETWORK, oai_network_task, NULL);
 }
 #else
 int main(void) {
+  oai_power_init();
   ESP_ERROR_CHECK(esp_event_loop_create_default());
   peer_init();
+  oai_srtp_cipher_select();
+  oai_init_audio_decoder();
+
+  // OAI_BENCH=crypto|kws|governor|datachannel|metrics|sendqueue|history|dns|
+  // micro runs a benchmark and exits (bench.h)
+  const char *bench = getenv("OAI_BENCH");
+  if (bench != NULL) {
+    return oai_bench_main(bench);
+  }
+
+  // OAI_HISTORY_FILE=history.bin keeps the history log (history.h)
+  oai_history_init();
+
+  // OAI_REPLAY=capture.oair [OAI_REPLAY_SPEED=4] replays instead of calling
+  const char *replay = getenv("OAI_REPLAY");
+  if (replay != NULL) {
+    const char *speed = getenv("OAI_REPLAY_SPEED");
+    oai_webrtc_replay(replay, speed != NULL ? atof(speed) : 1.0f);
+    return 0;
+  }
+  // OAI_SYNTH_MIC=1 sends a test tone as the microphone (webrtc.cpp)
   oai_webrtc();
 }
 #endif
@@ -7,7 +7,42 @@ void oai_wifi(void);
 void oai_init_audio_capture(void);
 void oai_init_audio_decoder(void);
 void oai_init_audio_encoder();
-void oai_send_audio(PeerConnection *peer_connection);
+// Blocks for the next microphone frame and encodes it. Returns the packet
+// size and the frame's RMS level, or -1 if there is nothing to send,
+// including while the wake word detector (kws.h) holds the uplink closed.
+int oai_capture_audio(const uint8_t **packet, uint32_t *level);
+#ifndef LINUX_BUILD
+// Frames the I2S driver dropped because they were not read in time, since the
+// last call.
+uint32_t oai_capture_take_overruns(void);
+#endif
+// The capture path after the microphone read: runs one mono frame through the
+// DSP chain in place, then the wake word gate and the encoder.
+int oai_encode_audio(int16_t *pcm, const uint8_t **packet, uint32_t *level);
+void oai_audio_set_encoder_complexity(int complexity);
 void oai_audio_decode(uint8_t *data, size_t size);
+// Starts the playout task; oai_audio_playout() hands it a packet to decode.
+void oai_init_audio_playout();
+void oai_audio_playout(uint8_t *data, size_t size);
+// Playback volume in percent, applied to decoded audio.
+void oai_audio_set_volume(uint8_t percent);
+uint8_t oai_audio_get_volume(void);
 void oai_webrtc();
-void oai_http_request(char *offer, char *answer);
+#ifndef LINUX_BUILD
+// Starts capturing into the pre-roll (preroll.h) ahead of the connection.
+void oai_start_audio_publisher();
+#endif
+#ifdef LINUX_BUILD
+// Plays a recorder capture (recorder.h) through the receive paths instead of
+// connecting, then prints the metrics.
+void oai_webrtc_replay(const char *path, float speed);
+#endif
+// Posts the SDP offer and writes the answer. Returns false if no answer came
+// back; the caller decides whether to retry.
+bool oai_http_request(char *offer, char *answer);
+// Starts resolving the OPENAI_REALTIMEAPI host (dns_cache.h) without waiting.
+void oai_http_prefetch(void);
+// Appends one chunk of the SDP answer to buffer (MAX_HTTP_OUTPUT_BUFFER + 1
+// bytes), clearing it on the first chunk and dropping what does not fit.
+// Returns the new length.
+int oai_http_accumulate(char *buffer, int used, const char *data, int len);
@@ -1,40 +1,46 @@
+#ifndef LINUX_BUILD
 #include <driver/i2s.h>
-#include <opus.h>
-
-#include "main.h"
-
-#define SPK_SAMPLE_RATE 8000
-#define SPK_BUFFER_SAMPLES 320  // 320
 
-#define MIC_OPUS_OUT_BUFFER_SIZE  2552// 1276  // 1276 bytes is recommended by opus_encode
-#define MIC_SAMPLE_RATE 16000
-#define MIC_BUFFER_SAMPLES 640  // 320
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#endif
+#include <esp_timer.h>
+#include <opus.h>
+#include <stdio.h>
+#include <string.h>
 
-// speaker
-#define MCLK_PIN -1
-#define DAC_BCLK_PIN 42   // BCLK
-#define DAC_LRCLK_PIN 41  // LRCLK
-#define DAC_DATA_PIN 1    // SDATA
+#include <atomic>
 
-// microphone
-#define ADC_BCLK_PIN 3    // SCK -- BCLK
-#define ADC_LRCLK_PIN 14  // WS  -- LRCLK
-#define ADC_DATA_PIN 46   // SD  -- DATA
-#define OPUS_OUT_BUFFER_SIZE 1276  // 1276 bytes is recommended by opus_encode
+#include "arena.h"
+#include "audio_format.h"
+#include "board.h"
+#include "dsp.h"
+#include "governor.h"
+#include "kws.h"
+#include "main.h"
+#include "metrics.h"
+#include "power.h"
+#include "tasks.h"
 
 #define OPUS_ENCODER_BITRATE 30000
 #define OPUS_ENCODER_COMPLEXITY 0
 
+#ifndef LINUX_BUILD
+// Reports DMA buffers the capture task was too late to read.
+static QueueHandle_t i2s_rx_events = NULL;
+static uint32_t capture_overruns = 0;
+
 void oai_init_audio_capture() {
   i2s_config_t i2s_config_out = {
       .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX),
-      .sample_rate = SPK_SAMPLE_RATE,
+      .sample_rate = SpkFormat::kSampleRate,
       .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
-      .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
+      .channel_format = SpkFormat::kChannels == 2 ? I2S_CHANNEL_FMT_RIGHT_LEFT
+                                                  : I2S_CHANNEL_FMT_ONLY_RIGHT,
       .communication_format = I2S_COMM_FORMAT_I2S_MSB,
       .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-      .dma_buf_count = 8,
-      .dma_buf_len = SPK_BUFFER_SAMPLES,
+      .dma_buf_count = Board::kAudio.dma_buf_count,
+      .dma_buf_len = SpkFormat::kDmaBufferLength,
       .use_apll = 1,
       .tx_desc_auto_clear = true,
   };
@@ -44,10 +50,10 @@ void oai_init_audio_capture() {
   }
 
   i2s_pin_config_t pin_config_out = {
-      .mck_io_num = MCLK_PIN,
-      .bck_io_num = DAC_BCLK_PIN,
-      .ws_io_num = DAC_LRCLK_PIN,
-      .data_out_num = DAC_DATA_PIN,
+      .mck_io_num = Board::kAudio.mclk_pin,
+      .bck_io_num = Board::kAudio.spk_bclk_pin,
+      .ws_io_num = Board::kAudio.spk_lrclk_pin,
+      .data_out_num = Board::kAudio.spk_data_pin,
       .data_in_num = I2S_PIN_NO_CHANGE,
   };
   if (i2s_set_pin(I2S_NUM_0, &pin_config_out) != ESP_OK) {
@@ -58,73 +64,207 @@ void oai_init_audio_capture() {
 
   i2s_config_t i2s_config_in = {
       .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX),
-      .sample_rate = MIC_SAMPLE_RATE,
+      .sample_rate = MicFormat::kSampleRate,
       .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
-      .channel_format = I2S_CHANNEL_FMT_ONLY_RIGHT,
+      .channel_format = MicFormat::kChannels == 2 ? I2S_CHANNEL_FMT_RIGHT_LEFT
+                                                  : I2S_CHANNEL_FMT_ONLY_RIGHT,
       .communication_format = I2S_COMM_FORMAT_I2S_MSB,
       .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-      .dma_buf_count = 8,
-      .dma_buf_len = MIC_BUFFER_SAMPLES,
+      .dma_buf_count = Board::kAudio.dma_buf_count,
+      .dma_buf_len = MicFormat::kDmaBufferLength,
       .use_apll = 1,
   };
-  if (i2s_driver_install(I2S_NUM_1, &i2s_config_in, 0, NULL) != ESP_OK) {
+  if (i2s_driver_install(I2S_NUM_1, &i2s_config_in,
+                         2 * Board::kAudio.dma_buf_count,
+                         &i2s_rx_events) != ESP_OK) {
     printf("Failed to configure I2S driver for audio input");
     return;
   }
 
   i2s_pin_config_t pin_config_in = {
-      .mck_io_num = MCLK_PIN,
-      .bck_io_num = ADC_BCLK_PIN,
-      .ws_io_num = ADC_LRCLK_PIN,
+      .mck_io_num = Board::kAudio.mclk_pin,
+      .bck_io_num = Board::kAudio.mic_bclk_pin,
+      .ws_io_num = Board::kAudio.mic_lrclk_pin,
       .data_out_num = I2S_PIN_NO_CHANGE,
-      .data_in_num = ADC_DATA_PIN,
+      .data_in_num = Board::kAudio.mic_data_pin,
   };
   if (i2s_set_pin(I2S_NUM_1, &pin_config_in) != ESP_OK) {
     printf("Failed to set I2S pins for audio input");
     return;
   }
 }
+#endif
+
+// One specialisation of each per supported format; the frame and packet sizes
+// are constants in the generated code.
+template <typename Format>
+static int encode_frame(OpusEncoder *encoder, const opus_int16 *pcm,
+                        uint8_t *packet) {
+  return opus_encode(encoder, pcm, Format::kFrameSamples, packet,
+                     Format::kMaxPacketBytes);
+}
+
+template <typename Format>
+static int decode_frame(OpusDecoder *decoder, const uint8_t *packet,
+                        size_t size, opus_int16 *pcm) {
+  return opus_decode(decoder, packet, size, pcm, Format::kMaxDecodeSamples, 0);
+}
+
+// Codec state and frame buffers are carved from one internal allocation that
+// lives as long as the process, so streaming never goes back to the heap.
+static oai_arena_t media_arena;
+
+static void *media_arena_alloc(size_t size) {
+  if (media_arena.base == NULL) {
+    size_t arena_size = opus_decoder_get_size(SpkFormat::kChannels) +
+                        opus_encoder_get_size(MicFormat::kChannels) +
+                        MicFormat::kBytes + MicFormat::kMaxPacketBytes +
+                        4 * sizeof(uint64_t);
+    oai_arena_init(&media_arena, OAI_MEM_DMA, arena_size, "media_arena");
+  }
+  return oai_arena_alloc(&media_arena, size);
+}
 
 opus_int16 *output_buffer = NULL;
 OpusDecoder *opus_decoder = NULL;
+static std::atomic<uint8_t> playback_volume{100};
+
+void oai_audio_set_volume(uint8_t percent) {
+  playback_volume.store(percent > 100 ? 100 : percent,
+                        std::memory_order_relaxed);
+}
+
+uint8_t oai_audio_get_volume(void) {
+  return playback_volume.load(std::memory_order_relaxed);
+}
+
+static void apply_volume(opus_int16 *pcm, size_t samples) {
+  uint8_t volume = playback_volume.load(std::memory_order_relaxed);
+  if (volume >= 100) {
+    return;
+  }
+  int32_t gain_q15 = volume * 32768 / 100;
+  for (size_t i = 0; i < samples; i++) {
+    pcm[i] = (opus_int16)((pcm[i] * gain_q15) >> 15);
+  }
+}
 
 void oai_init_audio_decoder() {
-  int decoder_error = 0;
-  opus_decoder = opus_decoder_create(SPK_SAMPLE_RATE, 2, &decoder_error);
-  if (decoder_error != OPUS_OK) {
+  opus_decoder = (OpusDecoder *)media_arena_alloc(
+      opus_decoder_get_size(SpkFormat::kChannels));
+  if (opus_decoder == NULL ||
+      opus_decoder_init(opus_decoder, SpkFormat::kSampleRate,
+                        SpkFormat::kChannels) != OPUS_OK) {
     printf("Failed to create OPUS decoder");
     return;
   }
 
-  output_buffer = (opus_int16 *)malloc(SPK_BUFFER_SAMPLES * sizeof(opus_int16));
+  // Up to 120 ms of PCM; i2s_write() copies it into DMA memory, so PSRAM
+  // will do.
+  output_buffer = (opus_int16 *)oai_mem_alloc(
+      OAI_MEM_PSRAM, SpkFormat::kMaxDecodeBytes, "decode buffer");
 }
 
 void oai_audio_decode(uint8_t *data, size_t size) {
+  int64_t start = esp_timer_get_time();
   int decoded_size =
-      opus_decode(opus_decoder, data, size, output_buffer, SPK_BUFFER_SAMPLES, 0);
+      decode_frame<SpkFormat>(opus_decoder, data, size, output_buffer);
+  uint32_t decode_us = (uint32_t)(esp_timer_get_time() - start);
+  oai_metrics_histogram_observe(OAI_HISTOGRAM_DECODE_US, decode_us);
+  oai_governor_add_playout_us(decode_us);
 
-  if (decoded_size > 0) {
+  if (decoded_size < 0) {
+    oai_metrics_counter_add(OAI_COUNTER_AUDIO_DECODE_ERRORS, 1);
+  } else if (decoded_size > 0) {
+    apply_volume(output_buffer, decoded_size * SpkFormat::kChannels);
+    oai_metrics_gauge_set(
+        OAI_GAUGE_SPK_RMS,
+        oai_dsp_rms(output_buffer, decoded_size * SpkFormat::kChannels));
+#ifndef LINUX_BUILD
     size_t bytes_written = 0;
-    i2s_write(I2S_NUM_0, output_buffer, SPK_BUFFER_SAMPLES * sizeof(opus_int16),
+    i2s_write(I2S_NUM_0, output_buffer,
+              decoded_size * SpkFormat::kChannels * sizeof(opus_int16),
               &bytes_written, portMAX_DELAY);
+#endif
+  }
+}
+
+#ifndef LINUX_BUILD
+// Packets are copied off the network task so a blocking i2s_write never
+// stalls peer_connection_loop().
+typedef struct {
+  int64_t enqueued_us;
+  uint16_t size;
+  uint8_t data[SpkFormat::kMaxPacketBytes];
+} playout_packet_t;
+
+static QueueHandle_t playout_queue = NULL;
+static StaticQueue_t playout_queue_buffer;
+
+static void oai_audio_playout_task(void *user_data) {
+  static playout_packet_t packet;
+  while (1) {
+    // Only a wake from an empty queue measures scheduling; a backlog is
+    // waiting on I2S, not on the scheduler.
+    bool was_idle = uxQueueMessagesWaiting(playout_queue) == 0;
+    if (xQueueReceive(playout_queue, &packet, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    if (was_idle) {
+      oai_task_observe_latency(OAI_TASK_PLAYOUT,
+                               esp_timer_get_time() - packet.enqueued_us);
+    }
+    oai_audio_decode(packet.data, packet.size);
+  }
+}
+
+void oai_init_audio_playout() {
+  uint32_t depth = oai_task_spec(OAI_TASK_PLAYOUT)->queue_depth;
+  uint8_t *storage = (uint8_t *)oai_mem_alloc(
+      OAI_MEM_PSRAM, depth * sizeof(playout_packet_t), "playout queue");
+  if (storage == NULL) {
+    return;
+  }
+  playout_queue = xQueueCreateStatic(depth, sizeof(playout_packet_t), storage,
+                                     &playout_queue_buffer);
+  oai_task_start(OAI_TASK_PLAYOUT, oai_audio_playout_task, NULL);
+}
+
+void oai_audio_playout(uint8_t *data, size_t size) {
+  static playout_packet_t packet;
+  if (playout_queue == NULL || size > sizeof(packet.data)) {
+    oai_metrics_counter_add(OAI_COUNTER_AUDIO_DECODE_ERRORS, 1);
+    return;
+  }
+  packet.enqueued_us = esp_timer_get_time();
+  packet.size = size;
+  memcpy(packet.data, data, size);
+  if (xQueueSend(playout_queue, &packet, 0) != pdTRUE) {
+    oai_metrics_counter_add(OAI_COUNTER_AUDIO_RX_LOST, 1);
   }
 }
+#else
+void oai_init_audio_playout() {}
+
+void oai_audio_playout(uint8_t *data, size_t size) {
+  oai_audio_decode(data, size);
+}
+#endif
 
 OpusEncoder *opus_encoder = NULL;
 opus_int16 *encoder_input_buffer = NULL;
 uint8_t *encoder_output_buffer = NULL;
 
 void oai_init_audio_encoder() {
-  int encoder_error;
-  opus_encoder = opus_encoder_create(MIC_SAMPLE_RATE, 1, OPUS_APPLICATION_VOIP,
-                                     &encoder_error);
-  if (encoder_error != OPUS_OK) {
+  opus_encoder = (OpusEncoder *)media_arena_alloc(
+      opus_encoder_get_size(MicFormat::kChannels));
+  if (opus_encoder == NULL) {
     printf("Failed to create OPUS encoder");
     return;
   }
 
-  if (opus_encoder_init(opus_encoder, MIC_SAMPLE_RATE, 1, OPUS_APPLICATION_VOIP) !=
-      OPUS_OK) {
+  if (opus_encoder_init(opus_encoder, MicFormat::kSampleRate,
+                        MicFormat::kChannels, OPUS_APPLICATION_VOIP) != OPUS_OK) {
     printf("Failed to initialize OPUS encoder");
     return;
   }
@@ -132,20 +272,80 @@ void oai_init_audio_encoder() {
   opus_encoder_ctl(opus_encoder, OPUS_SET_BITRATE(OPUS_ENCODER_BITRATE));
   opus_encoder_ctl(opus_encoder, OPUS_SET_COMPLEXITY(OPUS_ENCODER_COMPLEXITY));
   opus_encoder_ctl(opus_encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
-  encoder_input_buffer = (opus_int16 *)malloc(MIC_BUFFER_SAMPLES);
-  encoder_output_buffer = (uint8_t *)malloc(MIC_OPUS_OUT_BUFFER_SIZE);
+  oai_dsp_init(MicFormat::kSampleRate);
+  encoder_input_buffer = (opus_int16 *)media_arena_alloc(MicFormat::kBytes);
+  encoder_output_buffer =
+      (uint8_t *)media_arena_alloc(MicFormat::kMaxPacketBytes);
 }
 
-void oai_send_audio(PeerConnection *peer_connection) {
-  size_t bytes_read = 0;
+// Called by the governor (governor.h) from the capture task, the only user of
+// the encoder.
+void oai_audio_set_encoder_complexity(int complexity) {
+  if (opus_encoder != NULL) {
+    opus_encoder_ctl(opus_encoder, OPUS_SET_COMPLEXITY(complexity));
+  }
+}
 
-  i2s_read(I2S_NUM_1, encoder_input_buffer, MIC_BUFFER_SAMPLES, &bytes_read,
-           portMAX_DELAY);
+int oai_encode_audio(int16_t *pcm, const uint8_t **packet, uint32_t *level) {
+  static_assert(MicFormat::kChannels == 1, "the DSP chain expects mono");
+  oai_dsp_process(pcm, MicFormat::kSamples);
+  uint32_t rms = oai_dsp_rms(pcm, MicFormat::kSamples);
+  oai_metrics_gauge_set(OAI_GAUGE_MIC_RMS, rms);
+  oai_metrics_gauge_set(OAI_GAUGE_MIC_LEVEL_DBOV,
+                        -(int32_t)oai_dsp_audio_level(rms));
+  oai_power_on_mic_frame(rms, esp_timer_get_time());
+  *level = rms;
+
+  // Until the wake word is heard nothing is encoded or sent.
+  if (!oai_kws_uplink_open()) {
+    if (oai_kws_process(pcm, MicFormat::kSamples)) {
+      oai_power_on_activity(esp_timer_get_time());
+    }
+    return -1;
+  }
 
+  int64_t start = esp_timer_get_time();
   auto encoded_size =
-      opus_encode(opus_encoder, encoder_input_buffer, MIC_BUFFER_SAMPLES / 2,
-                  encoder_output_buffer, OPUS_OUT_BUFFER_SIZE);
+      encode_frame<MicFormat>(opus_encoder, pcm, encoder_output_buffer);
+  oai_metrics_histogram_observe(OAI_HISTOGRAM_ENCODE_US,
+                                (uint32_t)(esp_timer_get_time() - start));
+  if (encoded_size < 0) {
+    oai_metrics_counter_add(OAI_COUNTER_AUDIO_ENCODE_ERRORS, 1);
+    return -1;
+  }
+
+  oai_metrics_counter_add(OAI_COUNTER_AUDIO_TX_FRAMES, 1);
+  *packet = encoder_output_buffer;
+  return encoded_size;
+}
+
+#ifndef LINUX_BUILD
+int oai_capture_audio(const uint8_t **packet, uint32_t *level) {
+  size_t bytes_read = 0;
+
+  i2s_read(I2S_NUM_1, encoder_input_buffer, MicFormat::kBytes, &bytes_read,
+           portMAX_DELAY);
+  if (bytes_read != MicFormat::kBytes) {
+    return -1;
+  }
+  // Each DMA buffer holds one frame, so every overflow is one lost frame.
+  i2s_event_t event;
+  while (i2s_rx_events != NULL &&
+         xQueueReceive(i2s_rx_events, &event, 0) == pdTRUE) {
+    if (event.type == I2S_EVENT_RX_Q_OVF) {
+      capture_overruns++;
+      oai_metrics_counter_add(OAI_COUNTER_CAPTURE_OVERRUNS, 1);
+    }
+  }
+  int64_t now = esp_timer_get_time();
+  oai_task_tick(OAI_TASK_CAPTURE, now);
+  oai_governor_frame_begin(now);
+  return oai_encode_audio(encoder_input_buffer, packet, level);
+}
 
-  peer_connection_send_audio(peer_connection, encoder_output_buffer,
-                             encoded_size);
+uint32_t oai_capture_take_overruns(void) {
+  uint32_t lost = capture_overruns;
+  capture_overruns = 0;
+  return lost;
 }
+#endif
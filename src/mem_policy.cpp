@@ -0,0 +1,104 @@
+#include "mem_policy.h"
+
+#include <esp_log.h>
+#include <stdlib.h>
+
+#include <mutex>
+
+#ifndef LINUX_BUILD
+#include <esp_heap_caps.h>
+#endif
+
+#define MEM_TAG "mem_policy"
+#define MEM_MAX_PLACEMENTS 24
+
+typedef struct {
+  const char *owner;
+  oai_mem_region_t requested;
+  oai_mem_region_t placed;
+  size_t size;
+} placement_t;
+
+static const char *region_names[OAI_MEM_REGION_MAX] = {"internal", "dma",
+                                                       "psram"};
+
+static std::mutex placements_mutex;
+static placement_t placements[MEM_MAX_PLACEMENTS];
+static size_t placements_count = 0;
+
+#ifndef LINUX_BUILD
+static uint32_t region_caps(oai_mem_region_t region) {
+  switch (region) {
+    case OAI_MEM_INTERNAL:
+      return MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    case OAI_MEM_DMA:
+      return MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA | MALLOC_CAP_8BIT;
+    default:
+      return MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+  }
+}
+#endif
+
+static void record_placement(const char *owner, oai_mem_region_t requested,
+                             oai_mem_region_t placed, size_t size) {
+  std::lock_guard<std::mutex> lock(placements_mutex);
+  if (placements_count < MEM_MAX_PLACEMENTS) {
+    placements[placements_count++] = {owner, requested, placed, size};
+  }
+}
+
+void *oai_mem_alloc(oai_mem_region_t region, size_t size, const char *owner) {
+#ifndef LINUX_BUILD
+  oai_mem_region_t placed = region;
+  void *ptr = heap_caps_malloc(size, region_caps(region));
+  if (ptr == NULL && region != OAI_MEM_PSRAM) {
+    ESP_LOGW(MEM_TAG, "%s: %u bytes do not fit in %s RAM, using PSRAM", owner,
+             (unsigned)size, region_names[region]);
+    placed = OAI_MEM_PSRAM;
+    ptr = heap_caps_malloc(size, region_caps(OAI_MEM_PSRAM));
+  }
+#else
+  oai_mem_region_t placed = region;
+  void *ptr = malloc(size);
+#endif
+  if (ptr == NULL) {
+    ESP_LOGE(MEM_TAG, "%s: failed to allocate %u bytes", owner,
+             (unsigned)size);
+    return NULL;
+  }
+  record_placement(owner, region, placed, size);
+  return ptr;
+}
+
+void oai_mem_free(void *ptr) {
+#ifndef LINUX_BUILD
+  heap_caps_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+void oai_mem_report(void) {
+  std::lock_guard<std::mutex> lock(placements_mutex);
+  size_t totals[OAI_MEM_REGION_MAX] = {0};
+  for (size_t i = 0; i < placements_count; i++) {
+    const placement_t &p = placements[i];
+    totals[p.placed] += p.size;
+    ESP_LOGI(MEM_TAG, "%-20s %7u bytes  %-8s%s", p.owner, (unsigned)p.size,
+             region_names[p.placed],
+             p.placed != p.requested ? " (fallback)" : "");
+  }
+
+  for (int r = 0; r < OAI_MEM_REGION_MAX; r++) {
+#ifndef LINUX_BUILD
+    uint32_t caps = region_caps((oai_mem_region_t)r);
+    ESP_LOGI(MEM_TAG, "%-8s placed %7u  free %7u  largest %7u",
+             region_names[r], (unsigned)totals[r],
+             (unsigned)heap_caps_get_free_size(caps),
+             (unsigned)heap_caps_get_largest_free_block(caps));
+#else
+    ESP_LOGI(MEM_TAG, "%-8s placed %7u", region_names[r],
+             (unsigned)totals[r]);
+#endif
+  }
+}
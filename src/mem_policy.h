@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Where long-lived buffers are placed. Anything touched once per audio frame
+// (codec state, PCM and Opus frames, the audio task stack) belongs in
+// internal RAM; the SPI-RAM cache is too slow for the Opus inner loops.
+typedef enum {
+  OAI_MEM_INTERNAL,  // Internal SRAM, byte addressable
+  OAI_MEM_DMA,       // Internal SRAM usable by the I2S/SPI DMA engines
+  OAI_MEM_PSRAM,     // External SPI-RAM for large, cold data
+  OAI_MEM_REGION_MAX,
+} oai_mem_region_t;
+
+// Allocates from the requested region. Internal and DMA requests fall back
+// to PSRAM with a warning rather than failing, so an undersized heap shows up
+// in oai_mem_report() instead of as a crash.
+void *oai_mem_alloc(oai_mem_region_t region, size_t size, const char *owner);
+void oai_mem_free(void *ptr);
+
+// Logs what each owner placed where, plus free and largest-free-block sizes
+// for every region.
+void oai_mem_report(void);
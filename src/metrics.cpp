@@ -0,0 +1,600 @@
+#include "metrics.h"
+
+#include <esp_log.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+
+#include "audio_format.h"
+
+#ifndef LINUX_BUILD
+#include <esp_heap_caps.h>
+
+#include "esp_http_server.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+#define METRICS_TAG "metrics"
+// Inbound gaps at least this long are a pause in speech, not loss
+#define METRICS_AUDIO_RX_MAX_GAP_US (500 * 1000)
+#define METRICS_MAX_TASKS 24
+
+static const char *counter_names[OAI_COUNTER_MAX] = {
+    "audio_tx_frames",     "audio_rx_packets", "audio_rx_lost",
+    "audio_decode_errors", "audio_encode_errors", "datachannel_rx",
+    "datachannel_tx",      "peer_connected",   "peer_disconnected",
+    "liveness_probes",     "ice_restarts",     "send_queue_dropped",
+    "send_queue_coalesced", "tool_calls",     "tool_errors",
+    "capture_deadline_misses", "playout_deadline_misses",
+    "network_deadline_misses", "ui_deadline_misses",
+    "power_wakeups",      "recorder_dropped", "kws_detections",
+    "preroll_dropped",    "governor_steps",   "datachannel_rx_oversize",
+    "capture_overruns",
+    "history_bytes",
+    "history_dropped",
+    "history_erases",
+    "dns_cache_hits",
+    "dns_cache_misses",
+};
+
+static const char *gauge_names[OAI_GAUGE_MAX] = {
+    "heap_free",           "heap_min_free", "internal_free", "psram_free",
+    "audio_rx_jitter_us", "peer_state",    "display_fps",   "mic_rms",
+    "spk_rms",            "datachannel_rtt_ms", "send_queue_depth",
+    "power_profile",      "preroll_backlog_ms", "governor_level",
+    "encoder_complexity", "audio_slack_p99_us", "dc_rx_high_water",
+    "mic_level_dbov",
+    "history_erased_ahead",
+    "liveness_rtt_ms",
+};
+
+static const char *histogram_names[OAI_HISTOGRAM_MAX] = {
+    "encode_us",
+    "decode_us",
+    "audio_rx_interval_us",
+    "display_refresh_us",
+    "display_flush_wait_us",
+    "tool_call_us",
+    "capture_lateness_us",
+    "playout_lateness_us",
+    "network_lateness_us",
+    "ui_lateness_us",
+    "power_wake_us",
+    "kws_inference_us",
+    "datachannel_rx_bytes",
+    "audio_tx_interval_us",
+    "history_flash_op_us",
+    "dns_lookup_us",
+    "signaling_us",
+};
+
+typedef struct {
+  std::atomic<uint32_t> buckets[OAI_HISTOGRAM_BUCKETS];
+  std::atomic<uint32_t> count;
+  // 32 bits keeps the update a single native atomic; the sum wraps after
+  // roughly a day of 1 ms observations at frame rate.
+  std::atomic<uint32_t> sum;
+} histogram_t;
+
+static std::atomic<uint32_t> counters[OAI_COUNTER_MAX];
+static std::atomic<int32_t> gauges[OAI_GAUGE_MAX];
+static histogram_t histograms[OAI_HISTOGRAM_MAX];
+
+static int64_t last_audio_rx_us = 0;
+static int64_t audio_rx_jitter_q4 = 0;
+
+static inline uint32_t bucket_for(uint32_t value) {
+  if (value == 0) {
+    return 0;
+  }
+  uint32_t bucket = 32 - __builtin_clz(value);
+  return bucket < OAI_HISTOGRAM_BUCKETS ? bucket : OAI_HISTOGRAM_BUCKETS - 1;
+}
+
+static inline uint32_t bucket_upper_bound(uint32_t bucket) {
+  if (bucket == OAI_HISTOGRAM_BUCKETS - 1) {
+    return UINT32_MAX;
+  }
+  return bucket == 0 ? 0 : (1u << bucket) - 1;
+}
+
+void oai_metrics_counter_add(oai_counter_t counter, uint32_t value) {
+  counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void oai_metrics_gauge_set(oai_gauge_t gauge, int32_t value) {
+  gauges[gauge].store(value, std::memory_order_relaxed);
+}
+
+void oai_metrics_histogram_observe(oai_histogram_t histogram, uint32_t value) {
+  histogram_t &h = histograms[histogram];
+  h.buckets[bucket_for(value)].fetch_add(1, std::memory_order_relaxed);
+  h.count.fetch_add(1, std::memory_order_relaxed);
+  h.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint32_t oai_metrics_counter_get(oai_counter_t counter) {
+  return counters[counter].load(std::memory_order_relaxed);
+}
+
+int32_t oai_metrics_gauge_get(oai_gauge_t gauge) {
+  return gauges[gauge].load(std::memory_order_relaxed);
+}
+
+void oai_metrics_histogram_get(oai_histogram_t histogram,
+                               oai_histogram_snapshot_t *out) {
+  histogram_t &h = histograms[histogram];
+  for (int i = 0; i < OAI_HISTOGRAM_BUCKETS; i++) {
+    out->buckets[i] = h.buckets[i].load(std::memory_order_relaxed);
+  }
+  out->count = h.count.load(std::memory_order_relaxed);
+  out->sum = h.sum.load(std::memory_order_relaxed);
+}
+
+uint32_t oai_metrics_histogram_quantile(const oai_histogram_snapshot_t *h,
+                                        float quantile) {
+  uint32_t total = 0;
+  for (int i = 0; i < OAI_HISTOGRAM_BUCKETS; i++) {
+    total += h->buckets[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  uint32_t rank = (uint32_t)(quantile * (float)total + 0.5f);
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint32_t seen = 0;
+  for (int i = 0; i < OAI_HISTOGRAM_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      return bucket_upper_bound(i);
+    }
+  }
+  return UINT32_MAX;
+}
+
+void oai_metrics_reset(void) {
+  for (auto &c : counters) {
+    c.store(0, std::memory_order_relaxed);
+  }
+  for (auto &g : gauges) {
+    g.store(0, std::memory_order_relaxed);
+  }
+  for (auto &h : histograms) {
+    for (auto &b : h.buckets) {
+      b.store(0, std::memory_order_relaxed);
+    }
+    h.count.store(0, std::memory_order_relaxed);
+    h.sum.store(0, std::memory_order_relaxed);
+  }
+  last_audio_rx_us = 0;
+  audio_rx_jitter_q4 = 0;
+}
+
+// Only ever called from the network loop, so the jitter state is unshared.
+void oai_metrics_audio_rx(int64_t now_us) {
+  oai_metrics_counter_add(OAI_COUNTER_AUDIO_RX_PACKETS, 1);
+  if (last_audio_rx_us != 0) {
+    int64_t interval = now_us - last_audio_rx_us;
+    oai_metrics_histogram_observe(OAI_HISTOGRAM_AUDIO_RX_INTERVAL_US,
+                                  (uint32_t)interval);
+
+    if (interval < METRICS_AUDIO_RX_MAX_GAP_US) {
+      int64_t missing =
+          (interval + SpkFormat::kFrameUs / 2) / SpkFormat::kFrameUs - 1;
+      if (missing > 0) {
+        oai_metrics_counter_add(OAI_COUNTER_AUDIO_RX_LOST, (uint32_t)missing);
+      }
+    }
+
+    // J += (|D| - J) / 16, kept in Q4 to avoid losing the fraction.
+    int64_t d = interval - SpkFormat::kFrameUs;
+    if (d < 0) {
+      d = -d;
+    }
+    audio_rx_jitter_q4 += d - ((audio_rx_jitter_q4 + 8) >> 4);
+    oai_metrics_gauge_set(OAI_GAUGE_AUDIO_RX_JITTER_US,
+                          (int32_t)(audio_rx_jitter_q4 >> 4));
+  }
+  last_audio_rx_us = now_us;
+}
+
+typedef struct {
+  char name[16];
+  uint32_t stack_hwm;
+  uint32_t cpu_percent;
+} task_stat_t;
+
+static std::mutex system_mutex;
+static task_stat_t task_stats[METRICS_MAX_TASKS];
+static size_t task_stats_count = 0;
+
+#ifndef LINUX_BUILD
+static TaskStatus_t task_status[METRICS_MAX_TASKS];
+static uint32_t prev_task_runtime[METRICS_MAX_TASKS];
+static UBaseType_t prev_task_number[METRICS_MAX_TASKS];
+static size_t prev_task_count = 0;
+static uint32_t prev_total_runtime = 0;
+
+static uint32_t previous_runtime_for(UBaseType_t task_number) {
+  for (size_t i = 0; i < prev_task_count; i++) {
+    if (prev_task_number[i] == task_number) {
+      return prev_task_runtime[i];
+    }
+  }
+  return 0;
+}
+#endif
+
+void oai_metrics_sample_system(void) {
+  std::lock_guard<std::mutex> lock(system_mutex);
+#ifndef LINUX_BUILD
+  oai_metrics_gauge_set(OAI_GAUGE_HEAP_FREE, esp_get_free_heap_size());
+  oai_metrics_gauge_set(OAI_GAUGE_HEAP_MIN_FREE,
+                        esp_get_minimum_free_heap_size());
+  oai_metrics_gauge_set(OAI_GAUGE_INTERNAL_FREE,
+                        heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+  oai_metrics_gauge_set(OAI_GAUGE_PSRAM_FREE,
+                        heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+
+  uint32_t total_runtime = 0;
+  UBaseType_t count =
+      uxTaskGetSystemState(task_status, METRICS_MAX_TASKS, &total_runtime);
+  uint32_t elapsed = (total_runtime - prev_total_runtime) * portNUM_PROCESSORS;
+
+  task_stats_count = count;
+  for (UBaseType_t i = 0; i < count; i++) {
+    const TaskStatus_t &status = task_status[i];
+    task_stat_t &stat = task_stats[i];
+    strncpy(stat.name, status.pcTaskName, sizeof(stat.name) - 1);
+    stat.name[sizeof(stat.name) - 1] = '\0';
+    stat.stack_hwm = status.usStackHighWaterMark;
+
+    uint32_t delta =
+        status.ulRunTimeCounter - previous_runtime_for(status.xTaskNumber);
+    stat.cpu_percent =
+        elapsed ? (uint32_t)(((uint64_t)delta * 100) / elapsed) : 0;
+  }
+
+  for (UBaseType_t i = 0; i < count; i++) {
+    prev_task_number[i] = task_status[i].xTaskNumber;
+    prev_task_runtime[i] = task_status[i].ulRunTimeCounter;
+  }
+  prev_task_count = count;
+  prev_total_runtime = total_runtime;
+#endif
+}
+
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t used;
+} writer_t;
+
+static void writer_append(writer_t *w, const char *fmt, ...) {
+  if (w->used >= w->len) {
+    return;
+  }
+  va_list args;
+  va_start(args, fmt);
+  int written = vsnprintf(w->buf + w->used, w->len - w->used, fmt, args);
+  va_end(args);
+  if (written > 0) {
+    w->used += (size_t)written;
+  }
+  if (w->used >= w->len) {
+    w->used = w->len - 1;
+  }
+}
+
+size_t oai_metrics_snapshot_json(char *buf, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  writer_t w = {buf, len, 0};
+  buf[0] = '\0';
+
+  writer_append(&w, "{\"type\":\"device.metrics\",\"counters\":{");
+  for (int i = 0; i < OAI_COUNTER_MAX; i++) {
+    writer_append(&w, "%s\"%s\":%lu", i ? "," : "", counter_names[i],
+                  (unsigned long)oai_metrics_counter_get((oai_counter_t)i));
+  }
+
+  writer_append(&w, "},\"gauges\":{");
+  for (int i = 0; i < OAI_GAUGE_MAX; i++) {
+    writer_append(&w, "%s\"%s\":%ld", i ? "," : "", gauge_names[i],
+                  (long)oai_metrics_gauge_get((oai_gauge_t)i));
+  }
+
+  writer_append(&w, "},\"histograms\":{");
+  for (int i = 0; i < OAI_HISTOGRAM_MAX; i++) {
+    oai_histogram_snapshot_t h;
+    oai_metrics_histogram_get((oai_histogram_t)i, &h);
+    writer_append(&w, "%s\"%s\":{\"n\":%lu,\"mean\":%lu,\"p50\":%lu,\"p99\":%lu}",
+                  i ? "," : "", histogram_names[i], (unsigned long)h.count,
+                  (unsigned long)(h.count ? h.sum / h.count : 0),
+                  (unsigned long)oai_metrics_histogram_quantile(&h, 0.5f),
+                  (unsigned long)oai_metrics_histogram_quantile(&h, 0.99f));
+  }
+
+  writer_append(&w, "},\"tasks\":[");
+  {
+    std::lock_guard<std::mutex> lock(system_mutex);
+    for (size_t i = 0; i < task_stats_count; i++) {
+      writer_append(&w, "%s[\"%s\",%lu,%lu]", i ? "," : "",
+                    task_stats[i].name, (unsigned long)task_stats[i].stack_hwm,
+                    (unsigned long)task_stats[i].cpu_percent);
+    }
+  }
+  writer_append(&w, "]}");
+  return w.used;
+}
+
+size_t oai_metrics_snapshot_text(char *buf, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  writer_t w = {buf, len, 0};
+  buf[0] = '\0';
+
+  for (int i = 0; i < OAI_COUNTER_MAX; i++) {
+    writer_append(&w, "# TYPE oai_%s_total counter\noai_%s_total %lu\n",
+                  counter_names[i], counter_names[i],
+                  (unsigned long)oai_metrics_counter_get((oai_counter_t)i));
+  }
+
+  for (int i = 0; i < OAI_GAUGE_MAX; i++) {
+    writer_append(&w, "# TYPE oai_%s gauge\noai_%s %ld\n", gauge_names[i],
+                  gauge_names[i], (long)oai_metrics_gauge_get((oai_gauge_t)i));
+  }
+
+  for (int i = 0; i < OAI_HISTOGRAM_MAX; i++) {
+    oai_histogram_snapshot_t h;
+    oai_metrics_histogram_get((oai_histogram_t)i, &h);
+    writer_append(&w, "# TYPE oai_%s histogram\n", histogram_names[i]);
+    uint32_t cumulative = 0;
+    for (int b = 0; b < OAI_HISTOGRAM_BUCKETS - 1; b++) {
+      cumulative += h.buckets[b];
+      writer_append(&w, "oai_%s_bucket{le=\"%lu\"} %lu\n", histogram_names[i],
+                    (unsigned long)bucket_upper_bound(b),
+                    (unsigned long)cumulative);
+    }
+    cumulative += h.buckets[OAI_HISTOGRAM_BUCKETS - 1];
+    writer_append(&w, "oai_%s_bucket{le=\"+Inf\"} %lu\n", histogram_names[i],
+                  (unsigned long)cumulative);
+    writer_append(&w, "oai_%s_sum %lu\noai_%s_count %lu\n",
+                  histogram_names[i], (unsigned long)h.sum,
+                  histogram_names[i], (unsigned long)h.count);
+  }
+
+  std::lock_guard<std::mutex> lock(system_mutex);
+  for (size_t i = 0; i < task_stats_count; i++) {
+    writer_append(&w, "oai_task_stack_hwm_bytes{task=\"%s\"} %lu\n",
+                  task_stats[i].name, (unsigned long)task_stats[i].stack_hwm);
+    writer_append(&w, "oai_task_cpu_percent{task=\"%s\"} %lu\n",
+                  task_stats[i].name, (unsigned long)task_stats[i].cpu_percent);
+  }
+  return w.used;
+}
+
+#ifndef LINUX_BUILD
+#define METRICS_HTTP_BUFFER_SIZE 8192
+
+// httpd serves requests from a single task, so one buffer is enough.
+static char metrics_http_buffer[METRICS_HTTP_BUFFER_SIZE];
+
+static esp_err_t metrics_get_handler(httpd_req_t *req) {
+  oai_metrics_sample_system();
+  size_t len = oai_metrics_snapshot_text(metrics_http_buffer,
+                                         sizeof(metrics_http_buffer));
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+  httpd_resp_send(req, metrics_http_buffer, len);
+  return ESP_OK;
+}
+
+static const httpd_uri_t metrics_uri = {
+    .uri = "/metrics",
+    .method = HTTP_GET,
+    .handler = metrics_get_handler,
+    .user_ctx = NULL,
+};
+
+httpd_handle_t oai_metrics_start_http_server(void) {
+  httpd_handle_t server = NULL;
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.lru_purge_enable = true;
+
+  if (httpd_start(&server, &config) != ESP_OK) {
+    ESP_LOGE(METRICS_TAG, "Failed to start metrics server");
+    return NULL;
+  }
+  httpd_register_uri_handler(server, &metrics_uri);
+  ESP_LOGI(METRICS_TAG, "Serving /metrics on port %d", config.server_port);
+  return server;
+}
+#endif
+
+#ifdef LINUX_BUILD
+/**********************
+ * Self-test
+ **********************/
+#define SELFTEST_BUFFER_SIZE (32 * 1024)
+
+static char selftest_buffer[SELFTEST_BUFFER_SIZE];
+static bool selftest_ok = true;
+
+static void selftest_check(bool ok, const char *what) {
+  if (!ok) {
+    ESP_LOGE(METRICS_TAG, "%s", what);
+    selftest_ok = false;
+  }
+}
+
+// Bucket an observation of value lands in, from a freshly reset registry.
+static int selftest_bucket_of(uint32_t value) {
+  oai_metrics_reset();
+  oai_metrics_histogram_observe(OAI_HISTOGRAM_DECODE_US, value);
+  oai_histogram_snapshot_t h;
+  oai_metrics_histogram_get(OAI_HISTOGRAM_DECODE_US, &h);
+  for (int i = 0; i < OAI_HISTOGRAM_BUCKETS; i++) {
+    if (h.buckets[i] != 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void selftest_contains(const char *text, const char *expected) {
+  if (strstr(text, expected) == NULL) {
+    ESP_LOGE(METRICS_TAG, "Snapshot is missing:\n%s", expected);
+    selftest_ok = false;
+  }
+}
+
+// One observation in most of the low buckets, the top of bucket 16 and two
+// in the overflow bucket.
+static const uint32_t selftest_observations[] = {0, 1, 2, 3, 4, 7, 8,
+                                                 65535, 65536, 1000000};
+
+static const char selftest_json_head[] =
+    "{\"type\":\"device.metrics\",\"counters\":{\"audio_tx_frames\":3,"
+    "\"audio_rx_packets\":0,";
+
+static const char selftest_json_counter[] =
+    "\"ice_restarts\":0,\"send_queue_dropped\":7,\"send_queue_coalesced\":0,";
+
+static const char selftest_json_gauge[] =
+    "\"display_fps\":0,\"mic_rms\":-5,\"spk_rms\":0,";
+
+static const char selftest_json_histograms[] =
+    "},\"histograms\":{\"encode_us\":{\"n\":10,\"mean\":113109,\"p50\":7,"
+    "\"p99\":4294967295},\"decode_us\":{\"n\":0,\"mean\":0,\"p50\":0,"
+    "\"p99\":0},";
+
+static const char selftest_json_tail[] = "}},\"tasks\":[]}";
+
+static const char selftest_text_head[] =
+    "# TYPE oai_audio_tx_frames_total counter\n"
+    "oai_audio_tx_frames_total 3\n";
+
+static const char selftest_text_counter[] =
+    "# TYPE oai_send_queue_dropped_total counter\n"
+    "oai_send_queue_dropped_total 7\n";
+
+static const char selftest_text_gauge[] =
+    "# TYPE oai_mic_rms gauge\n"
+    "oai_mic_rms -5\n";
+
+static const char selftest_text_histogram[] =
+    "# TYPE oai_encode_us histogram\n"
+    "oai_encode_us_bucket{le=\"0\"} 1\n"
+    "oai_encode_us_bucket{le=\"1\"} 2\n"
+    "oai_encode_us_bucket{le=\"3\"} 4\n"
+    "oai_encode_us_bucket{le=\"7\"} 6\n"
+    "oai_encode_us_bucket{le=\"15\"} 7\n"
+    "oai_encode_us_bucket{le=\"31\"} 7\n"
+    "oai_encode_us_bucket{le=\"63\"} 7\n"
+    "oai_encode_us_bucket{le=\"127\"} 7\n"
+    "oai_encode_us_bucket{le=\"255\"} 7\n"
+    "oai_encode_us_bucket{le=\"511\"} 7\n"
+    "oai_encode_us_bucket{le=\"1023\"} 7\n"
+    "oai_encode_us_bucket{le=\"2047\"} 7\n"
+    "oai_encode_us_bucket{le=\"4095\"} 7\n"
+    "oai_encode_us_bucket{le=\"8191\"} 7\n"
+    "oai_encode_us_bucket{le=\"16383\"} 7\n"
+    "oai_encode_us_bucket{le=\"32767\"} 7\n"
+    "oai_encode_us_bucket{le=\"65535\"} 8\n"
+    "oai_encode_us_bucket{le=\"+Inf\"} 10\n"
+    "oai_encode_us_sum 1131096\n"
+    "oai_encode_us_count 10\n"
+    "# TYPE oai_decode_us histogram\n";
+
+bool oai_metrics_selftest(void) {
+  selftest_ok = true;
+
+  oai_metrics_reset();
+  oai_metrics_counter_add(OAI_COUNTER_AUDIO_TX_FRAMES, 1);
+  oai_metrics_counter_add(OAI_COUNTER_AUDIO_TX_FRAMES, 2);
+  selftest_check(oai_metrics_counter_get(OAI_COUNTER_AUDIO_TX_FRAMES) == 3,
+                 "Counter did not add up");
+  selftest_check(oai_metrics_counter_get(OAI_COUNTER_AUDIO_RX_PACKETS) == 0,
+                 "Counter changed without an update");
+  oai_metrics_gauge_set(OAI_GAUGE_MIC_RMS, 100);
+  oai_metrics_gauge_set(OAI_GAUGE_MIC_RMS, -5);
+  selftest_check(oai_metrics_gauge_get(OAI_GAUGE_MIC_RMS) == -5,
+                 "Gauge did not keep the last value");
+  oai_metrics_reset();
+  selftest_check(oai_metrics_counter_get(OAI_COUNTER_AUDIO_TX_FRAMES) == 0 &&
+                     oai_metrics_gauge_get(OAI_GAUGE_MIC_RMS) == 0,
+                 "Reset left a value behind");
+
+  selftest_check(selftest_bucket_of(0) == 0, "0 is not in bucket 0");
+  for (int b = 1; b < OAI_HISTOGRAM_BUCKETS - 1; b++) {
+    uint32_t low = 1u << (b - 1);
+    uint32_t high = (1u << b) - 1;
+    if (selftest_bucket_of(low) != b || selftest_bucket_of(high) != b ||
+        bucket_upper_bound(b) != high) {
+      ESP_LOGE(METRICS_TAG, "Bucket %d does not hold [%lu, %lu]", b,
+               (unsigned long)low, (unsigned long)high);
+      selftest_ok = false;
+    }
+  }
+  int last = OAI_HISTOGRAM_BUCKETS - 1;
+  selftest_check(selftest_bucket_of(1u << (last - 1)) == last &&
+                     selftest_bucket_of(UINT32_MAX) == last,
+                 "Overflow bucket does not hold everything above");
+
+  // The known state the snapshots are checked against
+  oai_metrics_reset();
+  oai_metrics_counter_add(OAI_COUNTER_AUDIO_TX_FRAMES, 3);
+  oai_metrics_counter_add(OAI_COUNTER_SEND_QUEUE_DROPPED, 7);
+  oai_metrics_gauge_set(OAI_GAUGE_MIC_RMS, -5);
+  for (uint32_t value : selftest_observations) {
+    oai_metrics_histogram_observe(OAI_HISTOGRAM_ENCODE_US, value);
+  }
+
+  size_t len =
+      oai_metrics_snapshot_json(selftest_buffer, sizeof(selftest_buffer));
+  selftest_check(len == strlen(selftest_buffer) &&
+                     len < sizeof(selftest_buffer) - 1,
+                 "JSON snapshot truncated");
+  selftest_check(strncmp(selftest_buffer, selftest_json_head,
+                         sizeof(selftest_json_head) - 1) == 0,
+                 "JSON snapshot does not start with the counters");
+  selftest_contains(selftest_buffer, selftest_json_counter);
+  selftest_contains(selftest_buffer, selftest_json_gauge);
+  selftest_contains(selftest_buffer, selftest_json_histograms);
+  size_t tail = sizeof(selftest_json_tail) - 1;
+  selftest_check(len >= tail && strcmp(selftest_buffer + len - tail,
+                                       selftest_json_tail) == 0,
+                 "JSON snapshot does not end with the task list");
+
+  len = oai_metrics_snapshot_text(selftest_buffer, sizeof(selftest_buffer));
+  selftest_check(len == strlen(selftest_buffer) &&
+                     len < sizeof(selftest_buffer) - 1,
+                 "Text snapshot truncated");
+  selftest_check(strncmp(selftest_buffer, selftest_text_head,
+                         sizeof(selftest_text_head) - 1) == 0,
+                 "Text snapshot does not start with the counters");
+  selftest_contains(selftest_buffer, selftest_text_counter);
+  selftest_contains(selftest_buffer, selftest_text_gauge);
+  selftest_contains(selftest_buffer, selftest_text_histogram);
+
+  // A short buffer is cut, still terminated
+  char small[32];
+  len = oai_metrics_snapshot_text(small, sizeof(small));
+  selftest_check(len == sizeof(small) - 1 && small[len] == '\0' &&
+                     strncmp(small, selftest_buffer, len) == 0,
+                 "Short buffer not cut cleanly");
+
+  oai_metrics_reset();
+  ESP_LOGI(METRICS_TAG, "%s", selftest_ok ? "PASS" : "FAIL");
+  return selftest_ok;
+}
+#endif
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef LINUX_BUILD
+#include "esp_http_server.h"
+#endif
+
+// Counters only ever increase, gauges hold the last value written and
+// histograms count observations into fixed power-of-two buckets. Every update
+// is a single relaxed atomic operation so it is safe to call from the audio
+// and network tasks without locking.
+
+typedef enum {
+  OAI_COUNTER_AUDIO_TX_FRAMES,
+  OAI_COUNTER_AUDIO_RX_PACKETS,
+  OAI_COUNTER_AUDIO_RX_LOST,
+  OAI_COUNTER_AUDIO_DECODE_ERRORS,
+  OAI_COUNTER_AUDIO_ENCODE_ERRORS,
+  OAI_COUNTER_DATACHANNEL_RX,
+  OAI_COUNTER_DATACHANNEL_TX,
+  OAI_COUNTER_PEER_CONNECTED,
+  OAI_COUNTER_PEER_DISCONNECTED,
+  OAI_COUNTER_LIVENESS_PROBES,
+  OAI_COUNTER_ICE_RESTARTS,
+  OAI_COUNTER_SEND_QUEUE_DROPPED,
+  OAI_COUNTER_SEND_QUEUE_COALESCED,
+  OAI_COUNTER_TOOL_CALLS,
+  OAI_COUNTER_TOOL_ERRORS,
+  OAI_COUNTER_CAPTURE_DEADLINE_MISSES,
+  OAI_COUNTER_PLAYOUT_DEADLINE_MISSES,
+  OAI_COUNTER_NETWORK_DEADLINE_MISSES,
+  OAI_COUNTER_UI_DEADLINE_MISSES,
+  OAI_COUNTER_POWER_WAKEUPS,
+  OAI_COUNTER_RECORDER_DROPPED,
+  OAI_COUNTER_KWS_DETECTIONS,
+  OAI_COUNTER_PREROLL_DROPPED,
+  OAI_COUNTER_GOVERNOR_STEPS,
+  OAI_COUNTER_DATACHANNEL_RX_OVERSIZE,
+  OAI_COUNTER_CAPTURE_OVERRUNS,
+  OAI_COUNTER_HISTORY_BYTES,
+  OAI_COUNTER_HISTORY_DROPPED,
+  OAI_COUNTER_HISTORY_ERASES,
+  OAI_COUNTER_DNS_CACHE_HITS,
+  OAI_COUNTER_DNS_CACHE_MISSES,
+  OAI_COUNTER_MAX,
+} oai_counter_t;
+
+typedef enum {
+  OAI_GAUGE_HEAP_FREE,
+  OAI_GAUGE_HEAP_MIN_FREE,
+  OAI_GAUGE_INTERNAL_FREE,
+  OAI_GAUGE_PSRAM_FREE,
+  OAI_GAUGE_AUDIO_RX_JITTER_US,
+  OAI_GAUGE_PEER_STATE,
+  OAI_GAUGE_DISPLAY_FPS,
+  OAI_GAUGE_MIC_RMS,
+  OAI_GAUGE_SPK_RMS,
+  OAI_GAUGE_DATACHANNEL_RTT_MS,
+  OAI_GAUGE_SEND_QUEUE_DEPTH,
+  OAI_GAUGE_POWER_PROFILE,
+  OAI_GAUGE_PREROLL_BACKLOG_MS,
+  OAI_GAUGE_GOVERNOR_LEVEL,
+  OAI_GAUGE_ENCODER_COMPLEXITY,
+  OAI_GAUGE_AUDIO_SLACK_P99_US,
+  OAI_GAUGE_DC_RX_HIGH_WATER,
+  OAI_GAUGE_MIC_LEVEL_DBOV,
+  OAI_GAUGE_HISTORY_ERASED_AHEAD,
+  OAI_GAUGE_LIVENESS_RTT_MS,
+  OAI_GAUGE_MAX,
+} oai_gauge_t;
+
+typedef enum {
+  OAI_HISTOGRAM_ENCODE_US,
+  OAI_HISTOGRAM_DECODE_US,
+  OAI_HISTOGRAM_AUDIO_RX_INTERVAL_US,
+  OAI_HISTOGRAM_DISPLAY_REFRESH_US,
+  OAI_HISTOGRAM_DISPLAY_FLUSH_WAIT_US,
+  OAI_HISTOGRAM_TOOL_CALL_US,
+  OAI_HISTOGRAM_CAPTURE_LATENESS_US,
+  OAI_HISTOGRAM_PLAYOUT_LATENESS_US,
+  OAI_HISTOGRAM_NETWORK_LATENESS_US,
+  OAI_HISTOGRAM_UI_LATENESS_US,
+  OAI_HISTOGRAM_POWER_WAKE_US,
+  OAI_HISTOGRAM_KWS_INFERENCE_US,
+  OAI_HISTOGRAM_DATACHANNEL_RX_BYTES,
+  OAI_HISTOGRAM_AUDIO_TX_INTERVAL_US,
+  OAI_HISTOGRAM_HISTORY_FLASH_OP_US,
+  OAI_HISTOGRAM_DNS_LOOKUP_US,
+  OAI_HISTOGRAM_SIGNALING_US,
+  OAI_HISTOGRAM_MAX,
+} oai_histogram_t;
+
+// Bucket 0 holds zero, bucket i holds [2^(i-1), 2^i) and the last bucket
+// holds everything above.
+#define OAI_HISTOGRAM_BUCKETS 18
+
+typedef struct {
+  uint32_t buckets[OAI_HISTOGRAM_BUCKETS];
+  uint32_t count;
+  uint32_t sum;
+} oai_histogram_snapshot_t;
+
+void oai_metrics_counter_add(oai_counter_t counter, uint32_t value);
+void oai_metrics_gauge_set(oai_gauge_t gauge, int32_t value);
+void oai_metrics_histogram_observe(oai_histogram_t histogram, uint32_t value);
+
+uint32_t oai_metrics_counter_get(oai_counter_t counter);
+int32_t oai_metrics_gauge_get(oai_gauge_t gauge);
+void oai_metrics_histogram_get(oai_histogram_t histogram,
+                               oai_histogram_snapshot_t *out);
+// Upper bound of the bucket holding the given quantile (0.0 - 1.0).
+uint32_t oai_metrics_histogram_quantile(const oai_histogram_snapshot_t *h,
+                                        float quantile);
+void oai_metrics_reset(void);
+
+// Feeds the arrival time of an inbound audio packet, updating the interval
+// histogram and the RFC 3550 style interarrival jitter estimate. Short gaps
+// in the stream are counted as lost frames; longer ones are taken to be the
+// pause between responses.
+void oai_metrics_audio_rx(int64_t now_us);
+
+// Refreshes heap, PSRAM and per-task gauges. Not for hot paths.
+void oai_metrics_sample_system(void);
+
+// Compact JSON event suitable for the oai-events data channel.
+size_t oai_metrics_snapshot_json(char *buf, size_t len);
+// Prometheus text exposition format for the /metrics endpoint.
+size_t oai_metrics_snapshot_text(char *buf, size_t len);
+
+#ifndef LINUX_BUILD
+// Serves /metrics and returns the server so other debug endpoints can be
+// registered on it, or NULL if it could not start.
+httpd_handle_t oai_metrics_start_http_server(void);
+#else
+// Checks counter and gauge updates, the histogram bucket of zero and of both
+// ends of every power-of-two bucket, and the JSON and text snapshots of a
+// known state. Resets the registry. Returns false on any mismatch.
+bool oai_metrics_selftest(void);
+#endif
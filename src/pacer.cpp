@@ -0,0 +1,80 @@
+#include "pacer.h"
+
+#include <string.h>
+
+#include <atomic>
+
+#include "audio_format.h"
+#include "mem_policy.h"
+#include "metrics.h"
+
+// Four sends per frame period at most, so a backlog drains at four times
+// real time.
+#define OAI_PACER_MIN_GAP_US (MicFormat::kFrameUs / 4)
+
+typedef struct {
+  uint16_t len;
+  uint8_t data[MicFormat::kMaxPacketBytes];
+} pacer_slot_t;
+
+static pacer_slot_t *slots = NULL;
+static std::atomic<uint32_t> head{0};  // Next slot written, capture task
+static std::atomic<uint32_t> tail{0};  // Next slot sent, network task
+static int64_t last_send_us = 0;
+static int64_t last_poll_us = 0;
+
+void oai_pacer_init(void) {
+  if (slots == NULL) {
+    slots = (pacer_slot_t *)oai_mem_alloc(
+        OAI_MEM_PSRAM, OAI_PACER_SLOTS * sizeof(pacer_slot_t), "pacer");
+  }
+}
+
+size_t oai_pacer_space(void) {
+  if (slots == NULL) {
+    return 0;
+  }
+  return OAI_PACER_SLOTS - (head.load(std::memory_order_relaxed) -
+                            tail.load(std::memory_order_acquire));
+}
+
+bool oai_pacer_push(const uint8_t *packet, size_t len) {
+  if (oai_pacer_space() == 0 || len > MicFormat::kMaxPacketBytes) {
+    return false;
+  }
+  uint32_t at = head.load(std::memory_order_relaxed);
+  pacer_slot_t *slot = &slots[at % OAI_PACER_SLOTS];
+  slot->len = (uint16_t)len;
+  memcpy(slot->data, packet, len);
+  head.store(at + 1, std::memory_order_release);
+  return true;
+}
+
+size_t oai_pacer_poll(int64_t now_us, oai_pacer_send_fn send) {
+  int64_t since_poll = last_poll_us != 0 ? now_us - last_poll_us : 0;
+  last_poll_us = now_us;
+  uint32_t at = tail.load(std::memory_order_relaxed);
+  uint32_t waiting = head.load(std::memory_order_acquire) - at;
+  if (waiting == 0) {
+    return 0;
+  }
+  // One per gap of network loop time, so only a late poll sends several.
+  uint32_t due = (uint32_t)(since_poll / OAI_PACER_MIN_GAP_US);
+  if (due == 0 && now_us - last_send_us >= OAI_PACER_MIN_GAP_US) {
+    due = 1;
+  }
+  due = due < waiting ? due : waiting;
+  for (uint32_t i = 0; i < due; i++, at++) {
+    const pacer_slot_t *slot = &slots[at % OAI_PACER_SLOTS];
+    send(slot->data, slot->len);
+    tail.store(at + 1, std::memory_order_release);
+    if (last_send_us != 0) {
+      oai_metrics_histogram_observe(OAI_HISTOGRAM_AUDIO_TX_INTERVAL_US,
+                                    (uint32_t)(now_us - last_send_us));
+    }
+    last_send_us = now_us;
+  }
+  return due;
+}
+
+uint8_t oai_pacer_filler(const uint8_t *packet) { return packet[0] & 0xFC; }
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Uplink pacer. The capture task queues each encoded frame here instead of
+// sending it, and the network task hands frames to libpeer right before
+// peer_connection_loop() puts them on the wire: one per OAI_PACER_MIN_GAP_US
+// at most, so the frames a stalled capture task reads back to back from the
+// I2S DMA ring, or the pre-roll catching up, go out evenly spaced instead of
+// as a burst. The gap is counted in network loop time, so when the loop
+// itself runs late it sends the frames it owes at once and the backlog still
+// drains at four times real time. Frames that do not fit the
+// OAI_PACER_SLOTS wait in the pre-roll. audio_tx_interval_us records the
+// spacing.
+//
+// libpeer stamps each RTP packet one frame after the last, so RTP time
+// follows the capture clock as long as every captured frame becomes exactly
+// one packet; the capture task fills frames lost to an I2S overrun with
+// oai_pacer_filler().
+//
+// One producer (capture) and one consumer (network), no locks.
+
+#define OAI_PACER_SLOTS 8
+
+void oai_pacer_init(void);
+
+// Queues a copy of one frame. Returns false when the pacer is full.
+bool oai_pacer_push(const uint8_t *packet, size_t len);
+size_t oai_pacer_space(void);
+
+typedef void (*oai_pacer_send_fn)(const uint8_t *packet, size_t len);
+
+// Sends whatever is due. Call from the task that owns the peer connection.
+size_t oai_pacer_poll(int64_t now_us, oai_pacer_send_fn send);
+
+// A one byte Opus packet with the configuration of packet: a code 0 TOC and
+// no frame data, which decoders conceal like a lost frame.
+uint8_t oai_pacer_filler(const uint8_t *packet);
@@ -0,0 +1,122 @@
+#include "power.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <atomic>
+#include <mutex>
+
+#include "metrics.h"
+#include "sdkconfig.h"
+
+#ifndef LINUX_BUILD
+#include <driver/gpio.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <esp_wifi.h>
+#endif
+
+#define POWER_TAG "power"
+
+// Serialises profile switches; the hot paths only read the atomics.
+static std::mutex power_mutex;
+static std::atomic<int64_t> last_activity_us{0};
+static std::atomic<oai_power_profile_t> profile{OAI_POWER_ACTIVE};
+
+#if !defined(LINUX_BUILD) && defined(CONFIG_PM_ENABLE)
+// Both are held while ACTIVE: light sleep would add its wake-up time to every
+// inbound packet mid-conversation.
+static esp_pm_lock_handle_t cpu_lock = NULL;
+static esp_pm_lock_handle_t no_sleep_lock = NULL;
+#endif
+
+static void apply_profile(oai_power_profile_t next) {
+#if !defined(LINUX_BUILD) && defined(CONFIG_PM_ENABLE)
+  if (next == OAI_POWER_ACTIVE) {
+    esp_pm_lock_acquire(cpu_lock);
+    esp_pm_lock_acquire(no_sleep_lock);
+  } else {
+    esp_pm_lock_release(no_sleep_lock);
+    esp_pm_lock_release(cpu_lock);
+  }
+#endif
+#ifndef LINUX_BUILD
+  esp_wifi_set_ps(next == OAI_POWER_ACTIVE ? WIFI_PS_NONE : WIFI_PS_MIN_MODEM);
+#endif
+  profile.store(next);
+  oai_metrics_gauge_set(OAI_GAUGE_POWER_PROFILE, (int32_t)next);
+}
+
+void oai_power_init(void) {
+#if !defined(LINUX_BUILD) && defined(CONFIG_PM_ENABLE)
+  esp_pm_config_t config = {};
+  config.max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+  config.min_freq_mhz = CONFIG_OAI_POWER_IDLE_CPU_MHZ;
+#ifdef CONFIG_FREERTOS_USE_TICKLESS_IDLE
+  config.light_sleep_enable = true;
+#endif
+  esp_err_t err = esp_pm_configure(&config);
+  if (err != ESP_OK) {
+    ESP_LOGE(POWER_TAG, "esp_pm_configure: %s", esp_err_to_name(err));
+  }
+  esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "oai_active", &cpu_lock);
+  esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "oai_awake", &no_sleep_lock);
+  esp_pm_lock_acquire(cpu_lock);
+  esp_pm_lock_acquire(no_sleep_lock);
+
+  esp_sleep_enable_wifi_wakeup();
+#if CONFIG_OAI_POWER_WAKE_GPIO >= 0
+  gpio_wakeup_enable((gpio_num_t)CONFIG_OAI_POWER_WAKE_GPIO,
+                     GPIO_INTR_LOW_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+#endif
+#endif
+  last_activity_us.store(esp_timer_get_time());
+  oai_metrics_gauge_set(OAI_GAUGE_POWER_PROFILE, (int32_t)OAI_POWER_ACTIVE);
+}
+
+void oai_power_on_activity(int64_t now_us) {
+  last_activity_us.store(now_us, std::memory_order_relaxed);
+  if (profile.load(std::memory_order_relaxed) == OAI_POWER_ACTIVE) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(power_mutex);
+  if (profile.load() == OAI_POWER_ACTIVE) {
+    return;
+  }
+  apply_profile(OAI_POWER_ACTIVE);
+  oai_metrics_counter_add(OAI_COUNTER_POWER_WAKEUPS, 1);
+  oai_metrics_histogram_observe(OAI_HISTOGRAM_POWER_WAKE_US,
+                                (uint32_t)(esp_timer_get_time() - now_us));
+}
+
+void oai_power_on_mic_frame(uint32_t rms, int64_t now_us) {
+  if (rms >= CONFIG_OAI_POWER_VAD_RMS) {
+    oai_power_on_activity(now_us);
+  }
+}
+
+void oai_power_poll(int64_t now_us) {
+  if (CONFIG_OAI_POWER_IDLE_AFTER_MS == 0 ||
+      profile.load(std::memory_order_relaxed) == OAI_POWER_IDLE ||
+      now_us - last_activity_us.load(std::memory_order_relaxed) <
+          (int64_t)CONFIG_OAI_POWER_IDLE_AFTER_MS * 1000) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(power_mutex);
+  // Activity may have woken things up again since the check above.
+  if (profile.load() == OAI_POWER_IDLE ||
+      now_us - last_activity_us.load() <
+          (int64_t)CONFIG_OAI_POWER_IDLE_AFTER_MS * 1000) {
+    return;
+  }
+  ESP_LOGI(POWER_TAG, "Idle, dropping to %d MHz",
+           CONFIG_OAI_POWER_IDLE_CPU_MHZ);
+  apply_profile(OAI_POWER_IDLE);
+}
+
+oai_power_profile_t oai_power_profile(void) {
+  return profile.load(std::memory_order_relaxed);
+}
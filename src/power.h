@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+// Power profiles. ACTIVE holds the CPU at its maximum frequency and keeps the
+// Wi-Fi modem awake; after CONFIG_OAI_POWER_IDLE_AFTER_MS without speech on
+// the microphone or traffic from the server the device drops to IDLE, where
+// DFS lowers the CPU clock, the modem sleeps between beacons and automatic
+// light sleep is allowed whenever no driver holds it off. Speech, inbound
+// audio or a data channel message switch back to ACTIVE at once; the I2S DMA
+// ring keeps capturing meanwhile, so the resume never clips audio.
+typedef enum {
+  OAI_POWER_ACTIVE,
+  OAI_POWER_IDLE,
+} oai_power_profile_t;
+
+void oai_power_init(void);
+
+// Fed by the capture task with the level of each frame.
+void oai_power_on_mic_frame(uint32_t rms, int64_t now_us);
+// Fed by the network task for inbound audio, messages and state changes.
+void oai_power_on_activity(int64_t now_us);
+// Drops to IDLE once the idle timeout has passed. Call from the network loop.
+void oai_power_poll(int64_t now_us);
+
+oai_power_profile_t oai_power_profile(void);
@@ -0,0 +1,126 @@
+#include "preroll.h"
+
+#include <string.h>
+
+#include "audio_format.h"
+#include "mem_policy.h"
+#include "metrics.h"
+#include "sdkconfig.h"
+
+// Twice the 30 kbps encoder rate, so VBR peaks and the record headers fit.
+#define PREROLL_BYTES_PER_SECOND 8192
+#define PREROLL_RECORD_HEADER_SIZE 4  // u16 length, u16 level
+
+static uint8_t *ring = NULL;
+static size_t ring_size = 0;
+static size_t head = 0;  // Next byte written
+static size_t tail = 0;  // First byte of the oldest frame
+static size_t used = 0;
+static size_t frames = 0;
+
+void oai_preroll_init(void) {
+  if (CONFIG_OAI_PREROLL_MS == 0 || ring != NULL) {
+    return;
+  }
+  ring_size = (size_t)CONFIG_OAI_PREROLL_MS * PREROLL_BYTES_PER_SECOND / 1000;
+  ring = (uint8_t *)oai_mem_alloc(OAI_MEM_PSRAM, ring_size, "preroll");
+  if (ring == NULL) {
+    ring_size = 0;
+  }
+}
+
+static void ring_write(const void *src, size_t len) {
+  const uint8_t *p = (const uint8_t *)src;
+  size_t first = ring_size - head < len ? ring_size - head : len;
+  memcpy(ring + head, p, first);
+  memcpy(ring, p + first, len - first);
+  head = (head + len) % ring_size;
+  used += len;
+}
+
+static void ring_peek(size_t pos, void *dst, size_t len) {
+  uint8_t *p = (uint8_t *)dst;
+  pos %= ring_size;
+  size_t first = ring_size - pos < len ? ring_size - pos : len;
+  memcpy(p, ring + pos, first);
+  memcpy(p + first, ring, len - first);
+}
+
+// Size of the frame at pos, header included; level is optional.
+static size_t record_at(size_t pos, uint32_t *level) {
+  uint8_t header[PREROLL_RECORD_HEADER_SIZE];
+  ring_peek(pos, header, sizeof(header));
+  if (level != NULL) {
+    *level = header[2] | (header[3] << 8);
+  }
+  return sizeof(header) + (header[0] | (header[1] << 8));
+}
+
+static void drop_oldest(void) {
+  size_t size = record_at(tail, NULL);
+  tail = (tail + size) % ring_size;
+  used -= size;
+  frames--;
+}
+
+static void report_backlog(void) {
+  oai_metrics_gauge_set(OAI_GAUGE_PREROLL_BACKLOG_MS,
+                        (int32_t)(frames * MicFormat::kFrameMs));
+}
+
+void oai_preroll_push(const uint8_t *packet, size_t len, uint32_t level) {
+  size_t need = PREROLL_RECORD_HEADER_SIZE + len;
+  if (ring == NULL || need > ring_size) {
+    oai_metrics_counter_add(OAI_COUNTER_PREROLL_DROPPED, 1);
+    return;
+  }
+  while (used + need > ring_size) {
+    drop_oldest();
+    oai_metrics_counter_add(OAI_COUNTER_PREROLL_DROPPED, 1);
+  }
+  level = level > UINT16_MAX ? UINT16_MAX : level;
+  uint8_t header[PREROLL_RECORD_HEADER_SIZE] = {
+      (uint8_t)len, (uint8_t)(len >> 8), (uint8_t)level,
+      (uint8_t)(level >> 8)};
+  ring_write(header, sizeof(header));
+  ring_write(packet, len);
+  frames++;
+  report_backlog();
+}
+
+void oai_preroll_trim_silence(uint32_t level, size_t lead_in_frames) {
+  size_t pos = tail;
+  size_t quiet = 0;
+  for (; quiet < frames; quiet++) {
+    uint32_t frame_level;
+    size_t size = record_at(pos, &frame_level);
+    if (frame_level >= level) {
+      break;
+    }
+    pos = (pos + size) % ring_size;
+  }
+  size_t drop = quiet == frames            ? frames
+                : quiet > lead_in_frames ? quiet - lead_in_frames
+                                           : 0;
+  for (size_t i = 0; i < drop; i++) {
+    drop_oldest();
+  }
+  report_backlog();
+}
+
+size_t oai_preroll_pop(uint8_t *out, size_t len) {
+  if (frames == 0) {
+    return 0;
+  }
+  size_t size = record_at(tail, NULL) - PREROLL_RECORD_HEADER_SIZE;
+  if (size <= len) {
+    ring_peek(tail + PREROLL_RECORD_HEADER_SIZE, out, size);
+  } else {
+    size = 0;
+  }
+  drop_oldest();
+  report_backlog();
+  return size;
+}
+
+size_t oai_preroll_frames(void) { return frames; }
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Pre-roll for the uplink. The microphone runs from boot, and until the peer
+// connection is up each encoded Opus frame is kept in a PSRAM ring of about
+// CONFIG_OAI_PREROLL_MS, oldest dropped first. Once connected the backlog is
+// sent ahead of live frames at a few frames per capture period until it has
+// caught up, so whatever the user said while Wi-Fi, signaling and DTLS were
+// still coming up reaches the server in order. 0 ms disables it.
+//
+// Only the capture task touches the ring, so nothing is locked.
+
+void oai_preroll_init(void);
+
+// Appends one encoded frame and the level it was captured at.
+void oai_preroll_push(const uint8_t *packet, size_t len, uint32_t level);
+
+// Drops frames ahead of the first one at or above level, keeping up to
+// lead_in_frames before it so the onset is not clipped. Without any such
+// frame the ring is emptied.
+void oai_preroll_trim_silence(uint32_t level, size_t lead_in_frames);
+
+// Moves the oldest frame into out and returns its size, or 0 when empty.
+size_t oai_preroll_pop(uint8_t *out, size_t len);
+
+size_t oai_preroll_frames(void);
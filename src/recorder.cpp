@@ -0,0 +1,233 @@
+#include "recorder.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <string.h>
+
+#include <mutex>
+
+#include "mem_policy.h"
+#include "metrics.h"
+#include "sdkconfig.h"
+
+#ifdef LINUX_BUILD
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+#define RECORDER_TAG "recorder"
+#define RECORDER_HTTP_CHUNK_SIZE 1024
+
+static std::mutex ring_mutex;
+static uint8_t *ring = NULL;
+static size_t ring_size = 0;
+static size_t head = 0;  // Next byte written
+static size_t tail = 0;  // First byte of the oldest record
+static size_t used = 0;
+static int64_t last_record_us = 0;
+static bool paused = false;
+
+void oai_recorder_init(void) {
+  if (CONFIG_OAI_RECORDER_KB == 0 || ring != NULL) {
+    return;
+  }
+  ring_size = CONFIG_OAI_RECORDER_KB * 1024;
+  ring = (uint8_t *)oai_mem_alloc(OAI_MEM_PSRAM, ring_size, "recorder");
+  if (ring == NULL) {
+    ring_size = 0;
+  }
+}
+
+static void ring_write(const void *src, size_t len) {
+  const uint8_t *p = (const uint8_t *)src;
+  size_t first = ring_size - head < len ? ring_size - head : len;
+  memcpy(ring + head, p, first);
+  memcpy(ring, p + first, len - first);
+  head = (head + len) % ring_size;
+  used += len;
+}
+
+static void ring_peek(size_t pos, void *dst, size_t len) {
+  uint8_t *p = (uint8_t *)dst;
+  pos %= ring_size;
+  size_t first = ring_size - pos < len ? ring_size - pos : len;
+  memcpy(p, ring + pos, first);
+  memcpy(p + first, ring, len - first);
+}
+
+void oai_recorder_record(oai_record_type_t type, const void *data,
+                         size_t len) {
+  if (ring == NULL) {
+    return;
+  }
+  size_t need = OAI_RECORDER_RECORD_HEADER_SIZE + len;
+  if (len > UINT16_MAX || need > ring_size) {
+    oai_metrics_counter_add(OAI_COUNTER_RECORDER_DROPPED, 1);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(ring_mutex);
+  if (paused) {
+    oai_metrics_counter_add(OAI_COUNTER_RECORDER_DROPPED, 1);
+    return;
+  }
+  while (used + need > ring_size) {
+    uint8_t old[OAI_RECORDER_RECORD_HEADER_SIZE];
+    ring_peek(tail, old, sizeof(old));
+    size_t old_size = sizeof(old) + (old[1] | (old[2] << 8));
+    tail = (tail + old_size) % ring_size;
+    used -= old_size;
+  }
+
+  int64_t now = esp_timer_get_time();
+  int64_t delta = last_record_us == 0 ? 0 : now - last_record_us;
+  if (delta > UINT32_MAX) {
+    delta = UINT32_MAX;
+  }
+  last_record_us = now;
+
+  uint8_t header[OAI_RECORDER_RECORD_HEADER_SIZE] = {
+      (uint8_t)type,           (uint8_t)len,
+      (uint8_t)(len >> 8),     (uint8_t)delta,
+      (uint8_t)(delta >> 8),   (uint8_t)(delta >> 16),
+      (uint8_t)(delta >> 24),
+  };
+  ring_write(header, sizeof(header));
+  ring_write(data, len);
+}
+
+size_t oai_recorder_read(size_t offset, uint8_t *out, size_t len) {
+  static const uint8_t header[OAI_RECORDER_HEADER_SIZE] = {
+      'O', 'A', 'I', 'R', OAI_RECORDER_VERSION, 0, 0, 0};
+
+  std::lock_guard<std::mutex> lock(ring_mutex);
+  if (offset == 0) {
+    paused = true;
+  }
+  size_t total = sizeof(header) + used;
+  if (offset >= total) {
+    return 0;
+  }
+  if (len > total - offset) {
+    len = total - offset;
+  }
+
+  size_t copied = 0;
+  if (offset < sizeof(header)) {
+    copied = sizeof(header) - offset < len ? sizeof(header) - offset : len;
+    memcpy(out, header + offset, copied);
+  }
+  if (copied < len) {
+    ring_peek(tail + offset + copied - sizeof(header), out + copied,
+              len - copied);
+  }
+  return len;
+}
+
+void oai_recorder_read_done(void) {
+  std::lock_guard<std::mutex> lock(ring_mutex);
+  paused = false;
+}
+
+#ifndef LINUX_BUILD
+static esp_err_t recording_get_handler(httpd_req_t *req) {
+  // httpd serves requests from a single task, so one buffer is enough.
+  static uint8_t chunk[RECORDER_HTTP_CHUNK_SIZE];
+  httpd_resp_set_type(req, "application/octet-stream");
+  httpd_resp_set_hdr(req, "Content-Disposition",
+                     "attachment; filename=\"session.oair\"");
+
+  esp_err_t err = ESP_OK;
+  size_t offset = 0;
+  size_t len;
+  while (err == ESP_OK &&
+         (len = oai_recorder_read(offset, chunk, sizeof(chunk))) > 0) {
+    err = httpd_resp_send_chunk(req, (const char *)chunk, len);
+    offset += len;
+  }
+  oai_recorder_read_done();
+  if (err == ESP_OK) {
+    err = httpd_resp_send_chunk(req, NULL, 0);
+  }
+  return err;
+}
+
+static const httpd_uri_t recording_uri = {
+    .uri = "/recording",
+    .method = HTTP_GET,
+    .handler = recording_get_handler,
+    .user_ctx = NULL,
+};
+
+void oai_recorder_register_http(httpd_handle_t server) {
+  if (server != NULL && ring != NULL) {
+    httpd_register_uri_handler(server, &recording_uri);
+  }
+}
+#else
+bool oai_replay_file(const char *path, float speed,
+                     const oai_replay_handlers_t *handlers) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    ESP_LOGE(RECORDER_TAG, "Can not open %s", path);
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  uint8_t *capture = (uint8_t *)malloc(size > 0 ? size : 1);
+  bool ok = capture != NULL && size >= OAI_RECORDER_HEADER_SIZE &&
+            fread(capture, 1, size, file) == (size_t)size &&
+            memcmp(capture, OAI_RECORDER_MAGIC, 4) == 0 &&
+            capture[4] == OAI_RECORDER_VERSION;
+  fclose(file);
+  if (!ok) {
+    ESP_LOGE(RECORDER_TAG, "%s is not a version %d capture", path,
+             OAI_RECORDER_VERSION);
+    free(capture);
+    return false;
+  }
+
+  // The message handler expects a NUL terminated string.
+  static char message[UINT16_MAX + 1];
+  size_t records = 0;
+  size_t pos = OAI_RECORDER_HEADER_SIZE;
+  int64_t start = esp_timer_get_time();
+  while (pos + OAI_RECORDER_RECORD_HEADER_SIZE <= (size_t)size) {
+    const uint8_t *h = capture + pos;
+    size_t len = h[1] | (h[2] << 8);
+    uint32_t delta = h[3] | (h[4] << 8) | (h[5] << 16) | ((uint32_t)h[6] << 24);
+    const uint8_t *payload = h + OAI_RECORDER_RECORD_HEADER_SIZE;
+    pos += OAI_RECORDER_RECORD_HEADER_SIZE + len;
+    if (pos > (size_t)size) {
+      ESP_LOGW(RECORDER_TAG, "Truncated record at the end of %s", path);
+      break;
+    }
+    if (speed > 0 && records > 0) {
+      usleep((useconds_t)(delta / speed));
+    }
+
+    switch (h[0]) {
+      case OAI_RECORD_AUDIO_RX:
+        handlers->on_audio(payload, len);
+        break;
+      case OAI_RECORD_DATACHANNEL_RX:
+        memcpy(message, payload, len);
+        message[len] = '\0';
+        handlers->on_message(message, len);
+        break;
+      case OAI_RECORD_PEER_STATE:
+        if (len == 1) {
+          handlers->on_state(payload[0]);
+        }
+        break;
+    }
+    records++;
+  }
+  ESP_LOGI(RECORDER_TAG, "Replayed %u records in %lld ms", (unsigned)records,
+           (long long)((esp_timer_get_time() - start) / 1000));
+  free(capture);
+  return true;
+}
+#endif
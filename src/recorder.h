@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef LINUX_BUILD
+#include "esp_http_server.h"
+#endif
+
+// Flight recorder for field diagnosis. Inbound Opus packets, data channel
+// messages and connection state changes are copied with their arrival times
+// into a PSRAM ring of CONFIG_OAI_RECORDER_KB, overwriting the oldest records
+// once full. Recording is a short memcpy under a lock, so the network loop
+// never waits on storage. 0 KB disables it.
+//
+// A capture is the header followed by records, oldest first:
+//
+//   header  "OAIR" u8 version u8[3] reserved
+//   record  u8 type  u16 length  u32 microseconds since the previous record
+//           then length bytes of payload
+//
+// All integers are little endian.
+
+#define OAI_RECORDER_MAGIC "OAIR"
+#define OAI_RECORDER_VERSION 1
+#define OAI_RECORDER_HEADER_SIZE 8
+#define OAI_RECORDER_RECORD_HEADER_SIZE 7
+
+typedef enum {
+  OAI_RECORD_AUDIO_RX = 1,  // One Opus packet from the remote track
+  OAI_RECORD_DATACHANNEL_RX,  // One oai-events message, without the NUL
+  OAI_RECORD_PEER_STATE,      // One byte of PeerConnectionState
+} oai_record_type_t;
+
+void oai_recorder_init(void);
+void oai_recorder_record(oai_record_type_t type, const void *data, size_t len);
+
+// Copies the capture into out starting at offset and returns the bytes
+// copied, 0 at the end. Recording is paused from the first call at offset 0
+// until oai_recorder_read_done(), so the copy is consistent.
+size_t oai_recorder_read(size_t offset, uint8_t *out, size_t len);
+void oai_recorder_read_done(void);
+
+#ifndef LINUX_BUILD
+// Serves the capture as application/octet-stream on GET /recording.
+void oai_recorder_register_http(httpd_handle_t server);
+#else
+typedef struct {
+  void (*on_audio)(const uint8_t *data, size_t len);
+  void (*on_message)(const char *msg, size_t len);
+  void (*on_state)(int state);
+} oai_replay_handlers_t;
+
+// Feeds a capture file back through the handlers, sleeping between records
+// to reproduce the original timing divided by speed; speed 0 replays as fast
+// as possible. Returns false if the file can not be read.
+bool oai_replay_file(const char *path, float speed,
+                     const oai_replay_handlers_t *handlers);
+#endif
@@ -0,0 +1,345 @@
+#include "send_queue.h"
+
+#include <esp_log.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <mutex>
+
+#include "mem_policy.h"
+#include "metrics.h"
+
+#define SEND_QUEUE_TAG "send_queue"
+
+typedef struct {
+  bool used;
+  bool in_flight;
+  oai_send_priority_t priority;
+  uint32_t seq;
+  const char *key;
+  size_t len;
+  char *data;
+} slot_t;
+
+static std::mutex queue_mutex;
+static slot_t slots[OAI_SEND_QUEUE_SLOTS];
+static uint32_t next_seq = 0;
+static oai_send_fn_t send_fn = NULL;
+
+// Only touched by oai_send_queue_flush()
+static int64_t tokens = OAI_SEND_QUEUE_BURST_BYTES;
+static int64_t last_refill_us = 0;
+
+void oai_send_queue_init(oai_send_fn_t send) {
+  std::lock_guard<std::mutex> lock(queue_mutex);
+  send_fn = send;
+  if (slots[0].data != NULL) {
+    return;
+  }
+  char *pool = (char *)oai_mem_alloc(
+      OAI_MEM_PSRAM, OAI_SEND_QUEUE_SLOTS * OAI_SEND_QUEUE_SLOT_SIZE,
+      "send queue");
+  if (pool == NULL) {
+    return;
+  }
+  for (int i = 0; i < OAI_SEND_QUEUE_SLOTS; i++) {
+    slots[i].data = pool + i * OAI_SEND_QUEUE_SLOT_SIZE;
+  }
+}
+
+static size_t depth_locked(void) {
+  size_t depth = 0;
+  for (int i = 0; i < OAI_SEND_QUEUE_SLOTS; i++) {
+    depth += slots[i].used;
+  }
+  return depth;
+}
+
+// Oldest waiting message of the lowest class present, or NULL.
+static slot_t *eviction_candidate(void) {
+  slot_t *victim = NULL;
+  for (int i = 0; i < OAI_SEND_QUEUE_SLOTS; i++) {
+    slot_t *s = &slots[i];
+    if (!s->used || s->in_flight) {
+      continue;
+    }
+    if (victim == NULL || s->priority > victim->priority ||
+        (s->priority == victim->priority && s->seq < victim->seq)) {
+      victim = s;
+    }
+  }
+  return victim;
+}
+
+bool oai_send_queue_push(oai_send_priority_t priority, const char *data,
+                         size_t len, const char *coalesce_key) {
+  if (len > OAI_SEND_QUEUE_SLOT_SIZE) {
+    ESP_LOGE(SEND_QUEUE_TAG, "%u byte message does not fit in a slot",
+             (unsigned)len);
+    oai_metrics_counter_add(OAI_COUNTER_SEND_QUEUE_DROPPED, 1);
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(queue_mutex);
+  if (slots[0].data == NULL) {
+    return false;
+  }
+
+  slot_t *slot = NULL;
+  if (coalesce_key != NULL) {
+    for (int i = 0; i < OAI_SEND_QUEUE_SLOTS && slot == NULL; i++) {
+      slot_t *s = &slots[i];
+      if (s->used && !s->in_flight && s->key != NULL &&
+          strcmp(s->key, coalesce_key) == 0) {
+        slot = s;
+        oai_metrics_counter_add(OAI_COUNTER_SEND_QUEUE_COALESCED, 1);
+      }
+    }
+  }
+
+  for (int i = 0; i < OAI_SEND_QUEUE_SLOTS && slot == NULL; i++) {
+    if (!slots[i].used) {
+      slot = &slots[i];
+      slot->seq = next_seq++;
+    }
+  }
+
+  if (slot == NULL) {
+    slot_t *victim = eviction_candidate();
+    if (victim == NULL || victim->priority < priority ||
+        (victim->priority == priority && priority != OAI_SEND_BULK)) {
+      oai_metrics_counter_add(OAI_COUNTER_SEND_QUEUE_DROPPED, 1);
+      return false;
+    }
+    oai_metrics_counter_add(OAI_COUNTER_SEND_QUEUE_DROPPED, 1);
+    slot = victim;
+    slot->seq = next_seq++;
+  }
+
+  slot->used = true;
+  slot->priority = priority;
+  slot->key = coalesce_key;
+  slot->len = len;
+  memcpy(slot->data, data, len);
+  oai_metrics_gauge_set(OAI_GAUGE_SEND_QUEUE_DEPTH, (int32_t)depth_locked());
+  return true;
+}
+
+size_t oai_send_queue_flush(int64_t now_us) {
+  if (last_refill_us != 0) {
+    tokens += (now_us - last_refill_us) * OAI_SEND_QUEUE_RATE_BYTES_PER_SEC /
+              1000000;
+    if (tokens > OAI_SEND_QUEUE_BURST_BYTES) {
+      tokens = OAI_SEND_QUEUE_BURST_BYTES;
+    }
+  }
+  last_refill_us = now_us;
+
+  size_t sent = 0;
+  std::unique_lock<std::mutex> lock(queue_mutex);
+  while (send_fn != NULL) {
+    slot_t *next = NULL;
+    for (int i = 0; i < OAI_SEND_QUEUE_SLOTS; i++) {
+      slot_t *s = &slots[i];
+      if (s->used && !s->in_flight &&
+          (next == NULL || s->priority < next->priority ||
+           (s->priority == next->priority && s->seq < next->seq))) {
+        next = s;
+      }
+    }
+    // Control messages may overdraw the budget; everything else waits.
+    if (next == NULL ||
+        (next->priority != OAI_SEND_CONTROL && tokens < (int64_t)next->len)) {
+      break;
+    }
+
+    // The slot is pinned while unlocked so pushes can neither coalesce into
+    // it nor evict it.
+    next->in_flight = true;
+    lock.unlock();
+    int rc = send_fn(next->data, next->len);
+    lock.lock();
+    next->in_flight = false;
+    if (rc < 0) {
+      break;
+    }
+
+    tokens -= next->len;
+    next->used = false;
+    next->key = NULL;
+    sent++;
+    oai_metrics_counter_add(OAI_COUNTER_DATACHANNEL_TX, 1);
+  }
+  oai_metrics_gauge_set(OAI_GAUGE_SEND_QUEUE_DEPTH, (int32_t)depth_locked());
+  return sent;
+}
+
+void oai_send_queue_clear(void) {
+  std::lock_guard<std::mutex> lock(queue_mutex);
+  for (int i = 0; i < OAI_SEND_QUEUE_SLOTS; i++) {
+    if (!slots[i].in_flight) {
+      slots[i].used = false;
+      slots[i].key = NULL;
+    }
+  }
+  oai_metrics_gauge_set(OAI_GAUGE_SEND_QUEUE_DEPTH, (int32_t)depth_locked());
+}
+
+size_t oai_send_queue_depth(void) {
+  std::lock_guard<std::mutex> lock(queue_mutex);
+  return depth_locked();
+}
+
+#ifdef LINUX_BUILD
+/**********************
+ * Stand-in peer
+ **********************/
+#define SELFTEST_MESSAGE_SIZE 64
+#define SELFTEST_STEP_US (10 * 1000)
+#define SELFTEST_DURATION_US (10 * 1000 * 1000)
+
+static bool peer_refusing = false;
+static char sent_order[256];
+static size_t sent_bytes = 0;
+static bool selftest_ok = true;
+
+// Messages named by the test start with the name, e.g. "c0", padded with
+// spaces; the order they go out in is kept in sent_order.
+static int selftest_send(const char *data, size_t len) {
+  if (peer_refusing) {
+    return -1;
+  }
+  const char *end = (const char *)memchr(data, ' ', len);
+  if (end != NULL) {
+    size_t used = strlen(sent_order);
+    snprintf(sent_order + used, sizeof(sent_order) - used, "%.*s ",
+             (int)(end - data), data);
+  }
+  sent_bytes += len;
+  return (int)len;
+}
+
+static void selftest_push(oai_send_priority_t priority, const char *name,
+                          const char *key, bool expect) {
+  char message[SELFTEST_MESSAGE_SIZE];
+  memset(message, ' ', sizeof(message));
+  memcpy(message, name, strlen(name));
+  if (oai_send_queue_push(priority, message, sizeof(message), key) != expect) {
+    ESP_LOGE(SEND_QUEUE_TAG, "Push of %s %s", name,
+             expect ? "refused" : "accepted");
+    selftest_ok = false;
+  }
+}
+
+static void selftest_check(bool ok, const char *what) {
+  if (!ok) {
+    ESP_LOGE(SEND_QUEUE_TAG, "%s", what);
+    selftest_ok = false;
+  }
+}
+
+static void selftest_reset(void) {
+  oai_send_queue_clear();
+  tokens = OAI_SEND_QUEUE_BURST_BYTES;
+  last_refill_us = 0;
+  sent_order[0] = '\0';
+  sent_bytes = 0;
+}
+
+bool oai_send_queue_selftest(void) {
+  selftest_ok = true;
+  oai_send_queue_init(selftest_send);
+  selftest_reset();
+
+  // Every slot taken, classes interleaved, while the peer refuses
+  peer_refusing = true;
+  selftest_push(OAI_SEND_BULK, "b0", NULL, true);
+  selftest_push(OAI_SEND_BULK, "b1", NULL, true);
+  selftest_push(OAI_SEND_NORMAL, "nX", "session.update", true);
+  selftest_push(OAI_SEND_CONTROL, "c0", NULL, true);
+  selftest_push(OAI_SEND_BULK, "b2", NULL, true);
+  selftest_push(OAI_SEND_NORMAL, "n1", NULL, true);
+  selftest_push(OAI_SEND_NORMAL, "n2", NULL, true);
+  selftest_push(OAI_SEND_BULK, "b3", NULL, true);
+  selftest_push(OAI_SEND_NORMAL, "n3", NULL, true);
+  selftest_push(OAI_SEND_CONTROL, "c1", NULL, true);
+  selftest_push(OAI_SEND_NORMAL, "n4", NULL, true);
+  selftest_push(OAI_SEND_NORMAL, "n5", NULL, true);
+  selftest_check(oai_send_queue_depth() == OAI_SEND_QUEUE_SLOTS,
+                 "Queue did not fill");
+  selftest_check(oai_send_queue_flush(1000 * 1000) == 0 &&
+                     oai_send_queue_depth() == OAI_SEND_QUEUE_SLOTS,
+                 "Refused sends left the queue");
+
+  // The replacement keeps nX's place; nothing is evicted for it
+  uint32_t coalesced =
+      oai_metrics_counter_get(OAI_COUNTER_SEND_QUEUE_COALESCED);
+  uint32_t dropped = oai_metrics_counter_get(OAI_COUNTER_SEND_QUEUE_DROPPED);
+  selftest_push(OAI_SEND_NORMAL, "n0", "session.update", true);
+  selftest_check(
+      oai_metrics_counter_get(OAI_COUNTER_SEND_QUEUE_COALESCED) ==
+          coalesced + 1,
+      "Same key did not coalesce");
+
+  // Full: b0, b1 and b2 go in that order, control and normal never do
+  selftest_push(OAI_SEND_NORMAL, "n6", NULL, true);
+  selftest_push(OAI_SEND_CONTROL, "c2", NULL, true);
+  selftest_push(OAI_SEND_BULK, "b4", NULL, true);
+  selftest_check(
+      oai_metrics_counter_get(OAI_COUNTER_SEND_QUEUE_DROPPED) == dropped + 3,
+      "Evictions not counted");
+  selftest_check(oai_send_queue_depth() == OAI_SEND_QUEUE_SLOTS,
+                 "Eviction changed the depth");
+
+  peer_refusing = false;
+  oai_send_queue_flush(1000 * 1000 + SELFTEST_STEP_US);
+  const char *expected = "c0 c1 c2 n0 n1 n2 n3 n4 n5 n6 b3 b4 ";
+  if (strcmp(sent_order, expected) != 0) {
+    ESP_LOGE(SEND_QUEUE_TAG, "Sent %s, expected %s", sent_order, expected);
+    selftest_ok = false;
+  }
+
+  // Saturated: the queue is topped up with full slots every step, so only
+  // the budget limits what goes out.
+  selftest_reset();
+  static char full_slot[OAI_SEND_QUEUE_SLOT_SIZE];
+  memset(full_slot, 'x', sizeof(full_slot));
+  int64_t start_us = 1000 * 1000;
+  int64_t now_us = start_us;
+  for (; now_us <= start_us + SELFTEST_DURATION_US;
+       now_us += SELFTEST_STEP_US) {
+    while (oai_send_queue_depth() < OAI_SEND_QUEUE_SLOTS) {
+      oai_send_queue_push(OAI_SEND_NORMAL, full_slot, sizeof(full_slot), NULL);
+    }
+    oai_send_queue_flush(now_us);
+  }
+  int64_t budget = OAI_SEND_QUEUE_BURST_BYTES +
+                   (int64_t)OAI_SEND_QUEUE_RATE_BYTES_PER_SEC *
+                       SELFTEST_DURATION_US / 1000000;
+  // Short of the budget by less than a message, plus refill rounding
+  if ((int64_t)sent_bytes > budget ||
+      (int64_t)sent_bytes < budget - 2 * OAI_SEND_QUEUE_SLOT_SIZE) {
+    ESP_LOGE(SEND_QUEUE_TAG, "Sent %u bytes in %d s, budget %u",
+             (unsigned)sent_bytes, SELFTEST_DURATION_US / 1000000,
+             (unsigned)budget);
+    selftest_ok = false;
+  }
+
+  size_t saturated_bytes = sent_bytes;
+
+  // With the budget spent, control still goes out
+  selftest_push(OAI_SEND_CONTROL, "c3", NULL, true);
+  sent_order[0] = '\0';
+  oai_send_queue_flush(now_us);
+  selftest_check(strncmp(sent_order, "c3 ", 3) == 0,
+                 "Control held back by the budget");
+
+  ESP_LOGI(SEND_QUEUE_TAG, "%s: %u bytes in %d s at %d B/s, burst %d",
+           selftest_ok ? "PASS" : "FAIL", (unsigned)saturated_bytes,
+           SELFTEST_DURATION_US / 1000000, OAI_SEND_QUEUE_RATE_BYTES_PER_SEC,
+           OAI_SEND_QUEUE_BURST_BYTES);
+  selftest_reset();
+  oai_send_queue_init(NULL);
+  return selftest_ok;
+}
+#endif
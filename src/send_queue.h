@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Outbound data-channel queue. Messages are copied into a fixed pool of slots
+// and drained from the webrtc loop in priority order, oldest first within a
+// class. libpeer does not report the SCTP buffered amount, so backpressure is
+// a byte budget refilled at OAI_SEND_QUEUE_RATE_BYTES_PER_SEC; a send the
+// peer refuses stays queued and is retried on the next flush.
+
+typedef enum {
+  OAI_SEND_CONTROL,  // Cancels, truncates, liveness probes
+  OAI_SEND_NORMAL,   // Session updates, tool results
+  OAI_SEND_BULK,     // Metrics and other droppable telemetry
+  OAI_SEND_PRIORITY_MAX,
+} oai_send_priority_t;
+
+#define OAI_SEND_QUEUE_SLOTS 12
+#define OAI_SEND_QUEUE_SLOT_SIZE 2048
+
+#ifndef OAI_SEND_QUEUE_RATE_BYTES_PER_SEC
+#define OAI_SEND_QUEUE_RATE_BYTES_PER_SEC (32 * 1024)
+#endif
+#ifndef OAI_SEND_QUEUE_BURST_BYTES
+#define OAI_SEND_QUEUE_BURST_BYTES (16 * 1024)
+#endif
+
+// Returns a negative value when the peer can not take the message now.
+typedef int (*oai_send_fn_t)(const char *data, size_t len);
+
+void oai_send_queue_init(oai_send_fn_t send);
+
+// Queues a copy of data. With a coalesce_key, a message with the same key
+// that is still waiting is overwritten in place instead, keeping its position
+// in the queue; the key is kept by pointer, so pass a string literal. When
+// the pool is full the oldest message of a lower class (or an older bulk
+// message) is dropped to make room. Returns false if nothing could be dropped
+// or the message does not fit in a slot.
+bool oai_send_queue_push(oai_send_priority_t priority, const char *data,
+                         size_t len, const char *coalesce_key);
+
+// Sends as much as the budget allows and returns the number of messages sent.
+// Call from the task that owns the peer connection.
+size_t oai_send_queue_flush(int64_t now_us);
+
+// Drops everything waiting, e.g. when the session is replaced.
+void oai_send_queue_clear(void);
+size_t oai_send_queue_depth(void);
+
+#ifdef LINUX_BUILD
+// Stand-in for a saturated peer: fills every slot while the peer refuses
+// sends and checks that same-key messages coalesce in place, that the oldest
+// message of the lowest class is evicted first and that control goes out
+// ahead of normal and bulk once the peer takes them. Then keeps the queue
+// full for ten simulated seconds and checks the bytes sent against the token
+// bucket. Returns false on any mismatch.
+bool oai_send_queue_selftest(void);
+#endif
@@ -0,0 +1,144 @@
+#include "session_config.h"
+
+#include <esp_log.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json_escape.h"
+#include "sdkconfig.h"
+#include "tools.h"
+
+#ifndef LINUX_BUILD
+#include "wifi_config.h"
+#endif
+
+#define SESSION_CONFIG_TAG "session_config"
+#define SESSION_UPDATE_BUFFER_SIZE 2048
+#define SESSION_GREETING_BUFFER_SIZE (2 * OAI_SESSION_GREETING_SIZE + 128)
+
+// Instructions are omitted entirely when empty so the server keeps its own
+// default rather than being told to follow nothing.
+#define SESSION_UPDATE_TEMPLATE                                             \
+  "{\"type\":\"session.update\",\"session\":{\"voice\":\"%s\",%s%s%s"      \
+  "\"turn_detection\":{\"type\":\"server_vad\",\"threshold\":%u.%03u,"     \
+  "\"prefix_padding_ms\":%u,\"silence_duration_ms\":%u},"                  \
+  "\"tool_choice\":\"auto\",\"tools\":"
+#define SESSION_GREETING_TEMPLATE                                      \
+  "{\"type\":\"response.create\",\"response\":{\"modalities\":"        \
+  "[\"audio\",\"text\"],\"instructions\":\"%s\"}}"
+
+static const char *const SESSION_VOICES[] = {
+    "alloy", "ash", "ballad", "coral", "echo", "sage", "shimmer", "verse",
+};
+
+static oai_session_config_t config;
+static char update_event[SESSION_UPDATE_BUFFER_SIZE];
+static size_t update_event_len = 0;
+static char greeting_event[SESSION_GREETING_BUFFER_SIZE];
+static size_t greeting_event_len = 0;
+
+static void set_defaults(oai_session_config_t *c) {
+  memset(c, 0, sizeof(*c));
+  strncpy(c->model, CONFIG_OAI_REALTIME_MODEL, sizeof(c->model) - 1);
+  strncpy(c->voice, CONFIG_OAI_SESSION_VOICE, sizeof(c->voice) - 1);
+  strncpy(c->instructions, CONFIG_OAI_SESSION_INSTRUCTIONS,
+          sizeof(c->instructions) - 1);
+  strncpy(c->greeting, CONFIG_OAI_SESSION_GREETING, sizeof(c->greeting) - 1);
+  c->vad_threshold_permille = CONFIG_OAI_SESSION_VAD_THRESHOLD;
+  c->prefix_padding_ms = CONFIG_OAI_SESSION_PREFIX_PADDING_MS;
+  c->silence_duration_ms = CONFIG_OAI_SESSION_SILENCE_DURATION_MS;
+}
+
+static size_t render_update(void) {
+  char voice[2 * OAI_SESSION_VOICE_SIZE];
+  if (!oai_json_escape(voice, sizeof(voice), config.voice)) {
+    return 0;
+  }
+  char instructions[2 * OAI_SESSION_INSTRUCTIONS_SIZE];
+  if (!oai_json_escape(instructions, sizeof(instructions), config.instructions)) {
+    ESP_LOGE(SESSION_CONFIG_TAG, "Instructions too long, dropping them");
+    instructions[0] = '\0';
+  }
+  bool has_instructions = instructions[0] != '\0';
+  uint16_t threshold = config.vad_threshold_permille > 1000
+                           ? 1000
+                           : config.vad_threshold_permille;
+
+  size_t len = sizeof(update_event);
+  int n = snprintf(update_event, len, SESSION_UPDATE_TEMPLATE, voice,
+                   has_instructions ? "\"instructions\":\"" : "",
+                   instructions, has_instructions ? "\"," : "",
+                   threshold / 1000, threshold % 1000,
+                   config.prefix_padding_ms, config.silence_duration_ms);
+  if (n < 0 || (size_t)n >= len) {
+    return 0;
+  }
+  size_t tools_len = oai_tools_declarations(update_event + n, len - n);
+  if (tools_len == 0) {
+    return 0;
+  }
+  n += tools_len;
+  if ((size_t)n + 2 >= len) {
+    return 0;
+  }
+  memcpy(update_event + n, "}}", 3);
+  return n + 2;
+}
+
+static size_t render_greeting(void) {
+  if (config.greeting[0] == '\0') {
+    return 0;
+  }
+  char greeting[2 * OAI_SESSION_GREETING_SIZE];
+  if (!oai_json_escape(greeting, sizeof(greeting), config.greeting)) {
+    return 0;
+  }
+  int n = snprintf(greeting_event, sizeof(greeting_event),
+                   SESSION_GREETING_TEMPLATE, greeting);
+  return n > 0 && (size_t)n < sizeof(greeting_event) ? n : 0;
+}
+
+void oai_session_config_load(void) {
+  set_defaults(&config);
+#ifndef LINUX_BUILD
+  read_session_config_from_nvs(&config);
+#endif
+  if (!oai_session_voice_valid(config.voice)) {
+    ESP_LOGW(SESSION_CONFIG_TAG, "Unknown voice %s, using %s", config.voice,
+             CONFIG_OAI_SESSION_VOICE);
+    memset(config.voice, 0, sizeof(config.voice));
+    strncpy(config.voice, CONFIG_OAI_SESSION_VOICE, sizeof(config.voice) - 1);
+  }
+
+  update_event_len = render_update();
+  if (update_event_len == 0) {
+    ESP_LOGE(SESSION_CONFIG_TAG, "session.update does not fit in %d bytes",
+             SESSION_UPDATE_BUFFER_SIZE);
+  }
+  greeting_event_len = render_greeting();
+  ESP_LOGI(SESSION_CONFIG_TAG,
+           "model=%s voice=%s vad=%u prefix=%ums silence=%ums", config.model,
+           config.voice, config.vad_threshold_permille,
+           config.prefix_padding_ms, config.silence_duration_ms);
+}
+
+const oai_session_config_t *oai_session_config_get(void) { return &config; }
+
+bool oai_session_voice_valid(const char *voice) {
+  for (const char *name : SESSION_VOICES) {
+    if (strcmp(voice, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t oai_session_config_update_event(const char **event) {
+  *event = update_event;
+  return update_event_len;
+}
+
+size_t oai_session_config_greeting_event(const char **event) {
+  *event = greeting_event;
+  return greeting_event_len;
+}
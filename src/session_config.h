@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-device session settings. Defaults come from Kconfig and are overridden
+// by whatever is stored in the "session_config" NVS namespace (written from
+// the provisioning page), so turn detection can be tuned per deployment
+// without reflashing. Linux builds use the Kconfig defaults only.
+
+#define OAI_SESSION_MODEL_SIZE 64
+#define OAI_SESSION_VOICE_SIZE 16
+#define OAI_SESSION_INSTRUCTIONS_SIZE 256
+#define OAI_SESSION_GREETING_SIZE 128
+
+typedef struct {
+  char model[OAI_SESSION_MODEL_SIZE];
+  char voice[OAI_SESSION_VOICE_SIZE];
+  char instructions[OAI_SESSION_INSTRUCTIONS_SIZE];
+  // Instructions for the first response of a boot, empty for no greeting
+  char greeting[OAI_SESSION_GREETING_SIZE];
+  uint16_t vad_threshold_permille;  // Server VAD activation, 0 - 1000
+  uint16_t prefix_padding_ms;
+  uint16_t silence_duration_ms;
+} oai_session_config_t;
+
+// Loads the configuration and renders the session.update and greeting events
+// into their preallocated buffers. Call once before the data channel opens.
+void oai_session_config_load(void);
+const oai_session_config_t *oai_session_config_get(void);
+
+// Whether voice is one the Realtime API accepts. A stored voice that is not
+// falls back to the Kconfig default when the configuration is loaded.
+bool oai_session_voice_valid(const char *voice);
+
+// Prerendered client events. Each returns the length, or 0 when there is
+// nothing to send.
+size_t oai_session_config_update_event(const char **event);
+size_t oai_session_config_greeting_event(const char **event);
@@ -0,0 +1,205 @@
+#include "srtp_cipher.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <mbedtls/aes.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "cipher.h"
+#include "srtp.h"
+
+#define SRTP_CIPHER_TAG "srtp_cipher"
+#define SRTP_CIPHER_BENCH_PACKETS 200
+#define SRTP_CIPHER_BENCH_PAYLOAD 160
+#define SRTP_CIPHER_KEY_LEN 16
+#define SRTP_CIPHER_SALT_LEN 14
+#define RTP_HEADER_SIZE 12
+
+// libsrtp's built-in AES_CM_128, whatever the port compiled it against.
+extern "C" const srtp_cipher_type_t srtp_aes_icm_128;
+
+/**********************
+ * mbedTLS AES counter mode
+ **********************/
+typedef struct {
+  mbedtls_aes_context aes;
+  uint8_t salt[16];
+  uint8_t counter[16];
+  uint8_t stream_block[16];
+  size_t stream_offset;
+} mbedtls_icm_t;
+
+static srtp_err_status_t mbedtls_icm_alloc(srtp_cipher_t **c, int key_len,
+                                           int tag_len);
+static srtp_err_status_t mbedtls_icm_dealloc(srtp_cipher_t *c);
+static srtp_err_status_t mbedtls_icm_init(void *cv, const uint8_t *key);
+static srtp_err_status_t mbedtls_icm_set_iv(void *cv, uint8_t *iv,
+                                            srtp_cipher_direction_t dir);
+static srtp_err_status_t mbedtls_icm_encrypt(void *cv, uint8_t *buf,
+                                             unsigned int *bytes);
+
+static srtp_cipher_type_t mbedtls_icm_128_type = {
+    mbedtls_icm_alloc,
+    mbedtls_icm_dealloc,
+    mbedtls_icm_init,
+    NULL,  // set_aad
+    mbedtls_icm_encrypt,
+    mbedtls_icm_encrypt,
+    mbedtls_icm_set_iv,
+    NULL,  // get_tag
+    "AES-128 counter mode (mbedTLS)",
+    NULL,  // test_data, filled in by oai_srtp_cipher_select()
+    SRTP_AES_ICM_128,
+};
+
+static srtp_err_status_t mbedtls_icm_alloc(srtp_cipher_t **c, int key_len,
+                                           int tag_len) {
+  if (key_len != SRTP_CIPHER_KEY_LEN + SRTP_CIPHER_SALT_LEN) {
+    return srtp_err_status_bad_param;
+  }
+  // Same allocator as libsrtp's own ciphers; it returns zeroed memory.
+  srtp_cipher_t *cipher = (srtp_cipher_t *)srtp_crypto_alloc(
+      sizeof(srtp_cipher_t) + sizeof(mbedtls_icm_t));
+  if (cipher == NULL) {
+    return srtp_err_status_alloc_fail;
+  }
+  mbedtls_icm_t *state = (mbedtls_icm_t *)(cipher + 1);
+  mbedtls_aes_init(&state->aes);
+
+  cipher->type = &mbedtls_icm_128_type;
+  cipher->state = state;
+  cipher->key_len = key_len;
+  cipher->algorithm = SRTP_AES_ICM_128;
+  *c = cipher;
+  return srtp_err_status_ok;
+}
+
+static srtp_err_status_t mbedtls_icm_dealloc(srtp_cipher_t *c) {
+  mbedtls_icm_t *state = (mbedtls_icm_t *)c->state;
+  mbedtls_aes_free(&state->aes);
+  srtp_crypto_free(c);
+  return srtp_err_status_ok;
+}
+
+static srtp_err_status_t mbedtls_icm_init(void *cv, const uint8_t *key) {
+  mbedtls_icm_t *state = (mbedtls_icm_t *)cv;
+  memset(state->salt, 0, sizeof(state->salt));
+  memcpy(state->salt, key + SRTP_CIPHER_KEY_LEN, SRTP_CIPHER_SALT_LEN);
+  if (mbedtls_aes_setkey_enc(&state->aes, key, SRTP_CIPHER_KEY_LEN * 8) != 0) {
+    return srtp_err_status_init_fail;
+  }
+  return srtp_err_status_ok;
+}
+
+static srtp_err_status_t mbedtls_icm_set_iv(void *cv, uint8_t *iv,
+                                            srtp_cipher_direction_t dir) {
+  mbedtls_icm_t *state = (mbedtls_icm_t *)cv;
+  for (int i = 0; i < 16; i++) {
+    state->counter[i] = state->salt[i] ^ iv[i];
+  }
+  state->stream_offset = 0;
+  return srtp_err_status_ok;
+}
+
+// Counter mode is its own inverse, so this also decrypts.
+static srtp_err_status_t mbedtls_icm_encrypt(void *cv, uint8_t *buf,
+                                             unsigned int *bytes) {
+  mbedtls_icm_t *state = (mbedtls_icm_t *)cv;
+  if (mbedtls_aes_crypt_ctr(&state->aes, *bytes, &state->stream_offset,
+                            state->counter, state->stream_block, buf,
+                            buf) != 0) {
+    return srtp_err_status_cipher_fail;
+  }
+  return srtp_err_status_ok;
+}
+
+
+/**********************
+ * Selection
+ **********************/
+typedef struct {
+  const char *name;
+  const srtp_cipher_type_t *type;
+} backend_t;
+
+static const backend_t backends[OAI_SRTP_CIPHER_BACKENDS] = {
+    {"libsrtp", &srtp_aes_icm_128},
+    {"mbedtls", &mbedtls_icm_128_type},
+};
+static oai_srtp_cipher_result_t results[OAI_SRTP_CIPHER_BACKENDS];
+static const char *selected = "libsrtp";
+
+// Nanoseconds per protected packet through whichever AES_CM_128 is
+// registered, or -1 on failure.
+static int time_protect(void) {
+  uint8_t key[SRTP_CIPHER_KEY_LEN + SRTP_CIPHER_SALT_LEN];
+  for (size_t i = 0; i < sizeof(key); i++) {
+    key[i] = (uint8_t)(i * 7 + 1);
+  }
+  srtp_policy_t policy;
+  memset(&policy, 0, sizeof(policy));
+  srtp_crypto_policy_set_aes_cm_128_null_auth(&policy.rtp);
+  srtp_crypto_policy_set_aes_cm_128_null_auth(&policy.rtcp);
+  policy.ssrc.type = ssrc_any_outbound;
+  policy.key = key;
+  policy.window_size = 128;
+  policy.allow_repeat_tx = 1;
+
+  srtp_t session = NULL;
+  if (srtp_create(&session, &policy) != srtp_err_status_ok) {
+    return -1;
+  }
+
+  static uint8_t packet[RTP_HEADER_SIZE + SRTP_CIPHER_BENCH_PAYLOAD +
+                        SRTP_MAX_TRAILER_LEN];
+  int64_t start = esp_timer_get_time();
+  bool ok = true;
+  for (int i = 0; i < SRTP_CIPHER_BENCH_PACKETS && ok; i++) {
+    memset(packet, 0, RTP_HEADER_SIZE);
+    packet[0] = 0x80;
+    packet[1] = 111;
+    packet[2] = (uint8_t)(i >> 8);
+    packet[3] = (uint8_t)i;
+    packet[11] = 1;  // SSRC
+    int len = RTP_HEADER_SIZE + SRTP_CIPHER_BENCH_PAYLOAD;
+    ok = srtp_protect(session, packet, &len) == srtp_err_status_ok;
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+  srtp_dealloc(session);
+  return ok ? (int)(elapsed * 1000 / SRTP_CIPHER_BENCH_PACKETS) : -1;
+}
+
+void oai_srtp_cipher_select(void) {
+  // The self test libsrtp runs on registration needs vectors; AES_CM_128 is
+  // the same transform whichever library computes it.
+  mbedtls_icm_128_type.test_data = srtp_aes_icm_128.test_data;
+
+  int best = -1;
+  for (int i = 0; i < OAI_SRTP_CIPHER_BACKENDS; i++) {
+    results[i].name = backends[i].name;
+    results[i].protect_ns = -1;
+    if (srtp_replace_cipher_type(backends[i].type, SRTP_AES_ICM_128) !=
+        srtp_err_status_ok) {
+      ESP_LOGW(SRTP_CIPHER_TAG, "%s failed its self test", backends[i].name);
+      continue;
+    }
+    results[i].protect_ns = time_protect();
+    if (results[i].protect_ns >= 0 &&
+        (best < 0 || results[i].protect_ns < results[best].protect_ns)) {
+      best = i;
+    }
+  }
+
+  best = best < 0 ? 0 : best;
+  srtp_replace_cipher_type(backends[best].type, SRTP_AES_ICM_128);
+  selected = backends[best].name;
+  ESP_LOGI(SRTP_CIPHER_TAG, "AES_CM_128: libsrtp %d ns, mbedtls %d ns, using %s",
+           results[0].protect_ns, results[1].protect_ns, selected);
+}
+
+const char *oai_srtp_cipher_backend(void) { return selected; }
+
+const oai_srtp_cipher_result_t *oai_srtp_cipher_results(void) {
+  return results;
+}
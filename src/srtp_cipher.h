@@ -0,0 +1,23 @@
+#pragma once
+
+// SRTP cipher backends. libsrtp ships its own AES counter mode, which runs
+// in software unless the port was built against a crypto library; mbedTLS
+// drives the AES peripheral on the ESP32-S3 (CONFIG_MBEDTLS_HARDWARE_AES).
+// oai_srtp_cipher_select() times each backend on a voice-sized packet and
+// registers the fastest with libsrtp for AES_CM_128, the cipher libpeer
+// negotiates. Call it after peer_init(), before any session is created.
+
+typedef struct {
+  const char *name;
+  // Nanoseconds to protect one 160 byte packet with AES_CM_128 and no
+  // authentication, or -1 if the backend failed its self test.
+  int protect_ns;
+} oai_srtp_cipher_result_t;
+
+#define OAI_SRTP_CIPHER_BACKENDS 2
+
+void oai_srtp_cipher_select(void);
+
+// Name of the backend in use, and the timings that chose it.
+const char *oai_srtp_cipher_backend(void);
+const oai_srtp_cipher_result_t *oai_srtp_cipher_results(void);
@@ -0,0 +1,96 @@
+#include "tasks.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "audio_format.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TASKS_TAG "tasks"
+
+static constexpr oai_task_spec_t specs[OAI_TASK_MAX] = {
+    // The encoder's deepest path runs on this stack, so it stays internal.
+    {"audio_publisher", 1, 7, 32 * 1024, OAI_MEM_INTERNAL, 0,
+     MicFormat::kFrameUs, MicFormat::kFrameUs,
+     OAI_HISTOGRAM_CAPTURE_LATENESS_US, OAI_COUNTER_CAPTURE_DEADLINE_MISSES},
+    {"audio_playout", 1, 6, 16 * 1024, OAI_MEM_INTERNAL, 8,
+     SpkFormat::kFrameUs, SpkFormat::kFrameUs,
+     OAI_HISTOGRAM_PLAYOUT_LATENESS_US, OAI_COUNTER_PLAYOUT_DEADLINE_MISSES},
+    // libpeer and the HTTP offer exchange need a deep stack.
+    {"network", 0, 5, 16 * 1024, OAI_MEM_INTERNAL, 0, 5 * 1000, 20 * 1000,
+     OAI_HISTOGRAM_NETWORK_LATENESS_US, OAI_COUNTER_NETWORK_DEADLINE_MISSES},
+    {"tool_worker", 0, 3, 4 * 1024, OAI_MEM_INTERNAL, 4, 0, 0,
+     OAI_HISTOGRAM_MAX, OAI_COUNTER_MAX},
+    // Created by esp_lvgl_port, which allocates its own stack.
+    {"taskLVGL", 0, 2, 8 * 1024, OAI_MEM_INTERNAL, 32, 30 * 1000, 50 * 1000,
+     OAI_HISTOGRAM_UI_LATENESS_US, OAI_COUNTER_UI_DEADLINE_MISSES},
+    // Flash writes disable the cache, so the stack must not be in PSRAM.
+    {"history", 0, 1, 4 * 1024, OAI_MEM_INTERNAL, 0, 0, 0, OAI_HISTOGRAM_MAX,
+     OAI_COUNTER_MAX},
+};
+
+// Only touched by the task that owns the id.
+static int64_t last_tick_us[OAI_TASK_MAX];
+
+const oai_task_spec_t *oai_task_spec(oai_task_id_t id) { return &specs[id]; }
+
+#ifndef LINUX_BUILD
+static StaticTask_t task_buffers[OAI_TASK_MAX];
+static bool started[OAI_TASK_MAX];
+
+bool oai_task_start(oai_task_id_t id, void (*fn)(void *), void *arg) {
+  const oai_task_spec_t *spec = &specs[id];
+  if (started[id]) {
+    ESP_LOGE(TASKS_TAG, "%s already started", spec->name);
+    return false;
+  }
+  StackType_t *stack = (StackType_t *)oai_mem_alloc(
+      spec->stack_region, spec->stack_size, spec->name);
+  if (stack == NULL) {
+    return false;
+  }
+  BaseType_t core = spec->core < 0 ? tskNO_AFFINITY : spec->core;
+  if (xTaskCreateStaticPinnedToCore(fn, spec->name, spec->stack_size, arg,
+                                    spec->priority, stack, &task_buffers[id],
+                                    core) == NULL) {
+    ESP_LOGE(TASKS_TAG, "Failed to create %s", spec->name);
+    return false;
+  }
+  started[id] = true;
+  ESP_LOGI(TASKS_TAG, "%s: core %d, priority %lu, %lu byte stack", spec->name,
+           spec->core, (unsigned long)spec->priority,
+           (unsigned long)spec->stack_size);
+  return true;
+}
+#endif
+
+void oai_task_observe_latency(oai_task_id_t id, int64_t late_us) {
+  const oai_task_spec_t *spec = &specs[id];
+  if (spec->latency_histogram == OAI_HISTOGRAM_MAX) {
+    return;
+  }
+  if (late_us < 0) {
+    late_us = 0;
+  }
+  oai_metrics_histogram_observe(spec->latency_histogram, (uint32_t)late_us);
+  if (late_us > spec->deadline_us) {
+    oai_metrics_counter_add(spec->miss_counter, 1);
+  }
+}
+
+void oai_task_tick(oai_task_id_t id, int64_t now_us) {
+  if (last_tick_us[id] != 0) {
+    oai_task_observe_latency(
+        id, now_us - last_tick_us[id] - (int64_t)specs[id].period_us);
+  }
+  last_tick_us[id] = now_us;
+}
+
+void oai_task_delay_ms(oai_task_id_t id, uint32_t ms) {
+  TickType_t ticks = pdMS_TO_TICKS(ms);
+  int64_t expected = esp_timer_get_time() +
+                     (int64_t)ticks * portTICK_PERIOD_MS * 1000;
+  vTaskDelay(ticks);
+  oai_task_observe_latency(id, esp_timer_get_time() - expected);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem_policy.h"
+#include "metrics.h"
+
+// Where every long-running task lives. Audio owns core 1; the network loop
+// and the display share core 0 with the WiFi and lwIP tasks, so a busy
+// display can only ever delay network work, never a frame.
+//
+//   priority  core  task
+//   7         1     capture   I2S read, DSP, Opus encode, pacer queue
+//   6         1     playout   Opus decode and I2S write
+//   5         0     network   peer_connection_loop, pacer, send queue
+//   3         0     tools     function call workers
+//   2         0     ui        LVGL timers and flushes (esp_lvgl_port)
+//   1         0     history   history log flash writes (history.h)
+//
+// Each task reports how late it woke against its period into its own
+// histogram, and counts a miss whenever that exceeds its deadline.
+//
+// That this placement lowers the p99 frame deadline misses under display
+// load has not been measured yet. To check it on a board, read
+// capture_lateness_us and capture_deadline_misses from /metrics while the UI
+// is animating, with this table and with capture and network on their old
+// cores.
+
+typedef enum {
+  OAI_TASK_CAPTURE,
+  OAI_TASK_PLAYOUT,
+  OAI_TASK_NETWORK,
+  OAI_TASK_TOOLS,
+  OAI_TASK_UI,
+  OAI_TASK_HISTORY,
+  OAI_TASK_MAX,
+} oai_task_id_t;
+
+typedef struct {
+  const char *name;
+  int core;  // -1 for no affinity
+  uint32_t priority;
+  uint32_t stack_size;
+  oai_mem_region_t stack_region;
+  uint32_t queue_depth;  // Inbound queue, 0 if the task has none
+  uint32_t period_us;    // How often the task expects to run
+  uint32_t deadline_us;  // Lateness beyond this counts as a miss
+  oai_histogram_t latency_histogram;
+  oai_counter_t miss_counter;
+} oai_task_spec_t;
+
+const oai_task_spec_t *oai_task_spec(oai_task_id_t id);
+
+#ifndef LINUX_BUILD
+// Creates the task with its stack carved from the spec's region. Each id can
+// be started once.
+bool oai_task_start(oai_task_id_t id, void (*fn)(void *), void *arg);
+#endif
+
+// Scheduling-latency probe. oai_task_tick() is called once per period by the
+// task itself; oai_task_delay_ms() wraps a sleep and measures the oversleep.
+void oai_task_observe_latency(oai_task_id_t id, int64_t late_us);
+void oai_task_tick(oai_task_id_t id, int64_t now_us);
+void oai_task_delay_ms(oai_task_id_t id, uint32_t ms);
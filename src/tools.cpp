@@ -0,0 +1,305 @@
+#include "tools.h"
+
+#include <cJSON.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifndef LINUX_BUILD
+#include <esp_pthread.h>
+
+#include "lcd.h"
+#endif
+
+#include "json_escape.h"
+#include "main.h"
+#include "mem_policy.h"
+#include "metrics.h"
+#include "send_queue.h"
+#include "tasks.h"
+
+#define TOOLS_TAG "tools"
+#define TOOLS_WORKERS 2
+#define TOOLS_CALL_ID_SIZE 40
+#define TOOLS_OUTPUT_SIZE 256
+// function_call_output event around an escaped output of up to twice its size
+#define TOOLS_EVENT_SIZE (2 * TOOLS_OUTPUT_SIZE + 160)
+
+#define TOOLS_RESPONSE_CREATE "{\"type\": \"response.create\"}"
+
+typedef union {
+  struct {
+    int level;
+  } set_volume;
+  struct {
+    int brightness;
+  } set_backlight;
+} tool_args_t;
+
+typedef struct {
+  const char *name;
+  const char *description;
+  const char *parameters;  // JSON schema
+  // Fills args from the model's arguments, false if they are unusable
+  bool (*parse)(const cJSON *json, tool_args_t *args);
+  // Writes a JSON result into out
+  void (*run)(const tool_args_t *args, char *out, size_t len);
+} tool_t;
+
+static bool parse_percent(const cJSON *json, const char *key, int *out) {
+  const cJSON *value = cJSON_GetObjectItemCaseSensitive(json, key);
+  if (!cJSON_IsNumber(value) || value->valuedouble < 0 ||
+      value->valuedouble > 100) {
+    return false;
+  }
+  *out = (int)value->valuedouble;
+  return true;
+}
+
+static bool parse_no_args(const cJSON *json, tool_args_t *args) {
+  return true;
+}
+
+static bool parse_set_volume(const cJSON *json, tool_args_t *args) {
+  return parse_percent(json, "level", &args->set_volume.level);
+}
+
+static void run_set_volume(const tool_args_t *args, char *out, size_t len) {
+  oai_audio_set_volume((uint8_t)args->set_volume.level);
+  snprintf(out, len, "{\"volume\":%d}", args->set_volume.level);
+}
+
+static bool parse_set_backlight(const cJSON *json, tool_args_t *args) {
+  return parse_percent(json, "brightness", &args->set_backlight.brightness);
+}
+
+static void run_set_backlight(const tool_args_t *args, char *out, size_t len) {
+#ifndef LINUX_BUILD
+  set_backlight_brightness(args->set_backlight.brightness);
+#endif
+  snprintf(out, len, "{\"brightness\":%d}", args->set_backlight.brightness);
+}
+
+static void run_get_device_status(const tool_args_t *args, char *out,
+                                  size_t len) {
+  oai_metrics_sample_system();
+  snprintf(out, len,
+           "{\"uptime_s\":%lld,\"free_heap\":%lu,\"volume\":%u,"
+           "\"rtt_ms\":%ld}",
+           (long long)(esp_timer_get_time() / 1000000),
+           (unsigned long)oai_metrics_gauge_get(OAI_GAUGE_HEAP_FREE),
+           (unsigned)oai_audio_get_volume(),
+           (long)oai_metrics_gauge_get(OAI_GAUGE_DATACHANNEL_RTT_MS));
+}
+
+static const tool_t tools[] = {
+    {"set_volume", "Set the speaker volume.",
+     "{\"type\":\"object\",\"properties\":{\"level\":{\"type\":\"integer\","
+     "\"minimum\":0,\"maximum\":100,\"description\":\"Volume in percent\"}},"
+     "\"required\":[\"level\"]}",
+     parse_set_volume, run_set_volume},
+    {"set_backlight", "Set the display backlight brightness.",
+     "{\"type\":\"object\",\"properties\":{\"brightness\":{\"type\":"
+     "\"integer\",\"minimum\":0,\"maximum\":100,\"description\":"
+     "\"Brightness in percent\"}},\"required\":[\"brightness\"]}",
+     parse_set_backlight, run_set_backlight},
+    {"get_device_status",
+     "Read the device's uptime, free memory, volume and network round trip.",
+     "{\"type\":\"object\",\"properties\":{}}", parse_no_args,
+     run_get_device_status},
+};
+
+#define TOOLS_COUNT (sizeof(tools) / sizeof(tools[0]))
+
+typedef struct {
+  const tool_t *tool;  // NULL when the arguments did not parse
+  char call_id[TOOLS_CALL_ID_SIZE];
+  tool_args_t args;
+  int64_t received_us;
+  uint32_t session;
+} tool_job_t;
+
+static std::mutex jobs_mutex;
+static std::condition_variable jobs_ready;
+static tool_job_t *jobs = NULL;
+static size_t jobs_depth = 0;
+static size_t jobs_head = 0;
+static size_t jobs_count = 0;
+
+// Calls of the response in progress, guarded by jobs_mutex
+static uint32_t session = 0;       // Bumped by oai_tools_reset()
+static size_t calls_pending = 0;   // Dispatched, output not yet queued
+static size_t calls_answered = 0;  // Output queued, no response.create yet
+static bool response_done = false;
+
+// Continues the conversation once the response is over and nothing is left
+// to answer. Called with jobs_mutex held.
+static void maybe_create_response(void) {
+  if (!response_done || calls_pending > 0 || calls_answered == 0) {
+    return;
+  }
+  calls_answered = 0;
+  response_done = false;
+  oai_send_queue_push(OAI_SEND_NORMAL, TOOLS_RESPONSE_CREATE,
+                      strlen(TOOLS_RESPONSE_CREATE), NULL);
+}
+
+static bool send_output(const char *call_id, const char *output) {
+  char escaped[2 * TOOLS_OUTPUT_SIZE];
+  if (!oai_json_escape(escaped, sizeof(escaped), output)) {
+    ESP_LOGW(TOOLS_TAG, "Output for %s cut short", call_id);
+  }
+
+  char event[TOOLS_EVENT_SIZE];
+  int len = snprintf(event, sizeof(event),
+                     "{\"type\":\"conversation.item.create\",\"item\":{"
+                     "\"type\":\"function_call_output\",\"call_id\":\"%s\","
+                     "\"output\":\"%s\"}}",
+                     call_id, escaped);
+  if (len < 0 || len >= (int)sizeof(event)) {
+    ESP_LOGE(TOOLS_TAG, "Output for %s does not fit", call_id);
+    return false;
+  }
+  return oai_send_queue_push(OAI_SEND_NORMAL, event, len, NULL);
+}
+
+static void tools_worker(void) {
+  while (1) {
+    tool_job_t job;
+    {
+      std::unique_lock<std::mutex> lock(jobs_mutex);
+      jobs_ready.wait(lock, [] { return jobs_count > 0; });
+      job = jobs[jobs_head];
+      jobs_head = (jobs_head + 1) % jobs_depth;
+      jobs_count--;
+    }
+
+    char output[TOOLS_OUTPUT_SIZE];
+    if (job.tool != NULL) {
+      job.tool->run(&job.args, output, sizeof(output));
+    } else {
+      snprintf(output, sizeof(output), "{\"error\":\"invalid arguments\"}");
+      oai_metrics_counter_add(OAI_COUNTER_TOOL_ERRORS, 1);
+    }
+    {
+      // Pushed under the lock so a reset can not slip in between.
+      std::lock_guard<std::mutex> lock(jobs_mutex);
+      if (job.session == session) {
+        calls_pending--;
+        if (send_output(job.call_id, output)) {
+          calls_answered++;
+        }
+        maybe_create_response();
+      }
+    }
+    oai_metrics_histogram_observe(
+        OAI_HISTOGRAM_TOOL_CALL_US,
+        (uint32_t)(esp_timer_get_time() - job.received_us));
+  }
+}
+
+void oai_tools_init(void) {
+  const oai_task_spec_t *spec = oai_task_spec(OAI_TASK_TOOLS);
+  jobs = (tool_job_t *)oai_mem_alloc(
+      OAI_MEM_PSRAM, spec->queue_depth * sizeof(tool_job_t), "tool jobs");
+  if (jobs == NULL) {
+    return;
+  }
+  jobs_depth = spec->queue_depth;
+#ifndef LINUX_BUILD
+  esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+  cfg.stack_size = spec->stack_size;
+  cfg.prio = spec->priority;
+  cfg.pin_to_core = spec->core;
+  cfg.thread_name = spec->name;
+  esp_pthread_set_cfg(&cfg);
+#endif
+  for (int i = 0; i < TOOLS_WORKERS; i++) {
+    std::thread(tools_worker).detach();
+  }
+#ifndef LINUX_BUILD
+  cfg = esp_pthread_get_default_config();
+  esp_pthread_set_cfg(&cfg);
+#endif
+}
+
+size_t oai_tools_declarations(char *buf, size_t len) {
+  size_t n = snprintf(buf, len, "[");
+  for (size_t i = 0; i < TOOLS_COUNT && n < len; i++) {
+    n += snprintf(buf + n, len - n,
+                  "%s{\"type\":\"function\",\"name\":\"%s\","
+                  "\"description\":\"%s\",\"parameters\":%s}",
+                  i ? "," : "", tools[i].name, tools[i].description,
+                  tools[i].parameters);
+  }
+  if (n < len) {
+    n += snprintf(buf + n, len - n, "]");
+  }
+  return n < len ? n : 0;
+}
+
+void oai_tools_dispatch(const char *name, const char *call_id,
+                        const char *arguments) {
+  int64_t received = esp_timer_get_time();
+  oai_metrics_counter_add(OAI_COUNTER_TOOL_CALLS, 1);
+
+  tool_job_t job = {};
+  job.received_us = received;
+  if (strlen(call_id) >= sizeof(job.call_id)) {
+    ESP_LOGE(TOOLS_TAG, "call_id too long");
+    oai_metrics_counter_add(OAI_COUNTER_TOOL_ERRORS, 1);
+    return;
+  }
+  strcpy(job.call_id, call_id);
+
+  const tool_t *tool = NULL;
+  for (size_t i = 0; i < TOOLS_COUNT && tool == NULL; i++) {
+    if (strcmp(tools[i].name, name) == 0) {
+      tool = &tools[i];
+    }
+  }
+  if (tool == NULL) {
+    ESP_LOGW(TOOLS_TAG, "Unknown tool %s", name);
+  } else {
+    cJSON *json = cJSON_Parse(arguments);
+    if (json != NULL && tool->parse(json, &job.args)) {
+      job.tool = tool;
+    }
+    cJSON_Delete(json);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    if (jobs_count == jobs_depth) {
+      ESP_LOGW(TOOLS_TAG, "Tool queue full, dropping %s", name);
+      oai_metrics_counter_add(OAI_COUNTER_TOOL_ERRORS, 1);
+      return;
+    }
+    // A call means its response is still going.
+    response_done = false;
+    job.session = session;
+    jobs[(jobs_head + jobs_count) % jobs_depth] = job;
+    jobs_count++;
+    calls_pending++;
+  }
+  jobs_ready.notify_one();
+}
+
+void oai_tools_on_response_done(void) {
+  std::lock_guard<std::mutex> lock(jobs_mutex);
+  response_done = true;
+  maybe_create_response();
+}
+
+void oai_tools_reset(void) {
+  std::lock_guard<std::mutex> lock(jobs_mutex);
+  session++;
+  calls_pending = 0;
+  calls_answered = 0;
+  response_done = false;
+}
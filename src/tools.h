@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Functions the model can call on the device. Each tool parses its JSON
+// arguments straight into a typed struct on the network task, then runs on
+// a small worker pool so slow hardware never stalls peer_connection_loop().
+// Results go back as function_call_output items through the send queue. The
+// server allows one response at a time, so a single response.create follows
+// once the response that made the calls is done and every call is answered.
+
+// Starts the worker pool. Call once before the data channel opens.
+void oai_tools_init(void);
+
+// Writes the JSON array declaring every registered tool, for the tools field
+// of a session.update. Returns the length, or 0 if buf is too small.
+size_t oai_tools_declarations(char *buf, size_t len);
+
+// Handles a response.function_call_arguments.done event. arguments is the
+// JSON text the model produced.
+void oai_tools_dispatch(const char *name, const char *call_id,
+                        const char *arguments);
+
+// Handles a response.done event.
+void oai_tools_on_response_done(void);
+
+// Forgets calls of a session that has gone away; their outputs are dropped.
+void oai_tools_reset(void);
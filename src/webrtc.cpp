@@ -5,51 +5,278 @@
 
 #include <esp_event.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <string.h>
 #include <cJSON.h>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "arena.h"
+#include "audio_format.h"
+#include "board.h"
+#include "dc_stream.h"
+#include "dns_cache.h"
+#include "governor.h"
+#include "history.h"
+#include "kws.h"
+#include "liveness.h"
 #include "main.h"
+#include "mem_policy.h"
+#include "metrics.h"
+#include "pacer.h"
+#include "power.h"
+#include "preroll.h"
+#include "recorder.h"
+#include "send_queue.h"
+#include "session_config.h"
+#include "sdkconfig.h"
+#include "tasks.h"
+#include "tools.h"
 
 #ifndef LINUX_BUILD
 #include "esp_lcd_panel_io.h"
 #include "lcd.h"
 #include "esp_lvgl_port.h"
+#else
+#include <math.h>
+#include <unistd.h>
 #endif
 
 #define TICK_INTERVAL 5
-#define GREETING                                                    \
-  "{\"type\": \"response.create\", \"response\": {\"modalities\": " \
-  "[\"audio\", \"text\"], \"instructions\": \"Say 'How can I help?.'\"}}"
+// Inbound packets wait in the socket buffer at most this long while idle
+#define IDLE_TICK_INTERVAL 20
+
+// The publisher logs its stack high-water mark once it has run for a while;
+// the per-task watermark is also reported on /metrics.
+#define AUDIO_PUBLISHER_WATERMARK_FRAMES 500
+
+// Pre-roll backlog frames sent per captured frame once connected, so the
+// backlog drains at twice real time. Frames this far ahead of the first
+// speech are kept so the onset is not clipped.
+#define PREROLL_CATCHUP_FRAMES 3
+#define PREROLL_LEAD_IN_FRAMES (300 / MicFormat::kFrameMs)
+
+// Metrics snapshots are not a Realtime API client event and the server answers
+// them with an error, so publishing is off unless a build enables it.
+#ifndef OAI_METRICS_PUBLISH_INTERVAL_MS
+#define OAI_METRICS_PUBLISH_INTERVAL_MS 0
+#endif
+// Answered by session.updated without changing anything
+#define LIVENESS_PROBE "{\"type\": \"session.update\", \"session\": {}}"
+
+// An ICE restart or offer that has not opened the data channel by then is
+// retried, and after PEER_MAX_RESTARTS attempts in a row the device reboots.
+#define PEER_RESTART_TIMEOUT_US (10 * 1000 * 1000)
+#define PEER_MAX_RESTARTS 5
 
+#define METRICS_EVENT_BUFFER_SIZE 2048
+#define JSON_SCRATCH_SIZE (32 * 1024)
+#ifdef LINUX_BUILD
+#define ALLOC_REPORT_INTERVAL_US (10 * 1000 * 1000)
+// The synthetic microphone stalls this long every SYNTH_MIC_STALL_EVERY_US
+// and then reads the frames it missed back to back, as the capture task does
+// after the I2S DMA ring has filled behind it.
+#define SYNTH_MIC_STALL_US (200 * 1000)
+#define SYNTH_MIC_STALL_EVERY_US (5 * 1000 * 1000)
+#endif
+
+// Only used by the network task; captured audio reaches it through the pacer.
 PeerConnection *peer_connection = NULL;
+// Whether audio sent now would reach the peer; until then it goes to the
+// pre-roll.
+static std::atomic<bool> audio_connected{false};
+static bool datachannel_open = false;
+static bool greeting_sent = false;
+static bool restart_requested = false;
+static int64_t restart_started_us = 0;
+static int restart_attempts = 0;
+static bool transcript_streaming = false;
+// libpeer does not expose RTCP statistics, so link RTT is approximated by how
+// long the server takes to acknowledge a client event.
+static int64_t request_sent_us = 0;
 
-void parse_response(const char* json_str) {
-  cJSON *root = cJSON_Parse(json_str);
+void parse_response(const char* json_str, size_t len) {
+  oai_json_scratch_begin();
+  cJSON *root = cJSON_ParseWithLength(json_str, len);
   if (root == NULL) {
       // printf("JSON parse failed\n");
+      oai_json_scratch_end();
       return;
   }
   
+  // Assistant speech is streamed into one bubble as deltas arrive; the final
+  // transcript only closes it. Any other event carrying a transcript gets a
+  // bubble of its own.
+  cJSON *type = cJSON_GetObjectItem(root, "type");
+  const char *type_str = cJSON_IsString(type) ? type->valuestring : "";
+  cJSON *delta = cJSON_GetObjectItem(root, "delta");
   cJSON *transcript = cJSON_GetObjectItem(root, "transcript");
-  if (transcript != NULL && cJSON_IsString(transcript)) {
+  // Liveness probes are answered by session.updated, which must not keep an
+  // idle device awake.
+  if (strcmp(type_str, "session.updated") != 0) {
+    oai_power_on_activity(esp_timer_get_time());
+  } else {
+    oai_liveness_on_probe_reply(esp_timer_get_time());
+  }
+  if (strcmp(type_str, "response.function_call_arguments.done") == 0) {
+    cJSON *name = cJSON_GetObjectItem(root, "name");
+    cJSON *call_id = cJSON_GetObjectItem(root, "call_id");
+    cJSON *arguments = cJSON_GetObjectItem(root, "arguments");
+    if (cJSON_IsString(name) && cJSON_IsString(call_id) &&
+        cJSON_IsString(arguments)) {
+      oai_tools_dispatch(name->valuestring, call_id->valuestring,
+                         arguments->valuestring);
+    }
+  } else if (strcmp(type_str, "response.done") == 0) {
+    oai_tools_on_response_done();
+  } else if (strcmp(type_str, "response.created") == 0 &&
+             request_sent_us != 0) {
+    oai_metrics_gauge_set(
+        OAI_GAUGE_DATACHANNEL_RTT_MS,
+        (int32_t)((esp_timer_get_time() - request_sent_us) / 1000));
+    request_sent_us = 0;
+  } else if (strcmp(type_str, "response.audio_transcript.delta") == 0) {
+    if (cJSON_IsString(delta)) {
+#ifndef LINUX_BUILD
+      if (!transcript_streaming) {
+        lvgl_ui_label_append_text("msg: ");
+      }
+      lvgl_ui_label_append_text(delta->valuestring);
+#endif
+      transcript_streaming = true;
+    }
+  } else if (transcript != NULL && cJSON_IsString(transcript)) {
       printf("msg: %s\n", transcript->valuestring);
+      bool done = strcmp(type_str, "response.audio_transcript.done") == 0;
+      oai_history_append(done ? OAI_HISTORY_ASSISTANT : OAI_HISTORY_USER,
+                         transcript->valuestring,
+                         strlen(transcript->valuestring));
 #ifndef LINUX_BUILD
-      char buf[1000];
-      lv_snprintf(buf, sizeof(buf), "msg: %s", transcript->valuestring);
-      lvgl_ui_label_set_text(buf);
+      if (!(done && transcript_streaming)) {
+        lvgl_ui_label_end();
+        lvgl_ui_label_append_text("msg: ");
+        lvgl_ui_label_append_text(transcript->valuestring);
+      }
+      lvgl_ui_label_end();
 #endif
+      if (done) {
+        transcript_streaming = false;
+      }
   }
   
   cJSON_Delete(root);
+  oai_json_scratch_end();
 }
+
+// Runs on the capture task (the synthetic microphone thread on Linux) for
+// each frame; the network task sends what reaches the pacer.
+static void oai_publish_frame(const uint8_t *packet, int size, uint32_t level) {
+  static uint8_t backlog_packet[MicFormat::kMaxPacketBytes];
+  static bool was_connected = false;
+
+  bool connected = audio_connected.load(std::memory_order_acquire);
+  if (connected && !was_connected) {
+    // Leading silence is not worth the catch-up time.
+    oai_preroll_trim_silence(CONFIG_OAI_POWER_VAD_RMS, PREROLL_LEAD_IN_FRAMES);
+  }
+  was_connected = connected;
+  // Live frames queue behind any backlog so the peer hears them in order,
+  // and wait in the pre-roll while the network task is behind.
+  if (size > 0 && (!connected || oai_preroll_frames() > 0 ||
+                   !oai_pacer_push(packet, size))) {
+    oai_preroll_push(packet, size, level);
+  }
+  if (!connected) {
+    return;
+  }
+  for (int i = 0; i < PREROLL_CATCHUP_FRAMES && oai_pacer_space() > 0; i++) {
+    size_t len = oai_preroll_pop(backlog_packet, sizeof(backlog_packet));
+    if (len == 0) {
+      break;
+    }
+    oai_pacer_push(backlog_packet, len);
+  }
+}
+
+static void oai_send_audio_packet(const uint8_t *packet, size_t len) {
+  peer_connection_send_audio(peer_connection, (uint8_t *)packet, len);
+}
+
+#ifdef LINUX_BUILD
+// OAI_SYNTH_MIC: a 440 Hz tone captured on an absolute frame schedule stands
+// in for the I2S microphone, so the uplink and the pacer can be checked with
+// a packet capture on the host.
+static void oai_synthetic_mic() {
+  oai_init_audio_encoder();
+  oai_preroll_init();
+  static int16_t pcm[MicFormat::kSamples];
+  uint64_t sample = 0;
+  int64_t next_frame_us = esp_timer_get_time();
+  int64_t next_stall_us = next_frame_us + SYNTH_MIC_STALL_EVERY_US;
+  while (1) {
+    int64_t now = esp_timer_get_time();
+    if (now >= next_stall_us) {
+      usleep(SYNTH_MIC_STALL_US);
+      next_stall_us += SYNTH_MIC_STALL_EVERY_US;
+    } else if (now < next_frame_us) {
+      usleep((useconds_t)(next_frame_us - now));
+    }
+    next_frame_us += MicFormat::kFrameUs;
+
+    for (uint32_t i = 0; i < MicFormat::kSamples; i++, sample++) {
+      pcm[i] = (int16_t)(8000 * sin(2 * M_PI * 440 * sample /
+                                    MicFormat::kSampleRate));
+    }
+    const uint8_t *packet;
+    uint32_t level;
+    int size = oai_encode_audio(pcm, &packet, &level);
+    if (size > 0) {
+      oai_publish_frame(packet, size, level);
+    }
+  }
+}
+#endif
+
 #ifndef LINUX_BUILD
-StaticTask_t task_buffer;
-void oai_send_audio_task(void *user_data) {
+static void oai_send_audio_task(void *user_data) {
   oai_init_audio_encoder();
+  oai_governor_init();
+  oai_preroll_init();
+  oai_mem_report();
 
+  uint32_t frames = 0;
   while (1) {
-    oai_send_audio(peer_connection);
-    vTaskDelay(pdMS_TO_TICKS(TICK_INTERVAL));
+    const uint8_t *packet;
+    uint32_t level;
+    int size = oai_capture_audio(&packet, &level);
+    // Frames the I2S driver dropped still take one packet each, so RTP time
+    // keeps to the capture clock.
+    uint32_t lost = oai_capture_take_overruns();
+    if (size > 0) {
+      uint8_t filler = oai_pacer_filler(packet);
+      lost = std::min(lost, (uint32_t)Board::kAudio.dma_buf_count);
+      for (uint32_t i = 0; i < lost; i++) {
+        oai_publish_frame(&filler, 1, 0);
+      }
+      oai_publish_frame(packet, size, level);
+      oai_governor_frame_end(esp_timer_get_time());
+    }
+    if (++frames == AUDIO_PUBLISHER_WATERMARK_FRAMES) {
+      ESP_LOGI(LOG_TAG, "audio_publisher stack: %u of %u bytes never used",
+               (unsigned)uxTaskGetStackHighWaterMark(NULL),
+               (unsigned)oai_task_spec(OAI_TASK_CAPTURE)->stack_size);
+    }
+  }
+}
+
+// The publisher outlives ICE restarts, keeping the encoder and I2S state.
+void oai_start_audio_publisher() {
+  static bool audio_publisher_started = false;
+  if (!audio_publisher_started) {
+    audio_publisher_started =
+        oai_task_start(OAI_TASK_CAPTURE, oai_send_audio_task, NULL);
   }
 }
 #endif
@@ -59,7 +286,14 @@ static void oai_ondatachannel_onmessage_task(char *msg, size_t len,
 #ifdef LOG_DATACHANNEL_MESSAGES
   ESP_LOGI(LOG_TAG, "DataChannel Message: %s", msg);
 #endif
-  parse_response(msg);
+  oai_recorder_record(OAI_RECORD_DATACHANNEL_RX, msg, len);
+  oai_liveness_on_rx(esp_timer_get_time());
+  oai_dc_stream_rx(msg, len);
+}
+
+static void oai_on_event(const char *event, size_t len) {
+  oai_metrics_counter_add(OAI_COUNTER_DATACHANNEL_RX, 1);
+  parse_response(event, len);
 }
 
 static void oai_ondatachannel_onopen_task(void *userdata) {
@@ -67,8 +301,25 @@ static void oai_ondatachannel_onopen_task(void *userdata) {
                                          0, 0, (char *)"oai-events",
                                          (char *)"") != -1) {
     ESP_LOGI(LOG_TAG, "DataChannel created");
-    peer_connection_datachannel_send(peer_connection, (char *)GREETING,
-                                     strlen(GREETING));
+    datachannel_open = true;
+    oai_liveness_reset(esp_timer_get_time());
+    restart_started_us = 0;
+    restart_attempts = 0;
+
+    // Every session, restarted or not, needs its settings and tools again.
+    const char *event;
+    size_t len = oai_session_config_update_event(&event);
+    if (len > 0) {
+      oai_send_queue_push(OAI_SEND_NORMAL, event, len, "session.update");
+    }
+
+    // A restarted session carries on silently instead of greeting again.
+    len = oai_session_config_greeting_event(&event);
+    if (!greeting_sent && len > 0) {
+      greeting_sent = true;
+      request_sent_us = esp_timer_get_time();
+      oai_send_queue_push(OAI_SEND_NORMAL, event, len, NULL);
+    }
   } else {
     ESP_LOGE(LOG_TAG, "Failed to create DataChannel");
   }
@@ -78,50 +329,111 @@ static void oai_onconnectionstatechange_task(PeerConnectionState state,
                                              void *user_data) {
   ESP_LOGI(LOG_TAG, "PeerConnectionState: %s",
            peer_connection_state_to_string(state));
+  uint8_t recorded_state = (uint8_t)state;
+  oai_recorder_record(OAI_RECORD_PEER_STATE, &recorded_state, 1);
+  oai_history_event("peer %s", peer_connection_state_to_string(state));
+  oai_metrics_gauge_set(OAI_GAUGE_PEER_STATE, (int32_t)state);
+  oai_power_on_activity(esp_timer_get_time());
 
+  // The connection can not be torn down from inside its own callback, so a
+  // dead path only flags the restart for the loop in oai_webrtc().
   if (state == PEER_CONNECTION_DISCONNECTED ||
-      state == PEER_CONNECTION_CLOSED) {
-#ifndef LINUX_BUILD
-    esp_restart();
-#endif
+      state == PEER_CONNECTION_FAILED || state == PEER_CONNECTION_CLOSED) {
+    oai_metrics_counter_add(OAI_COUNTER_PEER_DISCONNECTED, 1);
+    audio_connected.store(false, std::memory_order_release);
+    oai_history_on_peer_connected(false);
+    datachannel_open = false;
+    restart_requested = true;
   } else if (state == PEER_CONNECTION_CONNECTED) {
-#ifndef LINUX_BUILD
-    StackType_t *stack_memory = (StackType_t *)heap_caps_malloc(
-      40000 * sizeof(StackType_t), MALLOC_CAP_SPIRAM);
-    xTaskCreateStaticPinnedToCore(oai_send_audio_task, "audio_publisher", 40000,
-                                  NULL, 7, stack_memory, &task_buffer, 0);
-#endif
+    oai_metrics_counter_add(OAI_COUNTER_PEER_CONNECTED, 1);
+    audio_connected.store(true, std::memory_order_release);
+    oai_history_on_peer_connected(true);
   }
 }
 
 static void oai_on_icecandidate_task(char *description, void *user_data) {
   char local_buffer[MAX_HTTP_OUTPUT_BUFFER + 1] = {0};
-  oai_http_request(description, local_buffer);
+  if (!oai_http_request(description, local_buffer)) {
+    // Handled like a restart that never connected: the connection is rebuilt
+    // after PEER_RESTART_TIMEOUT_US and only PEER_MAX_RESTARTS reboots.
+    oai_history_event("offer failed");
+    if (restart_started_us == 0) {
+      restart_started_us = esp_timer_get_time();
+    }
+    return;
+  }
   peer_connection_set_remote_description(peer_connection, local_buffer);
 }
 
-void oai_webrtc() {
-  PeerConfiguration peer_connection_config = {
-      .ice_servers = {},
-      .audio_codec = CODEC_OPUS,
-      .video_codec = CODEC_NONE,
-      .datachannel = DATA_CHANNEL_STRING,
-      .onaudiotrack = [](uint8_t *data, size_t size, void *userdata) -> void {
-#ifndef LINUX_BUILD
-        oai_audio_decode(data, size);
+static void oai_publish_metrics() {
+  static int64_t last_publish_us = 0;
+  int64_t now = esp_timer_get_time();
+  if (OAI_METRICS_PUBLISH_INTERVAL_MS == 0 || !datachannel_open ||
+      oai_governor_shedding(OAI_GOVERNOR_SHED_METRICS) ||
+      now - last_publish_us < OAI_METRICS_PUBLISH_INTERVAL_MS * 1000LL) {
+    return;
+  }
+  last_publish_us = now;
+
+  static char event[METRICS_EVENT_BUFFER_SIZE];
+  oai_metrics_sample_system();
+  size_t len = oai_metrics_snapshot_json(event, sizeof(event));
+  // Only the newest snapshot is worth sending.
+  oai_send_queue_push(OAI_SEND_BULK, event, len, "device.metrics");
+}
+
+#ifdef LINUX_BUILD
+// Reports heap allocations made while connected. With the arenas in place the
+// count per interval should stay at zero once streaming has started.
+static void oai_report_allocations() {
+  static int64_t last_report_us = 0;
+  static uint32_t last_count = 0;
+  int64_t now = esp_timer_get_time();
+  if (now - last_report_us < ALLOC_REPORT_INTERVAL_US) {
+    return;
+  }
+
+  uint32_t count = oai_alloc_count();
+  if (last_report_us != 0 && datachannel_open) {
+    ESP_LOGI(LOG_TAG, "Heap allocations in the last %d s: %u",
+             (int)(ALLOC_REPORT_INTERVAL_US / 1000000),
+             (unsigned)(count - last_count));
+  }
+  last_report_us = now;
+  last_count = count;
+}
 #endif
-      },
-      .onvideotrack = NULL,
-      .on_request_keyframe = NULL,
-      .user_data = NULL,
-  };
 
+static void oai_onaudiotrack(uint8_t *data, size_t size, void *userdata) {
+  oai_recorder_record(OAI_RECORD_AUDIO_RX, data, size);
+  int64_t now = esp_timer_get_time();
+  oai_metrics_audio_rx(now);
+  oai_liveness_on_rx(now);
+  oai_power_on_activity(now);
+  oai_audio_playout(data, size);
+}
+
+static PeerConfiguration peer_connection_config = {
+    .ice_servers = {},
+    .audio_codec = CODEC_OPUS,
+    .video_codec = CODEC_NONE,
+    .datachannel = DATA_CHANNEL_STRING,
+    .onaudiotrack = oai_onaudiotrack,
+    .onvideotrack = NULL,
+    .on_request_keyframe = NULL,
+    .user_data = NULL,
+};
+
+// Creates the connection and starts the offer; the SDP exchange itself runs
+// from oai_on_icecandidate_task once candidates are gathered.
+static void oai_create_peer_connection() {
   peer_connection = peer_connection_create(&peer_connection_config);
   if (peer_connection == NULL) {
     ESP_LOGE(LOG_TAG, "Failed to create peer connection");
 #ifndef LINUX_BUILD
     esp_restart();
 #endif
+    return;
   }
 
   peer_connection_oniceconnectionstatechange(peer_connection,
@@ -132,9 +444,163 @@ void oai_webrtc() {
                                 oai_ondatachannel_onopen_task, NULL);
 
   peer_connection_create_offer(peer_connection);
+}
+
+// libpeer has no ICE restart, so the connection is rebuilt and a new offer
+// goes through oai_http_request(). The audio publisher, codecs and I2S keep
+// running, queueing into the pre-roll until the new connection is up.
+static void oai_restart_peer_connection() {
+  ESP_LOGW(LOG_TAG, "Restarting ICE, attempt %d", restart_attempts + 1);
+  oai_history_event("ICE restart, attempt %d", restart_attempts + 1);
+  if (++restart_attempts > PEER_MAX_RESTARTS) {
+    ESP_LOGE(LOG_TAG, "Giving up after %d ICE restarts", PEER_MAX_RESTARTS);
+    oai_history_event("rebooting after %d ICE restarts", PEER_MAX_RESTARTS);
+    oai_history_flush(1000);
+#ifndef LINUX_BUILD
+    esp_restart();
+#endif
+  }
+  oai_metrics_counter_add(OAI_COUNTER_ICE_RESTARTS, 1);
+
+  audio_connected.store(false, std::memory_order_release);
+  oai_history_on_peer_connected(false);
+  datachannel_open = false;
+  transcript_streaming = false;
+  oai_dc_stream_reset();
+  oai_send_queue_clear();
+  oai_tools_reset();
+  if (peer_connection != NULL) {
+    peer_connection_destroy(peer_connection);
+  }
+  oai_create_peer_connection();
+  restart_requested = false;
+  restart_started_us = esp_timer_get_time();
+}
+
+static void oai_check_liveness() {
+  int64_t now = esp_timer_get_time();
+  if (restart_started_us != 0 &&
+      now - restart_started_us >= PEER_RESTART_TIMEOUT_US) {
+    restart_requested = true;
+  }
+
+  if (restart_requested) {
+    restart_requested = false;
+    oai_restart_peer_connection();
+    return;
+  }
+
+  if (!datachannel_open || restart_started_us != 0) {
+    return;
+  }
+  switch (oai_liveness_poll(now)) {
+    case OAI_LIVENESS_PROBE:
+      oai_send_queue_push(OAI_SEND_CONTROL, LIVENESS_PROBE,
+                          strlen(LIVENESS_PROBE), "liveness");
+      break;
+    case OAI_LIVENESS_DEAD:
+      ESP_LOGW(LOG_TAG, "Liveness probe unanswered");
+      oai_history_event("liveness probe unanswered");
+      oai_restart_peer_connection();
+      break;
+    default:
+      break;
+  }
+}
+
+static int oai_datachannel_send(const char *data, size_t len) {
+  return peer_connection_datachannel_send(peer_connection, (char *)data, len);
+}
+
+void oai_webrtc() {
+  oai_recorder_init();
+  oai_json_scratch_init(JSON_SCRATCH_SIZE);
+  oai_dc_stream_init(oai_on_event);
+  oai_send_queue_init(oai_datachannel_send);
+  oai_tools_init();
+  oai_session_config_load();
+  oai_pacer_init();
+  // Already sent from on_got_ip on the device; the answer is collected when
+  // the offer is posted.
+  oai_http_prefetch();
+#ifdef LINUX_BUILD
+  if (getenv("OAI_SYNTH_MIC") != NULL) {
+    std::thread(oai_synthetic_mic).detach();
+  }
+#else
+  // With a wake word model the microphone is listened to locally first, and
+  // the session is only opened once the keyword is heard.
+  bool wake_word = oai_kws_enabled();
+  if (wake_word) {
+    ESP_LOGI(LOG_TAG, "Waiting for the wake word");
+    while (!oai_kws_uplink_open()) {
+      oai_power_poll(esp_timer_get_time());
+      oai_dns_cache_poll(esp_timer_get_time());
+      oai_task_delay_ms(OAI_TASK_NETWORK, IDLE_TICK_INTERVAL);
+    }
+  }
+#endif
+  oai_create_peer_connection();
 
   while (1) {
+    if (audio_connected.load(std::memory_order_acquire)) {
+      oai_pacer_poll(esp_timer_get_time(), oai_send_audio_packet);
+    }
     peer_connection_loop(peer_connection);
-    vTaskDelay(pdMS_TO_TICKS(TICK_INTERVAL));
+    oai_check_liveness();
+    if (datachannel_open) {
+      oai_send_queue_flush(esp_timer_get_time());
+    }
+    oai_publish_metrics();
+#ifdef LINUX_BUILD
+    oai_report_allocations();
+#endif
+    oai_power_poll(esp_timer_get_time());
+    oai_dns_cache_poll(esp_timer_get_time());
+#ifndef LINUX_BUILD
+    // A conversation that has gone idle stops streaming; the session stays
+    // up and the next wake word resumes it.
+    if (wake_word && oai_power_profile() == OAI_POWER_IDLE &&
+        oai_kws_uplink_open()) {
+      ESP_LOGI(LOG_TAG, "Idle, waiting for the wake word");
+      oai_kws_rearm();
+    }
+#endif
+    oai_task_delay_ms(OAI_TASK_NETWORK, oai_power_profile() == OAI_POWER_IDLE
+                                            ? IDLE_TICK_INTERVAL
+                                            : TICK_INTERVAL);
   }
 }
+
+#ifdef LINUX_BUILD
+// Drives a capture through the same handlers a live session uses. Nothing is
+// sent: the data channel never opens, so the send queue only fills.
+void oai_webrtc_replay(const char *path, float speed) {
+  oai_json_scratch_init(JSON_SCRATCH_SIZE);
+  oai_dc_stream_init(oai_on_event);
+  oai_send_queue_init(oai_datachannel_send);
+  oai_tools_init();
+  oai_session_config_load();
+
+  static const oai_replay_handlers_t handlers = {
+      .on_audio =
+          [](const uint8_t *data, size_t len) {
+            oai_onaudiotrack((uint8_t *)data, len, NULL);
+          },
+      .on_message =
+          [](const char *msg, size_t len) { oai_dc_stream_rx(msg, len); },
+      .on_state =
+          [](int state) {
+            oai_onconnectionstatechange_task((PeerConnectionState)state,
+                                             NULL);
+          },
+  };
+  if (!oai_replay_file(path, speed, &handlers)) {
+    return;
+  }
+
+  static char report[8192];
+  oai_metrics_snapshot_text(report, sizeof(report));
+  printf("%s", report);
+}
+#endif
@@ -1,3 +1,4 @@
+#include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -12,6 +13,7 @@
 #include "lwip/inet.h"
 #include "esp_http_server.h"
 #include "wifi_config.h"
+#include "main.h"
 #include "esp_lcd_panel_io.h"
 #include "lcd.h"
 #include "esp_lvgl_port.h"
@@ -20,8 +22,14 @@ static const char *TAG = "wifi_config";
 
 /* NVS Namespace */
 #define NVS_NAMESPACE "wifi_config"
+#define NVS_SESSION_NAMESPACE "session_config"
+
+/* Numeric Kconfig defaults shown as placeholders on the form */
+#define WIFI_CONFIG_STR_(x) #x
+#define WIFI_CONFIG_STR(x) WIFI_CONFIG_STR_(x)
 
 wifi_config_data_t web_wifi_config_data;
+static oai_session_config_t web_session_config_data;
 static httpd_handle_t wifi_config_server = NULL;
 static bool web_is_configured = false;
 static bool sta_is_connected = false;
@@ -46,6 +54,8 @@ static void on_got_ip(void *arg, esp_event_base_t event_base,
         ESP_LOGI(TAG, "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
         sta_ip = event->ip_info.ip;
         sta_is_connected = true;
+        /* Resolve the API host while the rest of the connection is set up */
+        oai_http_prefetch();
     }
 }
 
@@ -151,6 +161,14 @@ const wifi_config_data_t* get_web_wifi_config_data(void) {
     return &web_wifi_config_data;
 }
 
+/**
+ * @brief Get the session settings submitted through the web page.
+ *        Fields left blank on the form are empty or zero.
+ */
+const oai_session_config_t* get_web_session_config_data(void) {
+    return &web_session_config_data;
+}
+
 /**
  * @brief HTTP GET handler for the root ("/") endpoint.
  *        Returns the WiFi configuration form HTML page.
@@ -184,7 +202,7 @@ static esp_err_t root_get_handler(httpd_req_t *req)
     "        }\n" \
     "        h2 { text-align: center; margin-bottom: 20px; font-size: 1.5em; color: #4a4a4a; }\n" \
     "        label { display: block; margin-bottom: 6px; font-weight: bold; font-size: 1em; }\n" \
-    "        input[type=\"text\"], input[type=\"password\"] {\n" \
+    "        input[type=\"text\"], input[type=\"password\"], input[type=\"number\"] {\n" \
     "            width: 95%;\n" \
     "            padding: 10px 12px;\n" \
     "            margin-bottom: 16px;\n" \
@@ -195,7 +213,7 @@ static esp_err_t root_get_handler(httpd_req_t *req)
     "            display: block;\n" \
     "            margin: 15px auto;\n" \
     "        }\n" \
-    "        input[type=\"text\"]:focus, input[type=\"password\"]:focus {\n" \
+    "        input[type=\"text\"]:focus, input[type=\"password\"]:focus, input[type=\"number\"]:focus {\n" \
     "            border-color: #007bff;\n" \
     "            outline: none;\n" \
     "            box-shadow: 0 0 0 2px rgba(0,123,255,0.25);\n" \
@@ -225,7 +243,7 @@ static esp_err_t root_get_handler(httpd_req_t *req)
     "                font-size: 1.2em;\n" \
     "                margin-bottom: 16px;\n" \
     "            }\n" \
-    "            input[type=\"text\"], input[type=\"password\"] {\n" \
+    "            input[type=\"text\"], input[type=\"password\"], input[type=\"number\"] {\n" \
     "                width: 90%; " \
     "                font-size: 1em;\n" \
     "                padding: 8px 10px;\n" \
@@ -255,6 +273,15 @@ static esp_err_t root_get_handler(httpd_req_t *req)
     "            <label for=\"openai_key\">OpenAI API Key:</label>\n" \
     "            <input type=\"text\" id=\"openai_key\" name=\"openai_key\" placeholder=\"sk-xxxxx...\">\n" \
     "\n" \
+    "            <label for=\"voice\">Voice (optional):</label>\n" \
+    "            <input type=\"text\" id=\"voice\" name=\"voice\" maxlength=\"15\" placeholder=\"" CONFIG_OAI_SESSION_VOICE "\">\n" \
+    "\n" \
+    "            <label for=\"vad_threshold\">Speech detection threshold, 1-1000 (optional):</label>\n" \
+    "            <input type=\"number\" id=\"vad_threshold\" name=\"vad_threshold\" min=\"1\" max=\"1000\" placeholder=\"" WIFI_CONFIG_STR(CONFIG_OAI_SESSION_VAD_THRESHOLD) "\">\n" \
+    "\n" \
+    "            <label for=\"silence_ms\">Silence that ends a turn, ms (optional):</label>\n" \
+    "            <input type=\"number\" id=\"silence_ms\" name=\"silence_ms\" min=\"1\" max=\"65535\" placeholder=\"" WIFI_CONFIG_STR(CONFIG_OAI_SESSION_SILENCE_DURATION_MS) "\">\n" \
+    "\n" \
     "            <input type=\"submit\" value=\"Submit\">\n" \
     "        </form>\n" \
     "    </div>\n" \
@@ -271,6 +298,33 @@ static const httpd_uri_t root = {
     .user_ctx  = NULL
 };
 
+/**
+ * @brief Decode an application/x-www-form-urlencoded value in place:
+ *        '+' becomes a space and %XX the byte it encodes.
+ * @return false if an escape is malformed.
+ */
+static bool url_decode(char *value)
+{
+    char *out = value;
+    for (const char *in = value; *in != '\0'; in++) {
+        if (*in == '+') {
+            *out++ = ' ';
+        } else if (*in == '%') {
+            unsigned byte;
+            if (!isxdigit((unsigned char)in[1]) || !isxdigit((unsigned char)in[2]) ||
+                sscanf(in + 1, "%2x", &byte) != 1 || byte == 0) {
+                return false;
+            }
+            *out++ = (char)byte;
+            in += 2;
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+    return true;
+}
+
 /**
  * @brief Handle the POST request from the web configuration form.
  *        Parses the submitted SSID, password, and OpenAI key.
@@ -308,6 +362,30 @@ static esp_err_t configure_post_handler(httpd_req_t *req)
     sscanf(password_start, "password=%[^&]", web_wifi_config_data.password);
     sscanf(key_start, "openai_key=%[^&]", web_wifi_config_data.openai_key);
 
+    /* Optional session settings */
+    char *voice_start = strstr(buf, "voice=");
+    char *threshold_start = strstr(buf, "vad_threshold=");
+    char *silence_start = strstr(buf, "silence_ms=");
+    unsigned value;
+    if (voice_start) {
+        /* Room for every character of the longest voice percent-encoded */
+        char voice[3 * OAI_SESSION_VOICE_SIZE] = "";
+        sscanf(voice_start, "voice=%47[^&]", voice);
+        if (!url_decode(voice) || strlen(voice) >= sizeof(web_session_config_data.voice) ||
+            (voice[0] != '\0' && !oai_session_voice_valid(voice))) {
+            ESP_LOGE(TAG, "Unknown voice");
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown voice");
+            return ESP_FAIL;
+        }
+        strcpy(web_session_config_data.voice, voice);
+    }
+    if (threshold_start && sscanf(threshold_start, "vad_threshold=%u", &value) == 1 && value <= 1000) {
+        web_session_config_data.vad_threshold_permille = value;
+    }
+    if (silence_start && sscanf(silence_start, "silence_ms=%u", &value) == 1 && value <= UINT16_MAX) {
+        web_session_config_data.silence_duration_ms = value;
+    }
+
     const char *success_html = 
         "<!DOCTYPE html>\n"
         "<html lang=\"en\">\n"
@@ -503,6 +581,83 @@ void write_wifi_config_to_nvs(const wifi_config_data_t *config) {
     }
 }
 
+/**
+ * @brief Override session settings with the ones stored in NVS.
+ *        Keys that were never written leave the passed-in defaults alone.
+ * @param config Configuration holding the defaults, updated in place.
+ * @return true if the session namespace exists, false otherwise.
+ */
+bool read_session_config_from_nvs(oai_session_config_t *config) {
+    nvs_handle_t my_nvs_handle;
+    esp_err_t err = nvs_open(NVS_SESSION_NAMESPACE, NVS_READONLY, &my_nvs_handle);
+    if (err != ESP_OK) {
+        return false;
+    }
+
+    /* nvs_get_str leaves the buffer untouched when the key is missing */
+    size_t len;
+    len = sizeof(config->model);
+    nvs_get_str(my_nvs_handle, "model", config->model, &len);
+    len = sizeof(config->voice);
+    nvs_get_str(my_nvs_handle, "voice", config->voice, &len);
+    len = sizeof(config->instructions);
+    nvs_get_str(my_nvs_handle, "instructions", config->instructions, &len);
+    len = sizeof(config->greeting);
+    nvs_get_str(my_nvs_handle, "greeting", config->greeting, &len);
+
+    nvs_get_u16(my_nvs_handle, "vad_threshold", &config->vad_threshold_permille);
+    nvs_get_u16(my_nvs_handle, "prefix_ms", &config->prefix_padding_ms);
+    nvs_get_u16(my_nvs_handle, "silence_ms", &config->silence_duration_ms);
+
+    nvs_close(my_nvs_handle);
+    return true;
+}
+
+/**
+ * @brief Write session settings to NVS.
+ *        Empty strings and zero values are skipped so the compiled defaults
+ *        keep applying to anything that was not set.
+ * @param config Pointer to the settings to write.
+ */
+void write_session_config_to_nvs(const oai_session_config_t *config) {
+    nvs_handle_t my_nvs_handle;
+    esp_err_t err = nvs_open(NVS_SESSION_NAMESPACE, NVS_READWRITE, &my_nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "NVS open failed: %s", esp_err_to_name(err));
+        return;
+    }
+
+    err = ESP_OK;
+    if (strlen(config->model) > 0) {
+        err |= nvs_set_str(my_nvs_handle, "model", config->model);
+    }
+    if (strlen(config->voice) > 0) {
+        err |= nvs_set_str(my_nvs_handle, "voice", config->voice);
+    }
+    if (strlen(config->instructions) > 0) {
+        err |= nvs_set_str(my_nvs_handle, "instructions", config->instructions);
+    }
+    if (strlen(config->greeting) > 0) {
+        err |= nvs_set_str(my_nvs_handle, "greeting", config->greeting);
+    }
+    if (config->vad_threshold_permille > 0) {
+        err |= nvs_set_u16(my_nvs_handle, "vad_threshold", config->vad_threshold_permille);
+    }
+    if (config->prefix_padding_ms > 0) {
+        err |= nvs_set_u16(my_nvs_handle, "prefix_ms", config->prefix_padding_ms);
+    }
+    if (config->silence_duration_ms > 0) {
+        err |= nvs_set_u16(my_nvs_handle, "silence_ms", config->silence_duration_ms);
+    }
+
+    err |= nvs_commit(my_nvs_handle);
+    nvs_close(my_nvs_handle);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "NVS write failed: %s", esp_err_to_name(err));
+    }
+}
+
 /**
  * @brief Clear all saved WiFi configuration data from NVS.
  */
@@ -562,6 +717,7 @@ void wifi_config_init(void) {
         ESP_ERROR_CHECK(esp_wifi_stop());
         esp_netif_destroy(esp_netif_ap);
         write_wifi_config_to_nvs(web_config);
+        write_session_config_to_nvs(get_web_session_config_data());
         esp_restart();
     }
 }
\ No newline at end of file
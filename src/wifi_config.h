@@ -3,6 +3,7 @@
 
 #include "esp_netif.h"
 #include "esp_event.h"
+#include "session_config.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,6 +31,9 @@ void stop_wifi_config_webserver(void);  // Stop the web server and release resou
 bool read_wifi_config_from_nvs(wifi_config_data_t *config); // Read WiFi config from NVS
 void write_wifi_config_to_nvs(const wifi_config_data_t *config); // Write WiFi config to NVS
 void clear_nvs_config(void); // Clear stored WiFi configuration in NVS
+const oai_session_config_t* get_web_session_config_data(void); // Get session settings submitted via web
+bool read_session_config_from_nvs(oai_session_config_t *config); // Override config with stored session settings
+void write_session_config_to_nvs(const oai_session_config_t *config); // Write session settings to NVS
 
 void wifi_config_init(void);
 